@@ -0,0 +1,372 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include "opencv2/opencv.hpp"
+#include "src/utils/roi_mask.hpp"
+#include "src/utils/seq_greyscale_converter.hpp"
+#include "src/utils/seq_smoother.hpp"
+#include "src/nthreads/greyscale_converter.hpp"
+#include "src/nthreads/smoother.hpp"
+#include "src/nthreads/comparer.hpp"
+#include "src/fastflow/farm/ff_farm_worker.hpp"
+#include "src/fastflow/mw/ff_worker.hpp"
+#include "src/utils/half_float.hpp"
+#include "src/utils/tiled_stages.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Result of the benchmark of a kernel at a resolution
+ *
+ */
+struct BenchResult {
+    string kernel;
+    string resolution;
+    long pixels;
+    double median_usec;
+    double mean_usec;
+    double stddev_usec;
+    double mad_usec; // median absolute deviation of the repetitions, robust to outliers
+    double ns_per_pixel;
+    double gbps;
+};
+
+/**
+ * @brief Class that runs the stage kernels on synthetic frames and measures them, without decoding,
+ *        process startup and file I/O
+ *
+ */
+class KernelBench {
+
+    private:
+        int warmup;
+        int repetitions;
+        vector<BenchResult> results;
+
+        /**
+         * @brief Fills a matrix with deterministic pseudo-random values in [0,1]
+         *
+         * @param m the matrix to fill
+         * @param seed seed of the generator
+         */
+        void fill(Mat & m, unsigned int seed) {
+            float * p = (float *) m.data;
+            long n = (long) m.total() * m.channels();
+            unsigned int x = seed;
+            for (long i=0; i<n; i++) {
+                x = x * 1664525 + 1013904223;
+                p[i] = (float) (x >> 8) / (float) (1 << 24);
+            }
+        }
+
+    public:
+
+        KernelBench(int warmup, int repetitions): warmup(warmup), repetitions(repetitions) {}
+
+        /**
+         * @brief Measures a kernel, the input is prepared before each call and the output released
+         *        after it, so that only the kernel is timed
+         *
+         * @param kernel name of the kernel
+         * @param resolution name of the resolution
+         * @param rows rows of the frames
+         * @param cols columns of the frames
+         * @param bytes_per_pixel bytes read and written by the kernel for each pixel
+         * @param prepare function that prepares the input
+         * @param run function that runs the kernel on the input
+         * @param release function that releases the output
+         */
+        void measure(string kernel, string resolution, int rows, int cols, int bytes_per_pixel,
+            function<void()> prepare, function<void()> run, function<void()> release) {
+            vector<double> usecs;
+            for (int i=0; i<this->warmup + this->repetitions; i++) {
+                prepare();
+                auto start = std::chrono::high_resolution_clock::now();
+                run();
+                auto duration = std::chrono::high_resolution_clock::now() - start;
+                release();
+                if (i >= this->warmup) usecs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / 1000.0);
+            }
+            BenchResult r;
+            r.kernel = kernel;
+            r.resolution = resolution;
+            r.pixels = (long) rows * cols;
+            double sum = 0;
+            for (double u : usecs) sum += u;
+            r.mean_usec = sum / usecs.size();
+            double var = 0;
+            for (double u : usecs) var += (u - r.mean_usec) * (u - r.mean_usec);
+            r.stddev_usec = (usecs.size() > 1) ? sqrt(var / (usecs.size() - 1)) : 0;
+            sort(usecs.begin(), usecs.end());
+            r.median_usec = usecs[usecs.size() / 2];
+            vector<double> deviations;
+            for (double u : usecs) deviations.push_back(fabs(u - r.median_usec));
+            sort(deviations.begin(), deviations.end());
+            r.mad_usec = deviations[deviations.size() / 2];
+            r.ns_per_pixel = r.median_usec * 1000.0 / r.pixels;
+            r.gbps = (double) r.pixels * bytes_per_pixel / (r.median_usec * 1000.0);
+            (this->results).push_back(r);
+            cout << left << setw(40) << kernel << setw(8) << resolution << right << fixed << setprecision(1) <<
+                setw(12) << r.median_usec << " usec" << setprecision(3) << setw(10) << r.ns_per_pixel << " ns/px" <<
+                setprecision(2) << setw(9) << r.gbps << " GB/s" << setprecision(1) << "  stddev " << r.stddev_usec << " usec" << endl;
+        }
+
+        /**
+         * @brief Runs all the variants of the kernels at a resolution
+         *
+         * @param resolution name of the resolution
+         * @param rows rows of the frames
+         * @param cols columns of the frames
+         */
+        void run_resolution(string resolution, int rows, int cols) {
+            RoiMask roi(rows, cols);
+            Mat colour = Mat(rows, cols, CV_32FC3);
+            this->fill(colour, 1);
+            Mat grey = Mat(rows, cols, CV_32F);
+            this->fill(grey, 2);
+            Mat background = Mat(rows, cols, CV_32F);
+            this->fill(background, 3);
+            float threshold = 0.05;
+
+            GreyscaleConverter converter(&roi, false, false);
+            GreyscaleConverterSeq converterseq(&roi, false, false);
+            Smoother smoother(&roi, false, false);
+            Comparer comparer(background, threshold, &roi, false, false);
+            FarmWorker farm_worker(background, threshold, &roi, nullptr, false, false);
+            Worker mw_worker(background, threshold, &roi, nullptr, false, false);
+
+            // Inputs and outputs of the kernels that work on pointers and delete their input
+            Mat * in = nullptr;
+            Mat * out = nullptr;
+            Mat seq_out;
+            float result = 0;
+            auto prepare_colour = [&]() { in = new Mat(colour.clone()); };
+            auto prepare_grey = [&]() { in = new Mat(grey.clone()); };
+            auto release = [&]() { delete out; out = nullptr; seq_out.release(); };
+            auto nothing = [&]() {};
+
+            // Greyscale conversion reads three floats and writes one for each pixel
+            this->measure("GreyscaleConverter::convert_to_greyscale", resolution, rows, cols, 16,
+                prepare_colour, [&]() { out = converter.convert_to_greyscale(in); }, release);
+            this->measure("GreyscaleConverterSeq::convert_to_greyscale", resolution, rows, cols, 16,
+                nothing, [&]() { seq_out = converterseq.convert_to_greyscale(colour); }, release);
+            this->measure("FarmWorker::convert_to_greyscale", resolution, rows, cols, 16,
+                prepare_colour, [&]() { out = farm_worker.convert_to_greyscale(in); }, release);
+            this->measure("Worker::convert_to_greyscale", resolution, rows, cols, 16,
+                prepare_colour, [&]() { out = mw_worker.convert_to_greyscale(in); }, release);
+
+            // Smoothing reads one float and writes one for each pixel, the neighbours are in cache
+            this->measure("Smoother::smoothing", resolution, rows, cols, 8,
+                prepare_grey, [&]() { out = smoother.smoothing(in); }, release);
+            this->measure("SmootherSeq::smoothing", resolution, rows, cols, 8,
+                nothing, [&]() { SmootherSeq s(grey, &roi, false, false); seq_out = s.smoothing(); }, release);
+            this->measure("FarmWorker::smoothing", resolution, rows, cols, 8,
+                prepare_grey, [&]() { out = farm_worker.smoothing(in); }, release);
+            this->measure("Worker::smoothing", resolution, rows, cols, 8,
+                prepare_grey, [&]() { out = mw_worker.smoothing(in); }, release);
+
+            // Background subtraction reads two floats for each pixel, the mask of one bit per pixel stays in cache
+            this->measure("Comparer::different_pixels", resolution, rows, cols, 8,
+                prepare_grey, [&]() { result = comparer.different_pixels(in); }, nothing);
+            this->measure("FarmWorker::different_pixels", resolution, rows, cols, 8,
+                prepare_grey, [&]() { result = farm_worker.different_pixels(in); }, nothing);
+            this->measure("Worker::different_pixels", resolution, rows, cols, 8,
+                prepare_grey, [&]() { result = mw_worker.different_pixels(in); }, nothing);
+
+            // Average intensity reads one float for each pixel
+            this->measure("GreyscaleConverter::get_avg_intensity", resolution, rows, cols, 4,
+                nothing, [&]() { result = converter.get_avg_intensity(grey); }, nothing);
+            this->measure("GreyscaleConverterSeq::get_avg_intensity", resolution, rows, cols, 4,
+                nothing, [&]() { result = converterseq.get_avg_intensity(grey); }, nothing);
+
+            // The half float kernels of the -half mode read and write two bytes for each greyscale pixel
+            Mat grey_half = HalfFloat::to_half(grey);
+            Mat background_half = HalfFloat::to_half(background);
+            this->measure("HalfFloat::greyscale", resolution, rows, cols, 14,
+                nothing, [&]() { seq_out = HalfFloat::greyscale(colour, roi); }, release);
+            this->measure("HalfFloat::smoothing", resolution, rows, cols, 4,
+                nothing, [&]() { seq_out = HalfFloat::smoothing(grey_half, roi); }, release);
+            MotionMask half_mask;
+            this->measure("MotionMask::compare half", resolution, rows, cols, 4,
+                nothing, [&]() { result = half_mask.compare(grey_half, background_half, threshold, roi); }, nothing);
+            if (result < 0) cout << "Unexpected result" << endl;
+        }
+
+        /**
+         * @brief Compares the tiled execution of the three stages with the full frame one, where each stage
+         *        goes through the whole frame before the next, with the tiles sized from the cache and with
+         *        given heights. Both read the colour frame and the background
+         *
+         * @param resolution name of the resolution
+         * @param rows rows of the frames
+         * @param cols columns of the frames
+         */
+        void run_tiled(string resolution, int rows, int cols) {
+            RoiMask roi(rows, cols);
+            Mat colour = Mat(rows, cols, CV_32FC3);
+            this->fill(colour, 1);
+            Mat background = Mat(rows, cols, CV_32F);
+            this->fill(background, 3);
+            float threshold = 0.05;
+
+            GreyscaleConverter converter(&roi, false, false);
+            Smoother smoother(&roi, false, false);
+            Comparer comparer(background, threshold, &roi, false, false);
+            Mat * in = nullptr;
+            float full = 0;
+            float result = 0;
+            auto prepare_colour = [&]() { in = new Mat(colour.clone()); };
+            auto release = [&]() { delete in; in = nullptr; };
+            auto nothing = [&]() {};
+
+            this->measure("Full frame stages", resolution, rows, cols, 16,
+                prepare_colour, [&]() { full = comparer.different_pixels(smoother.smoothing(converter.convert_to_greyscale(in))); in = nullptr; }, nothing);
+            TiledStages fitted(background, threshold, &roi);
+            int fitted_rows = fitted.get_tile_rows(colour);
+            this->measure("TiledStages::run (" + to_string(fitted_rows) + " rows, fitted)", resolution, rows, cols, 16,
+                prepare_colour, [&]() { result = fitted.run(*in); }, release);
+            if (result != full) cout << "Tiled result " << result << " differs from the full frame one " << full << endl;
+            for (int r : {4, 32, 128}) {
+                if (r == fitted_rows) continue;
+                TiledStages tiled(background, threshold, &roi, r);
+                this->measure("TiledStages::run (" + to_string(r) + " rows)", resolution, rows, cols, 16,
+                    prepare_colour, [&]() { result = tiled.run(*in); }, release);
+                if (result != full) cout << "Tiled result " << result << " differs from the full frame one " << full << endl;
+            }
+        }
+
+        /**
+         * @brief Checks the accuracy of the half float stages against the FP32 ones, on a frame that
+         *        differs from the background by noise and by a bright rectangle, so that many pixels are
+         *        close to the threshold
+         *
+         * @param resolution name of the resolution
+         * @param rows rows of the frames
+         * @param cols columns of the frames
+         * @return the number of pixels whose comparison with the threshold differs
+         */
+        long check_half(string resolution, int rows, int cols) {
+            RoiMask roi(rows, cols);
+            GreyscaleConverterSeq converter(&roi, false, false);
+            Mat colour = Mat(rows, cols, CV_32FC3);
+            this->fill(colour, 1);
+            Mat frame = colour.clone();
+            Mat noise = Mat(rows, cols, CV_32FC3);
+            this->fill(noise, 4);
+            float * pf = (float *) frame.data;
+            float * pn = (float *) noise.data;
+            for (long i=0; i<(long) rows * cols * 3; i++) {
+                long r = i / (3L * cols);
+                long c = (i / 3) % cols;
+                float bright = (r > rows / 4 && r < rows / 2 && c > cols / 4 && c < cols / 2) ? 0.3 : 0;
+                pf[i] = min(max(pf[i] + (pn[i] - 0.5f) * 0.3f + bright, 0.0f), 1.0f);
+            }
+
+            // FP32 stages
+            SmootherSeq bs(converter.convert_to_greyscale(colour), &roi, false, false);
+            Mat background = bs.smoothing();
+            float threshold = converter.get_avg_intensity(background) / 10;
+            SmootherSeq fs(converter.convert_to_greyscale(frame), &roi, false, false);
+            Mat smoothed = fs.smoothing();
+            // Half float stages, with the background converted as in the comparer
+            Mat smoothed_half = HalfFloat::to_float(HalfFloat::smoothing(HalfFloat::greyscale(frame, roi), roi));
+            Mat background_half = HalfFloat::to_float(HalfFloat::to_half(background));
+
+            long full = 0;
+            long half = 0;
+            long flipped = 0;
+            float max_error = 0;
+            for (int i=0; i<rows; i++) {
+                float * a = smoothed.ptr<float>(i);
+                float * b = background.ptr<float>(i);
+                float * ah = smoothed_half.ptr<float>(i);
+                float * bh = background_half.ptr<float>(i);
+                for (int j=0; j<cols; j++) {
+                    bool d = abs(a[j] - b[j]) > threshold;
+                    bool dh = abs(ah[j] - bh[j]) > threshold;
+                    full += d;
+                    half += dh;
+                    flipped += d != dh;
+                    max_error = max(max_error, abs(a[j] - ah[j]));
+                }
+            }
+            long pixels = (long) rows * cols;
+            cout << "Half floats " << resolution << ": max error " << setprecision(6) << max_error << ", different pixels " <<
+                setprecision(4) << 100.0 * full / pixels << "% FP32, " << 100.0 * half / pixels << "% FP16, " << flipped <<
+                " pixels flipped (" << 100.0 * flipped / pixels << "%)" << endl;
+            return flipped;
+        }
+
+        /**
+         * @brief Writes the results in a CSV file
+         *
+         * @param filename name of the file
+         */
+        void write_csv(string filename) {
+            ofstream file;
+            file.open(filename);
+            file << "kernel,resolution,pixels,median_usec,mean_usec,stddev_usec,mad_usec,ns_per_pixel,gbps" << endl;
+            for (BenchResult & r : this->results) {
+                file << r.kernel << "," << r.resolution << "," << r.pixels << "," << r.median_usec << "," << r.mean_usec << "," <<
+                    r.stddev_usec << "," << r.mad_usec << "," << r.ns_per_pixel << "," << r.gbps << endl;
+            }
+            file.close();
+        }
+};
+
+/**
+ * @brief Print how to use the program
+ *
+ * @param prog the name of the program
+ */
+void print_usage(string prog) {
+    cout << "Basic usage is " << prog << endl;
+    cout << "Options are: \n" <<
+    "-reps: number of measured repetitions of each kernel (default 20)\n" <<
+    "-warmup: number of repetitions before measuring (default 3)\n" <<
+    "-res: runs only one resolution among 480p, 1080p and 4k, or 8k that runs only the tiled execution\n" <<
+    "-csv: writes the results in the given CSV file"
+    << endl;
+}
+
+// Microbenchmarks of the stage kernels
+int main(int argc, char * argv[]) {
+
+    int repetitions = 20;
+    int warmup = 3;
+    string only = "";
+    string csv = "";
+
+    // Options parsing
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc) repetitions = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) warmup = max(atoi(argv[i + 1]), 0);
+        if (strcmp(argv[i], "-res") == 0 && i + 1 < argc) only = argv[i + 1];
+        if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc) csv = argv[i + 1];
+    }
+
+    cout << "Kernel microbenchmarks, " << warmup << " warm-up and " << repetitions << " measured repetitions" << endl;
+    KernelBench bench(warmup, repetitions);
+    if (only.empty() || only == "480p") bench.run_resolution("480p", 480, 640);
+    if (only.empty() || only == "1080p") bench.run_resolution("1080p", 1080, 1920);
+    if (only.empty() || only == "4k") bench.run_resolution("4k", 2160, 3840);
+    // Tiled execution of the stages against the full frame one, 8K only if asked since a frame takes 400 MB
+    if (only.empty() || only == "1080p") bench.run_tiled("1080p", 1080, 1920);
+    if (only.empty() || only == "4k") bench.run_tiled("4k", 2160, 3840);
+    if (only == "8k") bench.run_tiled("8k", 4320, 7680);
+    // Accuracy of the -half mode of nt, on the same resolutions
+    if (only.empty() || only == "480p") bench.check_half("480p", 480, 640);
+    if (only.empty() || only == "1080p") bench.check_half("1080p", 1080, 1920);
+    if (only.empty() || only == "4k") bench.check_half("4k", 2160, 3840);
+    if (!csv.empty()) bench.write_csv(csv);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <chrono>
+#include "opencv2/opencv.hpp"
+#include "src/detector/motion_detector.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Print how to use the program
+ *
+ * @param prog name of the program
+ */
+void print_usage(string prog) {
+    cout << "Basic usage is " << prog << " backend k filename [filename ...]" << endl;
+    cout << "The backend is one of seq, nt, fffarm, ffmw. The videos are pushed frame by frame to the same detector,\n" <<
+    "that keeps its threads between them" << endl;
+    cout << "Options are: \n" <<
+    "-nw: specifies the number of workers of the parallel backends\n" <<
+    "-roi: image or polygons file with the region of interest, pixels outside are not analyzed\n" <<
+    "-bgframes: the background is the per pixel median of this number of first frames (default 1)\n" <<
+    "-queue: number of pushed frames after which the push waits for the detector (default 16)\n" <<
+    "-membudget: bytes of the frames in flight in the parallel backends, with K, M or G suffix\n" <<
+    "-policy: order of the tasks of the nt backend, newest (default), fifo, oldest or stage\n" <<
+    "-masks: prints with the verdict of each frame the rectangle that holds its different pixels\n" <<
+    "-show: prints the verdict of each frame"
+    << endl;
+}
+
+// Example of use of the motion detector library
+int main(int argc, char * argv[]) {
+
+    if (argc < 4) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    Backend backend;
+    string name = argv[1];
+    if (name == "seq") backend = SEQUENTIAL;
+    else if (name == "nt") backend = THREAD_POOL;
+    else if (name == "fffarm") backend = FF_FARM;
+    else if (name == "ffmw") backend = FF_MASTER_WORKER;
+    else {
+        print_usage(argv[0]);
+        return 1;
+    }
+    DetectorConfig config;
+    config.k = atoi(argv[2]);
+    bool show = false;
+    vector<string> videos;
+
+    // Options parsing
+    for (int i=3; i<argc; i++) {
+        if (strcmp(argv[i], "-help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-nw") == 0 && i + 1 < argc) config.nw = max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "-roi") == 0 && i + 1 < argc) config.roi_file = argv[++i];
+        else if (strcmp(argv[i], "-bgframes") == 0 && i + 1 < argc) config.bg_frames = max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "-queue") == 0 && i + 1 < argc) config.queue_capacity = max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "-membudget") == 0 && i + 1 < argc) config.mem_budget = InFlightCounter::parse_bytes(argv[++i]);
+        else if (strcmp(argv[i], "-policy") == 0 && i + 1 < argc) {
+            if (!parse_policy(argv[++i], config.policy)) {
+                cout << "Unknown scheduling policy " << argv[i] << endl;
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-masks") == 0) config.masks = true;
+        else if (strcmp(argv[i], "-show") == 0) show = true;
+        else videos.push_back(argv[i]);
+    }
+
+    MotionDetector detector(backend, config);
+    for (string & video : videos) {
+        auto start = std::chrono::high_resolution_clock::now();
+        FrameReader reader(video, false, -1);
+        detector.begin([show](const Verdict & v) {
+            if (!show) return;
+            string region = "";
+            if (v.mask != nullptr) {
+                Rect r = v.mask->bounding_box();
+                if (r.width > 0) region = ", region " + to_string(r.width) + "x" + to_string(r.height) + " at " + to_string(r.x) + "," + to_string(r.y);
+            }
+            cout << "Frame " << v.frame << ": " << v.fraction * 100 << "% different" << (v.motion ? ", motion" : "") << region << endl;
+        });
+        Mat frame;
+        while (reader.read(frame)) detector.push(frame);
+        reader.release();
+        int different_frames = detector.end();
+        auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        cout << video << ": " << different_frames << " frames with motion out of " << detector.get_frames_number() <<
+            ", " << usec << " usec" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#include "opencv2/opencv.hpp"
+#include "src/utils/event_index.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Print how to use the program
+ *
+ * @param prog name of the program
+ */
+void print_usage(string prog) {
+    cout << "Basic usage is " << prog << " filename index" << endl;
+    cout << "The index is written by the detectors with -events, the video is decoded only around its events,\n" <<
+    "each one is written in its own file" << endl;
+    cout << "Options are: \n" <<
+    "-out: prefix of the files of the events, followed by the number of the event and .avi (default event)\n" <<
+    "-pad: frames written before and after each event (default 0)\n" <<
+    "-event: extracts only the event with the given number, counted from 0\n" <<
+    "-list: prints the events without extracting them"
+    << endl;
+}
+
+// Writes the segments of a video with motion, seeking to them with the event index
+int main(int argc, char * argv[]) {
+
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 0;
+    }
+    string filename = argv[1];
+    string index_file = argv[2];
+    string prefix = "event";
+    int pad = 0;
+    int only = -1;
+    bool list = false;
+
+    // Options parsing
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-out") == 0 && i + 1 < argc) prefix = argv[i + 1];
+        if (strcmp(argv[i], "-pad") == 0 && i + 1 < argc) pad = max(atoi(argv[i + 1]), 0);
+        if (strcmp(argv[i], "-event") == 0 && i + 1 < argc) only = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "-list") == 0) list = true;
+    }
+
+    vector<MotionEvent> events;
+    double fps;
+    int frames;
+    if (!EventIndex::read(index_file, events, fps, frames)) {
+        cout << "Cannot read the event index " << index_file << endl;
+        return 1;
+    }
+    cout << events.size() << " events in " << frames << " frames" << endl;
+    if (list) {
+        for (int i=0; i<(int) events.size(); i++) {
+            cout << "Event " << i << ": frames " << events[i].start << "-" << events[i].end;
+            if (fps > 0) cout << ", " << events[i].start / fps << "-" << (events[i].end + 1) / fps << " s";
+            cout << ", peak " << events[i].peak * 100 << "%" << endl;
+        }
+        return 0;
+    }
+
+    VideoCapture cap(filename);
+    if (!cap.isOpened()) {
+        cout << "Cannot open " << filename << endl;
+        return 1;
+    }
+    // The index of a video without a known frame rate is written at the rate of the file
+    if (fps <= 0) fps = cap.get(CAP_PROP_FPS);
+    if (fps <= 0) fps = 25;
+    int fourcc = VideoWriter::fourcc('M', 'J', 'P', 'G');
+
+    auto start = std::chrono::high_resolution_clock::now();
+    long decoded = 0;
+    for (int i=0; i<(int) events.size(); i++) {
+        if (only >= 0 && i != only) continue;
+        int first = max(events[i].start - pad, 0);
+        int last = min(events[i].end + pad, frames - 1);
+        // Seeks directly to the event, the decoder starts from the closest key frame before it
+        if (!cap.set(CAP_PROP_POS_FRAMES, first)) {
+            cout << "Cannot seek to frame " << first << " of " << filename << endl;
+            return 1;
+        }
+        string out = prefix + to_string(i) + ".avi";
+        VideoWriter writer;
+        Mat frame;
+        int written = 0;
+        for (int f=first; f<=last && cap.read(frame); f++) {
+            if (!writer.isOpened() && !writer.open(out, fourcc, fps, frame.size(), frame.channels() > 1)) {
+                cout << "Cannot write " << out << endl;
+                return 1;
+            }
+            writer.write(frame);
+            written++;
+        }
+        decoded += written;
+        writer.release();
+        cout << "Event " << i << ": frames " << first << "-" << last << " written in " << out << " (" << written << " frames)" << endl;
+    }
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    cout << "Frames written: " << decoded << " of " << frames << ", in " << usec << " usec" << endl;
+
+    return 0;
+}
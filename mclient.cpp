@@ -0,0 +1,69 @@
+#include <iostream>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "src/daemon/job_protocol.hpp"
+
+using namespace std;
+
+/**
+ * @brief Print how to use the program
+ *
+ * @param prog name of the program
+ */
+void print_usage(string prog) {
+    cout << "Basic usage is " << prog << " filename k" << endl;
+    cout << "The video is analyzed by the daemon, the path is resolved by the daemon so it should be absolute" << endl;
+    cout << "Options are: \n" <<
+    "-socket: path of the Unix socket of the daemon (default " << DEFAULT_SOCKET << ")\n" <<
+    "-luma: reads the luma plane of the frames and skips greyscale conversion\n" <<
+    "-roi: image or polygons file with the region of interest, pixels outside are not analyzed\n" <<
+    "-verdicts: prints the result of each frame, with the region x y width height of its different pixels"
+    << endl;
+}
+
+// Client that sends a video to the daemon and prints the results
+int main(int argc, char * argv[]) {
+
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 0;
+    }
+    string socket_path = DEFAULT_SOCKET;
+    JobRequest r;
+    r.video = argv[1];
+    r.k = atoi(argv[2]);
+
+    // Options parsing
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-socket") == 0 && i + 1 < argc) socket_path = argv[i + 1];
+        if (strcmp(argv[i], "-luma") == 0) r.luma = true;
+        if (strcmp(argv[i], "-roi") == 0 && i + 1 < argc) r.roi_file = argv[i + 1];
+        if (strcmp(argv[i], "-verdicts") == 0) r.verdicts = true;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        cout << "Cannot connect to the daemon on " << socket_path << ": " << strerror(errno) << endl;
+        return 2;
+    }
+    if (!write_all(fd, r.encode())) return 2;
+
+    // The daemon sends the results when the job is finished, and an error line if it failed
+    string line;
+    bool failed = true;
+    while (read_line(fd, line)) {
+        cout << line << endl;
+        if (line.rfind("result", 0) == 0) failed = false;
+    }
+    close(fd);
+    return failed ? 1 : 0;
+}
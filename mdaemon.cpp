@@ -0,0 +1,77 @@
+#include <iostream>
+#include <csignal>
+#include "src/daemon/job_server.hpp"
+
+using namespace std;
+
+// Server stopped by the signals
+JobServer * server = nullptr;
+
+/**
+ * @brief Stops accepting jobs, the running ones are completed before the daemon exits
+ *
+ * @param signum the signal
+ */
+void stop_server(int signum) {
+    if (server != nullptr) server->shutdown_socket();
+}
+
+/**
+ * @brief Print how to use the program
+ *
+ * @param prog name of the program
+ */
+void print_usage(string prog) {
+    cout << "Basic usage is " << prog << " [options]" << endl;
+    cout << "The jobs are sent with the client, the daemon runs until it receives SIGINT or SIGTERM" << endl;
+    cout << "Options are: \n" <<
+    "-socket: path of the Unix socket (default " << DEFAULT_SOCKET << ")\n" <<
+    "-nw: number of workers shared by the jobs (default 8)\n" <<
+    "-jobs: number of jobs analyzed at the same time, the others wait (default 4)\n" <<
+    "-buffers: frame buffers kept for the next frames (default the frames that can be in flight, 0 to free them)\n" <<
+    "-mapping: threads will be mapped on cores"
+    << endl;
+}
+
+// Daemon that keeps a thread pool and analyzes the videos sent by the clients
+int main(int argc, char * argv[]) {
+
+    string socket_path = DEFAULT_SOCKET;
+    int nw = 8;
+    int jobs = 4;
+    int buffers = -1;
+    bool mapping = false;
+
+    // Options parsing
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-socket") == 0 && i + 1 < argc) socket_path = argv[i + 1];
+        if (strcmp(argv[i], "-nw") == 0 && i + 1 < argc) nw = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) jobs = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-buffers") == 0 && i + 1 < argc) buffers = max(atoi(argv[i + 1]), 0);
+        if (strcmp(argv[i], "-mapping") == 0) mapping = true;
+    }
+
+    server = new JobServer(socket_path, nw, jobs, mapping, buffers);
+    if (!server->listen_socket()) {
+        delete server;
+        return 1;
+    }
+    // Without SA_RESTART, so that accept is interrupted
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_server;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    cout << "Listening on " << socket_path << " with " << nw << " workers and " << jobs << " concurrent jobs" << endl;
+    server->run();
+    cout << server->get_jobs_done() << " jobs analyzed" << endl;
+    server->get_buffers().print_report();
+    delete server;
+
+    return 0;
+}
@@ -7,10 +7,16 @@
 #include <mutex>
 #include <vector>
 #include <ctime>
+#include <climits>
 #include "src/nthreads/thread_pool.hpp"
 #include "src/utils/file_writer.hpp"
-#include "src/utils/seq_smoother.hpp" // sequential implementation used for background preparation
-#include "src/utils/seq_greyscale_converter.hpp"
+#include "src/utils/frame_reader.hpp"
+#include "src/utils/thread_budget.hpp"
+#include "src/utils/background_builder.hpp"
+#include "src/utils/first_verdict.hpp"
+#include "src/utils/event_index.hpp"
+#include "src/utils/pyramid.hpp"
+#include "src/utils/tiled_stages.hpp"
 
 using namespace std;
 using namespace cv;
@@ -22,11 +28,34 @@ using namespace cv;
  */
 void print_usage(string prog) {
     cout << "Basic usage is " << prog << " filename k -nw number_of_threads" << endl;
+    cout << "The filename can be synthetic:WIDTHxHEIGHT,frames=N,noise=A,objects=N,size=PX,speed=PX,seed=N,fps=F,truth=FILE \n" <<
+    "to generate a deterministic video with moving objects, writing the ground truth labels in the truth file" << endl;
     cout << "Options are: \n" <<
     "-info: shows times information \n" <<
     "-show: shows results frames for each stage \n" <<
     "-nw: specifies the number of workers to use\n"<<
-    "-mapping: threads will be mapped on cores"
+    "-mapping: threads will be mapped on cores\n" <<
+    "-luma: reads the luma plane of the frames and skips greyscale conversion\n" <<
+    "-half: stores the greyscale and smoothed frames and the background as half floats\n" <<
+    "-tiled: runs the three stages on tiles of rows that fit in the L2 cache, each tile is a task of the pool\n" <<
+    "-tilerows: rows of the tiles in tiled mode (default sized from the frames)\n" <<
+    "-membudget: bytes of the frames in flight allowed, with K, M or G suffix; the reader waits for room\n" <<
+    "-affinity: the next stage of a frame runs on the worker of the previous one, the others take it only when idle\n" <<
+    "-policy: order of the tasks, newest (newest frame first, default), fifo, oldest (oldest frame first) or\n" <<
+    "         stage (later stages first, finishing the frames in flight)\n" <<
+    "-threads: total number of threads, split between decoder and workers\n" <<
+    "-decthreads: number of decoder threads taken from the -threads budget\n" <<
+    "-roi: image or polygons file with the region of interest, pixels outside are not analyzed\n" <<
+    "-bgframes: the background is the per pixel median of this number of first frames, that are not analyzed (default 1)\n" <<
+    "-realtime: reads the frames at the given frame rate (0 for the rate of the video) and drops stale frames\n" <<
+    "-deadline: deadline in msec of each frame in real time mode\n" <<
+    "-events: writes the motion events in the given index file, with a JSON sidecar with their regions, used by the extract tool\n" <<
+    "-hysteresis: an event goes on while the fraction of different pixels exceeds this ratio of k (default 0.5)\n" <<
+    "-mingap: events separated by less frames are merged (default 10)\n" <<
+    "-pyramid: analyzes each frame downsampled by this factor (2 or 4) first, and at full resolution only near k\n" <<
+    "-margin: distance in percentage points from k within which the frame is analyzed at full resolution (default 2)\n" <<
+    "-perf: reads the hardware performance counters around each stage\n" <<
+    "-trace: writes a timeline of the tasks, reader blocking and queue lengths in the given file, in Chrome Trace format"
     << endl;
 }
 
@@ -34,6 +63,7 @@ void print_usage(string prog) {
 int main(int argc, char * argv[]) {
 
     auto complessive_time_start = std::chrono::high_resolution_clock::now();
+    FirstVerdict::start();
 
     if (argc == 1) {
         print_usage(argv[0]);
@@ -47,12 +77,52 @@ int main(int argc, char * argv[]) {
     bool times = false;
     // flag to indicate if each thread must be assigned to a specific core
     bool mapping = false;
+    // flag to read only the luma plane of the frames
+    bool luma = false;
+    // flag to store the frames between the stages as half floats
+    bool half = false;
+    // flag to run the stages on the tiles of the frames, and rows of the tiles, 0 to size them from the frames
+    bool tiled = false;
+    int tile_rows = 0;
+    // bytes of the frames in flight allowed, 0 if unlimited
+    long mem_budget = 0;
+    // flag to keep the stages of a frame on the same worker
+    bool affinity = false;
+    // order in which the workers take the tasks
+    SchedPolicy policy = POLICY_NEWEST;
+    // total threads budget and decoder threads, -1 if not specified
+    int total_threads = -1;
+    int decoder_threads = -1;
+    // file with the region of interest
+    string roi_file = "";
+    // number of first frames whose median is the background
+    int bgframes = 1;
+    // frame rate of the real time mode, -1 if it is not used, and deadline of the frames in msec
+    double realtime_fps = -1;
+    int deadline_ms = -1;
+    // index file of the motion events, not written if empty, and parameters used to merge the verdicts
+    string events_file = "";
+    float hysteresis = 0.5;
+    int min_gap = 10;
+    // downsampling factor of the coarse analysis, 1 if it is not used, and margin from k in percentage points
+    int pyramid_factor = 1;
+    float margin = 2;
 
     // Options parsing
     for (int i=1; i<argc; i++) {
         if (strcmp(argv[i], "-show") == 0) show = true;
         if (strcmp(argv[i], "-info") == 0) times = true;
         if (strcmp(argv[i], "-mapping") == 0) mapping = true;
+        if (strcmp(argv[i], "-luma") == 0) luma = true;
+        if (strcmp(argv[i], "-half") == 0) half = true;
+        if (strcmp(argv[i], "-tiled") == 0) tiled = true;
+        if (strcmp(argv[i], "-affinity") == 0) affinity = true;
+        if (strcmp(argv[i], "-tilerows") == 0 && i + 1 < argc) tile_rows = max(atoi(argv[i + 1]), 0);
+        if (strcmp(argv[i], "-membudget") == 0 && i + 1 < argc) mem_budget = InFlightCounter::parse_bytes(argv[i + 1]);
+        if (strcmp(argv[i], "-policy") == 0 && i + 1 < argc && !parse_policy(argv[i + 1], policy)) {
+            cout << "Unknown scheduling policy " << argv[i + 1] << endl;
+            return 0;
+        }
         if (strcmp(argv[i], "-help") == 0) {
             print_usage(argv[0]);
             return 0;
@@ -61,14 +131,42 @@ int main(int argc, char * argv[]) {
             nw = atoi(argv[i + 1]);
             if (nw <= 0) nw = 1;
         }
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) total_threads = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "-decthreads") == 0 && i + 1 < argc) decoder_threads = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "-roi") == 0 && i + 1 < argc) roi_file = argv[i + 1];
+        if (strcmp(argv[i], "-bgframes") == 0 && i + 1 < argc) bgframes = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-realtime") == 0 && i + 1 < argc) realtime_fps = max(atof(argv[i + 1]), 0.0);
+        if (strcmp(argv[i], "-deadline") == 0 && i + 1 < argc) deadline_ms = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "-events") == 0 && i + 1 < argc) events_file = argv[i + 1];
+        if (strcmp(argv[i], "-hysteresis") == 0 && i + 1 < argc) hysteresis = min(max((float) atof(argv[i + 1]), 0.0f), 1.0f);
+        if (strcmp(argv[i], "-mingap") == 0 && i + 1 < argc) min_gap = max(atoi(argv[i + 1]), 0);
+        if (strcmp(argv[i], "-pyramid") == 0 && i + 1 < argc) pyramid_factor = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-margin") == 0 && i + 1 < argc) margin = max((float) atof(argv[i + 1]), 0.0f);
+        if (strcmp(argv[i], "-perf") == 0) PerfCounters::enable();
+        if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) TraceRecorder::enable(argv[i + 1]);
     }
 
+    // Per stage latencies are always recorded, they are written in the results file
+    StageHistograms::enable();
+    // The main thread reads the frames and submits the tasks
+    TraceRecorder::name_thread("reader");
+
+    // Splits the threads between the decoder and the workers
+    ThreadBudget budget(total_threads, decoder_threads, nw);
+    nw = budget.get_workers();
+    decoder_threads = budget.get_decoder_threads();
+    // The reader is mapped on the decoder cores before opening the video, so that the decoder threads
+    // are not mapped on the cores of the workers
+    if (mapping) budget.pin_reader();
+
     // Creation of the name of the file to write the results to
     string program_name = argv[0];
     program_name = program_name.substr(2, program_name.length()-1);
     // Name of the video
     string filename = argv[1];
-    string output_file = "results/" + filename.substr(filename.find('/')+1, filename.length() - filename.find('/')-(filename.length() - filename.find('.')) - 1) + ".txt";
+    string output_file = "results/" + filename.substr(filename.find('/')+1, filename.length() - filename.find('/')-(filename.length() - filename.find('.')) - 1) + ".csv";
+    // The frames of a synthetic video are generated from a specification given in place of the file
+    if (SyntheticSource::is_spec(filename)) output_file = "results/synthetic.csv";
     // Percent of different pixels needed to detect a movement in a frame
     int k = atoi(argv[2]); 
     float percent = (float) k / 100;
@@ -77,65 +175,173 @@ int main(int argc, char * argv[]) {
 
     cout << "Native C++ threads implementation" << endl;
     cout << "Total threads used: " << nw << endl; 
+    cout << "Decoder threads: " << ((decoder_threads > 0) ? to_string(decoder_threads) : "default") << endl;
 
-    VideoCapture cap(filename);
+    FrameReader reader(filename, luma, decoder_threads);
 
     // The first frame is taken as background image
     Mat background;
-    cap >> background;
-    if (background.empty()) return 0;
-    background.convertTo(background, CV_32F, 1.0/255.0);
-    // Greyscale conversion and smoothing
-    GreyscaleConverterSeq converterseq(show, times);
-    background = converterseq.convert_to_greyscale(background);
-    // Computes the average intensity to establish a threshold for background subtraction
-    float avg_intensity = converterseq.get_avg_intensity(background);
-    SmootherSeq s(background, show, times);
-    background = s.smoothing();
-    // Threshold to exceed to consider two pixels different
-    float threshold = (float) avg_intensity / 10;
+    if (!reader.read(background)) return 0;
+    // Region of interest of the frames, the whole frame if no file is specified
+    RoiMask roi = (roi_file.empty()) ? RoiMask(background.rows, background.cols) : RoiMask(roi_file, background.rows, background.cols);
+    if (roi.get_area() == 0) {
+        cout << "The region of interest is empty" << endl;
+        return 0;
+    }
+    // Greyscale conversion and smoothing of the background are done by the workers while the reader
+    // goes on with the next frames, the threshold comes from the average intensity before smoothing
+    // With more frames the background is their median, that ignores the objects moving in some of them
+    vector<Mat> bg_frames(1, background);
+    for (int i=1; i<bgframes; i++) {
+        Mat m;
+        if (!reader.read(m)) break;
+        bg_frames.push_back(m);
+    }
+    BackgroundBuilder builder(bg_frames, &roi, nw, false);
     
     cout << "Frames resolution: " << background.rows << "x" << background.cols << endl;
-    cout << "Background average intensity: " << avg_intensity << endl;
-    cout << "Threshold is: " << threshold << endl;
+    cout << "Codec: " << reader.get_codec() << endl;
+    if (!roi_file.empty()) cout << "Region of interest area: " << roi.get_area() << " pixels" << endl;
+
+    // With a memory budget the frames in the pool are limited by their bytes
+    InFlightCounter inflight;
+    inflight.set_budget(mem_budget, InFlightCounter::get_frame_bytes(background));
+    if (mem_budget > 0) cout << "Memory budget: " << mem_budget / (1024 * 1024) << " MB, " << inflight.frames_allowed(INT_MAX) << " frames in flight" << endl;
+
+    // Real time controller, that paces the reader and drops the stale frames
+    RealTime * rt = nullptr;
+    if (realtime_fps >= 0) {
+        rt = new RealTime((realtime_fps > 0) ? realtime_fps : reader.get_fps(), inflight.frames_allowed(2 * nw), deadline_ms);
+    }
 
     // Creation of the classes to analyze frames
-    GreyscaleConverter * converter = new GreyscaleConverter(show, times);
-    Smoother * smoother = new Smoother(show, times);
-    Comparer * comparer = new Comparer(background, threshold, show, times);
-    // Creates and starts the thread_pool
-    ThreadPool pool(smoother, converter, comparer, nw, background, threshold, percent, show, times, mapping);
+    GreyscaleConverter * converter = new GreyscaleConverter(&roi, show, times);
+    Smoother * smoother = new Smoother(&roi, show, times);
+    Comparer * comparer = new Comparer(&builder, &roi, show, times);
+    // The comparer converts the background when it receives the first half frame
+    if (half) {
+        converter->set_half();
+        smoother->set_half();
+    }
+    // Creates and starts the thread_pool, its first tasks prepare the background
+    ThreadPool pool(smoother, converter, comparer, nw, background, 0, percent, show, times, mapping);
+    if (mapping) pool.set_cpu_offset(decoder_threads);
+    pool.set_realtime(rt);
+    // In real time mode the controller already limits the frames to the ones allowed by the budget
+    if (mem_budget > 0 && rt == nullptr) pool.set_inflight(&inflight);
+    if (affinity) pool.set_affinity();
+    pool.set_policy(policy);
+    // In pyramid mode the frames far from the percentage are decided downsampled
+    Pyramid * pyramid = (pyramid_factor > 1) ? new Pyramid(&roi, pyramid_factor, percent, margin / 100, &builder) : nullptr;
+    pool.set_pyramid(pyramid);
+    // In tiled mode the three stages run on each tile in cache, the tiles of a frame are taken by different
+    // workers; the tiles are FP32, so -half is ignored
+    TiledStages * tiled_stages = (tiled) ? new TiledStages(&builder, &roi, tile_rows) : nullptr;
+    if (tiled) {
+        pool.set_tiled(tiled_stages);
+        cout << "Tiles of " << tiled_stages->get_tile_rows(background) << " rows, " << tiled_stages->tiles(background) << " for each frame" << endl;
+    }
+    // The verdicts are merged into motion events, written in the index at the end; in real time mode the
+    // frames are numbered after the drops, so they cannot be located in the video
+    EventIndex events(percent, hysteresis, min_gap, bg_frames.size());
+    double fps = reader.get_fps();
+    if (!events_file.empty() && rt == nullptr) {
+        pool.set_callback([&events](const Verdict & v) { events.add(v); });
+        pool.set_masks();
+    }
     pool.start_pool();
+    pool.submit_background(&builder);
 
     // Loop that reads frames of video
     while (true) {
+        // In real time mode waits until the next frame is available from the source
+        TimePoint arrival = (rt != nullptr) ? rt->pace() : chrono::steady_clock::now();
         // Task generation
-        Mat * frame = new Mat(background.rows, background.cols, CV_32FC3);
-        cap >> *frame;
-        if (frame->empty()) break;
-        frame->convertTo(*frame, CV_32F, 1.0/255.0);
+        Mat * frame = new Mat();
+        if (!reader.read(*frame)) {
+            delete frame;
+            break;
+        }
+        // In real time mode drops the frame if it is stale or if the pool is full
+        if (rt != nullptr && !rt->admit(arrival)) {
+            delete frame;
+            continue;
+        }
         // Increments the number of total frames
         frame_number++;   
-        // Submits the frame to be converted to greyscale
-        pool.submit_conversion_task(frame, frame_number);
+        // Submits the tiles of the frame in tiled mode, otherwise the frame to be converted to greyscale, or
+        // directly to smoothing if it is already in greyscale
+        if (tiled) pool.submit_tiled_task(frame, frame_number, arrival);
+        else if (frame->channels() == 1) pool.submit_luma_task(frame, frame_number, arrival);
+        else pool.submit_conversion_task(frame, frame_number, arrival);
     }
 
-    cap.release();
+    reader.release();
     // Communicates the total frames number to the thread pool
     pool.communicate_frames_number(frame_number);
 
     // Waits that all the threads of the pool exited and gets the number of frames with movement detected
     int different_frames = pool.get_final_result();
+    long stall_usec = pool.get_stall_usec();
+    long queue_high_water = pool.get_queue_high_water();
+    long steals = pool.get_steals();
+    // A video without frames after the background leaves it to the main thread
+    builder.wait_ready();
+
+    cout << "Background average intensity: " << builder.get_avg_intensity() << endl;
+    cout << "Threshold is: " << builder.get_threshold() << endl;
+    cout << "Background prepared in: " << builder.get_usec() << " usec from " << bg_frames.size() << " frames" << endl;
+    cout << "Time to first verdict: " << FirstVerdict::get_usec() << " usec" << endl;
+    StageMigrations::print_report();
+    pool.print_scheduling_report();
+    AllocationCounter::print_report();
+    if (affinity) cout << "Stages taken by idle workers: " << steals << endl;
+    if (mem_budget > 0 && rt == nullptr) cout << "Frames in flight high water: " << inflight.high_water() << " (" << inflight.bytes_high_water() / (1024 * 1024) << " MB)" << endl;
+    if (!events_file.empty() && rt != nullptr) cout << "The event index is not written in real time mode" << endl;
+    else if (!events_file.empty()) {
+        int n = events.write(events_file, filename, fps, frame_number + bg_frames.size());
+        if (n < 0) cout << "Cannot write the event index " << events_file << endl;
+        else cout << "Motion events: " << n << ", index written in " << events_file << endl;
+    }
 
     cout << "Number of frames with movement detected: " << different_frames << " on a total of " << frame_number << " frames" << endl;
+    // Writes the remaining log messages and prints the stage latencies
+    AsyncLogger::instance().stop();
+    if (times) StageHistograms::print_report();
+    PerfCounters::print_report(program_name);
+    TraceRecorder::write();
+    if (pyramid != nullptr) {
+        pyramid->print_report();
+        delete pyramid;
+    }
+    if (tiled_stages != nullptr) delete tiled_stages;
+    if (rt != nullptr) {
+        rt->print_report();
+        delete rt;
+    }
+
     auto complessive_duration = std::chrono::high_resolution_clock::now() - complessive_time_start;
     auto complessive_usec = std::chrono::duration_cast<std::chrono::microseconds>(complessive_duration).count();
     cout << "Total time spent: " << complessive_usec << endl;
     
     // Writes the results on a file
     FileWriter fw(output_file);
-    string time = to_string(complessive_usec);
-    fw.print_results(filename, program_name, k, nw, mapping, time, different_frames);
+    RunMetrics metrics;
+    metrics.video = filename;
+    metrics.type = program_name;
+    metrics.k = k;
+    metrics.nw = nw;
+    metrics.mapping = mapping;
+    metrics.decoder_threads = decoder_threads;
+    metrics.usec = complessive_usec;
+    metrics.different_frames = different_frames;
+    metrics.frames = frame_number;
+    metrics.rows = background.rows;
+    metrics.cols = background.cols;
+    metrics.reader_stall_usec = stall_usec;
+    metrics.queue_high_water = queue_high_water;
+    metrics.first_verdict_usec = FirstVerdict::get_usec();
+    fw.print_results(metrics);
     
     return 0;
 };
\ No newline at end of file
@@ -0,0 +1,268 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include "src/utils/csv_table.hpp"
+
+using namespace std;
+
+/**
+ * @brief Measure of a metric: median of the repetitions and their relative spread
+ *
+ */
+struct Measure {
+    bool lower_is_better; // true for times, false for throughputs
+    double median;
+    double spread; // robust relative spread of the repetitions, 1.4826 * MAD / median
+};
+
+/**
+ * @brief Class that runs the kernel and end-to-end benchmarks on a synthetic video and compares
+ *        them with a baseline measured on the same host
+ *
+ */
+class PerfCheck {
+
+    private:
+        string bindir; // directory of the executables
+        string workdir; // directory where the implementations write their results
+        string video; // specification of the synthetic video
+        int nw;
+        int runs;
+        int reps;
+        map<string, Measure> measures;
+
+        /**
+         * @brief Gets the median and the relative spread of a set of values
+         *
+         * @param values the values
+         * @param lower_is_better direction of the metric
+         * @return the measure
+         */
+        static Measure summarize(vector<double> values, bool lower_is_better) {
+            Measure m;
+            m.lower_is_better = lower_is_better;
+            sort(values.begin(), values.end());
+            m.median = values[values.size() / 2];
+            vector<double> deviations;
+            for (double v : values) deviations.push_back(fabs(v - m.median));
+            sort(deviations.begin(), deviations.end());
+            m.spread = (m.median != 0) ? 1.4826 * deviations[deviations.size() / 2] / fabs(m.median) : 0;
+            return m;
+        }
+
+        /**
+         * @brief Runs a command and checks that it succeeded
+         *
+         * @param command the command
+         * @return false if the command failed
+         */
+        static bool run(string command) {
+            int rc = system((command + " > /dev/null 2>&1").c_str());
+            if (rc != 0) cout << "Command failed: " << command << endl;
+            return rc == 0;
+        }
+
+    public:
+
+        PerfCheck(string bindir, string workdir, string video, int nw, int runs, int reps):
+            bindir(bindir), workdir(workdir), video(video), nw(nw), runs(runs), reps(reps) {}
+
+        /**
+         * @brief Runs the kernel microbenchmarks, the metric of each kernel is its time per pixel
+         *
+         * @return false if the benchmark failed
+         */
+        bool kernels() {
+            string csv = this->workdir + "/bench.csv";
+            if (!run(this->bindir + "/bench -res 480p -reps " + to_string(this->reps) + " -csv " + csv)) return false;
+            CsvTable table(csv);
+            for (size_t i=0; i<table.size(); i++) {
+                Measure m;
+                m.lower_is_better = true;
+                m.median = table.number(i, "ns_per_pixel");
+                // Same robust spread as the end-to-end metrics, from the MAD of the repetitions
+                double median_usec = table.number(i, "median_usec");
+                m.spread = (median_usec > 0) ? 1.4826 * table.number(i, "mad_usec") / median_usec : 0;
+                this->measures["kernel " + table.get(i, "kernel") + " " + table.get(i, "resolution") + " ns_per_pixel"] = m;
+            }
+            return table.size() > 0;
+        }
+
+        /**
+         * @brief Runs an implementation on the synthetic video, the metrics are the throughput and
+         *        the 99th percentile of each stage
+         *
+         * @param type name of the executable of the implementation
+         * @return false if a run failed
+         */
+        bool end_to_end(string type) {
+            string results = this->workdir + "/results/synthetic.csv";
+            unlink(results.c_str());
+            // The implementations name their results after argv[0], so they are run as ./type
+            run("ln -sf " + this->bindir + "/" + type + " " + this->workdir + "/" + type);
+            string command = "cd " + this->workdir + " && ./" + type + " '" + this->video + "' 10";
+            if (type != "seq") command += " -nw " + to_string(this->nw);
+            for (int r=0; r<this->runs; r++) {
+                if (!run(command)) return false;
+            }
+            CsvTable table(results);
+            if (table.size() == 0) {
+                cout << "No results written by " << type << endl;
+                return false;
+            }
+            map<string, vector<double>> values;
+            for (size_t i=0; i<table.size(); i++) {
+                values["fps"].push_back(table.number(i, "fps"));
+                for (string stage : {"greyscale", "smoothing", "compare"}) {
+                    if (table.number(i, stage + "_p99_usec") > 0) values[stage + "_p99_usec"].push_back(table.number(i, stage + "_p99_usec"));
+                }
+            }
+            for (auto & v : values) {
+                if (v.second.empty()) continue;
+                this->measures["e2e " + type + " " + v.first] = summarize(v.second, v.first != "fps");
+            }
+            return true;
+        }
+
+        /**
+         * @brief Writes the measures as the new baseline
+         *
+         * @param filename name of the baseline file
+         */
+        void record(string filename) {
+            if (filename.find('/') != string::npos) run("mkdir -p " + filename.substr(0, filename.rfind('/')));
+            ofstream file;
+            file.open(filename);
+            file << "metric,better,median,spread" << endl;
+            for (auto & m : this->measures) {
+                file << m.first << "," << (m.second.lower_is_better ? "lower" : "higher") << "," << m.second.median << "," << m.second.spread << endl;
+            }
+            file.close();
+            cout << this->measures.size() << " metrics written in " << filename << endl;
+        }
+
+        /**
+         * @brief Compares the measures with the baseline. A metric regresses when it gets worse by more
+         *        than the tolerance or, if larger, than three times the combined spread of the two measures
+         *
+         * @param filename name of the baseline file
+         * @param tolerance minimum relative change considered a regression
+         * @return the number of regressions, -1 if the baseline cannot be read
+         */
+        int compare(string filename, double tolerance) {
+            CsvTable baseline(filename);
+            if (baseline.size() == 0) return -1;
+            int regressions = 0;
+            cout << left << setw(58) << "metric" << right << setw(14) << "baseline" << setw(14) << "current" <<
+                setw(10) << "change" << setw(10) << "allowed" << "  status" << endl;
+            for (size_t i=0; i<baseline.size(); i++) {
+                string metric = baseline.get(i, "metric");
+                double base = baseline.number(i, "median");
+                bool lower_is_better = baseline.get(i, "better") == "lower";
+                if (this->measures.find(metric) == this->measures.end()) {
+                    cout << left << setw(58) << metric << right << "  not measured" << endl;
+                    continue;
+                }
+                Measure & m = this->measures[metric];
+                double change = (base != 0) ? (m.median - base) / base : 0;
+                double worse = lower_is_better ? change : -change;
+                double noise = sqrt(pow(baseline.number(i, "spread"), 2) + pow(m.spread, 2));
+                double allowed = max(tolerance, 3 * noise);
+                bool regressed = worse > allowed;
+                if (regressed) regressions++;
+                cout << left << setw(58) << metric << right << fixed << setprecision(3) << setw(14) << base << setw(14) << m.median <<
+                    setprecision(1) << setw(9) << change * 100 << "%" << setw(9) << allowed * 100 << "%" <<
+                    "  " << (regressed ? "REGRESSION" : (worse < -allowed ? "improved" : "ok")) << endl;
+            }
+            return regressions;
+        }
+};
+
+/**
+ * @brief Print how to use the program
+ *
+ * @param prog the name of the program
+ */
+void print_usage(string prog) {
+    cout << "Basic usage is " << prog << endl;
+    cout << "It must be run in the directory of the executables (bench, seq, nt, fffarm, ffmw)" << endl;
+    cout << "Options are: \n" <<
+    "-baseline: baseline file (default perf/baseline.csv)\n" <<
+    "-record: writes the measures as the new baseline instead of comparing them\n" <<
+    "-tolerance: minimum relative change considered a regression (default 0.10)\n" <<
+    "-video: synthetic video specification (default synthetic:640x480,frames=300,seed=7)\n" <<
+    "-nw: number of workers of the parallel implementations (default 4)\n" <<
+    "-runs: end-to-end runs of each implementation (default 5)\n" <<
+    "-reps: repetitions of each kernel microbenchmark (default 20)"
+    << endl;
+}
+
+// Performance regression check against a baseline
+int main(int argc, char * argv[]) {
+
+    string baseline = "perf/baseline.csv";
+    bool record = false;
+    double tolerance = 0.10;
+    string video = "synthetic:640x480,frames=300,seed=7";
+    int nw = 4;
+    int runs = 5;
+    int reps = 20;
+
+    // Options parsing
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-record") == 0) record = true;
+        if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc) baseline = argv[i + 1];
+        if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) tolerance = max(atof(argv[i + 1]), 0.0);
+        if (strcmp(argv[i], "-video") == 0 && i + 1 < argc) video = argv[i + 1];
+        if (strcmp(argv[i], "-nw") == 0 && i + 1 < argc) nw = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) runs = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc) reps = max(atoi(argv[i + 1]), 1);
+    }
+
+    // Without a baseline the check cannot pass, it is recorded only on request
+    if (!record && access(baseline.c_str(), R_OK) != 0) {
+        cout << "Cannot read the baseline " << baseline << ", record it on this host with -record (make perfbaseline)" << endl;
+        return 2;
+    }
+
+    // The implementations write their results in a scratch directory, not in the results of the videos
+    char workdir[] = "/tmp/perfcheckXXXXXX";
+    if (mkdtemp(workdir) == nullptr || system(("mkdir -p " + string(workdir) + "/results").c_str()) != 0) {
+        cout << "Cannot create the working directory" << endl;
+        return 2;
+    }
+
+    char bindir[4096];
+    if (getcwd(bindir, sizeof(bindir)) == nullptr) return 2;
+    PerfCheck check(bindir, workdir, video, nw, runs, reps);
+    bool ok = check.kernels();
+    for (string type : {"seq", "nt", "fffarm", "ffmw"}) ok = check.end_to_end(type) && ok;
+    system(("rm -rf " + string(workdir)).c_str());
+    if (!ok) {
+        cout << "Some benchmarks failed" << endl;
+        return 2;
+    }
+
+    if (record) {
+        check.record(baseline);
+        return 0;
+    }
+    int regressions = check.compare(baseline, tolerance);
+    if (regressions < 0) {
+        cout << "Cannot read the baseline " << baseline << ", record it on this host with -record (make perfbaseline)" << endl;
+        return 2;
+    }
+    cout << ((regressions == 0) ? "No performance regressions" : to_string(regressions) + " performance regressions") << endl;
+    return (regressions == 0) ? 0 : 1;
+}
@@ -1,6 +1,8 @@
 #include "string"
 #include <iostream>
 #include <cstring>
+#include <chrono>
+#include <fstream>
 
 using namespace std;
 
@@ -9,7 +11,8 @@ int main(int argc, char * argv[]) {
     if (argc == 1) {
         cout << "Usage is one of the following command: \n" <<
                                 argv[0] << " 1 from_nw to_nw percent video \n" <<
-                                argv[0] << " 2 nw percent video tries" <<
+                                argv[0] << " 2 nw percent video tries \n" <<
+                                argv[0] << " 3 implementation threads percent video tries" <<
                                 endl;
         return 0;
     }
@@ -88,5 +91,47 @@ int main(int argc, char * argv[]) {
         }
     } 
 
+    // Calibration of the split between decoder threads and workers for a given video, that fixes
+    // resolution and codec, trying all the splits of the threads budget
+    else if (type == 3) {
+
+        string implementation = argv[2];
+        int threads = atoi(argv[3]);
+        int percent = atoi(argv[4]);
+        string filename = argv[5];
+        int tries = (argc > 6 && argv[6][0] != '-') ? atoi(argv[6]) : 1;
+        if (tries <= 0) tries = 1;
+
+        int best_split = -1;
+        long best_usec = -1;
+        for (int d=1; d<threads; d++) {
+            string command = "./" + implementation + " " + filename + " " + to_string(percent) + 
+                " -threads " + to_string(threads) + " -decthreads " + to_string(d);
+            if (mapping) command = command + " -mapping";
+            long sum = 0;
+            for (int i=0; i<tries; i++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                system(command.c_str());
+                auto duration = std::chrono::high_resolution_clock::now() - start;
+                sum += std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+            }
+            long avg = sum / tries;
+            cout << "Decoder threads: " << d << ", workers: " << threads - d << ", average time: " << avg << " usec" << endl;
+            if (best_usec < 0 || avg < best_usec) {
+                best_usec = avg;
+                best_split = d;
+            }
+        }
+        if (best_split > 0) {
+            cout << "Best split for " << filename << " with " << threads << " threads: " << best_split << 
+                " decoder threads and " << threads - best_split << " workers" << endl;
+            // Saves the best split to reuse it for videos with the same resolution and codec
+            ofstream file;
+            file.open("results/calibration.csv", std::ios_base::app);
+            file << filename << "," << implementation << "," << threads << "," << mapping << "," << best_split << "," << best_usec << endl;
+            file.close();
+        }
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -14,30 +14,32 @@ t=$1
 p=$3
 nwp=$2
 map=$4
+# The results files store the mapping policy by name
+if [ "$map" = "1" ]; then
+    map="cores"
+elif [ "$map" = "0" ]; then
+    map="none"
+fi
 for file in $(command ls); do
-    if [[ $file == *.txt ]]; then
+    # The calibration and the scalability analysis are not results of a video
+    if [[ $file == *.csv && $file != calibration.csv && $file != scalability* ]]; then
         echo "In file $file, with k = $p, with mapping flag = $map, average values for number of threads are"
-        for ((i=-1; i<=$nwp; i++)); do
-            sum=0
-            cnt=0
-            while IFS="," read -r record type percent nw mapping usec result; do
-                if [ $nw = $i ]; then
-                    if [ $type = $t ]; then
-                        if [ $percent = $p ]; then
-                            if [ $mapping = $map ]; then
-                                sum=$(($sum + $usec))
-                                cnt=$(($cnt + 1))
-                            fi
-                        fi
-                    fi
-                fi
-            done < "$file"
-            if [ $cnt -gt 0 ]; then
-                avg=$(($sum/$cnt))
-                echo "$i $avg"
-            fi
-        done
+        # The columns are found by name in the header of the file
+        awk -F',' -v t="$t" -v p="$p" -v nwp="$nwp" -v map="$map" '
+            NR == 1 {
+                for (i = 1; i <= NF; i++) col[$i] = i
+                next
+            }
+            $col["type"] == t && $col["k"] == p && $col["mapping"] == map && $col["nw"] >= -1 && $col["nw"] <= nwp {
+                sum[$col["nw"]] += $col["usec"]
+                cnt[$col["nw"]]++
+            }
+            END {
+                for (i = -1; i <= nwp; i++) {
+                    if (cnt[i] > 0) printf "%d %d\n", i, sum[i] / cnt[i]
+                }
+            }' "$file"
     fi
 done
 
-exit 0
\ No newline at end of file
+exit 0
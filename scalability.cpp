@@ -0,0 +1,309 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include "src/utils/csv_table.hpp"
+
+using namespace std;
+
+/**
+ * @brief Configuration of a measure: runs with the same key are repetitions of the same experiment
+ *
+ */
+struct Key {
+    string video;
+    int k;
+    string mapping;
+    string type;
+
+    bool operator<(const Key & o) const {
+        return tie(video, k, mapping, type) < tie(o.video, o.k, o.mapping, o.type);
+    }
+};
+
+/**
+ * @brief Statistics of the repetitions of a configuration with a number of workers
+ *
+ */
+struct Point {
+    int nw;
+    int samples;
+    double mean_usec;
+    double ci95_usec; // half width of the 95% confidence interval of the mean
+    double speedup = 0; // against the sequential implementation, 0 if it has not been measured
+    double speedup_ci95 = 0;
+    double scalability = 0; // against the same implementation with one worker, 0 if not measured
+    double efficiency = 0;
+};
+
+/**
+ * @brief Fits of the serial fraction and saturation of an implementation
+ *
+ */
+struct Fit {
+    double amdahl = -1; // serial fraction fitted with Amdahl's law, -1 if there are too few points
+    double gustafson = -1; // serial fraction fitted with Gustafson's law, -1 if there are too few points
+    double max_speedup = 0;
+    int best_nw = 0;
+    int saturation_nw = 0;
+};
+
+/**
+ * @brief Class that reads the results files written by the implementations and computes speedup,
+ *        scalability and efficiency for each video and number of workers
+ *
+ */
+class ScalabilityAnalysis {
+
+    private:
+        // Execution times in usec of the runs, by configuration and number of workers
+        map<Key, map<int, vector<double>>> runs;
+        // Gain under which adding workers is considered saturated
+        double tolerance;
+
+        /**
+         * @brief Gets the quantile of the Student's t distribution for a 95% two-sided interval
+         *
+         * @param df degrees of freedom
+         * @return the quantile
+         */
+        static double t95(int df) {
+            static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+            if (df < 1) return 0;
+            if (df <= 30) return table[df - 1];
+            return 1.960;
+        }
+
+    public:
+
+        ScalabilityAnalysis(double tolerance): tolerance(tolerance) {}
+
+        /**
+         * @brief Reads a results file, the columns are found by name in the header
+         *
+         * @param filename name of the file
+         * @return the number of runs read
+         */
+        int read(string filename) {
+            CsvTable table(filename);
+            for (string c : {"video", "type", "k", "nw", "mapping", "usec"}) {
+                if (!table.has(c)) {
+                    cout << "Skipping " << filename << ", the column " << c << " is missing" << endl;
+                    return 0;
+                }
+            }
+            for (size_t i=0; i<table.size(); i++) {
+                Key key = {table.get(i, "video"), (int) table.number(i, "k"), table.get(i, "mapping"), table.get(i, "type")};
+                // The sequential implementation has no workers and it is the baseline of every mapping
+                if (key.type == "seq" || key.type == "seqnovect") key.mapping = "none";
+                runs[key][(int) table.number(i, "nw")].push_back(table.number(i, "usec"));
+            }
+            return table.size();
+        }
+
+        /**
+         * @brief Computes the statistics of every configuration
+         *
+         * @return the points of each configuration, ordered by number of workers
+         */
+        map<Key, vector<Point>> points() {
+            map<Key, vector<Point>> result;
+            for (auto & run : this->runs) {
+                for (auto & nw_times : run.second) {
+                    vector<double> & times = nw_times.second;
+                    Point p;
+                    p.nw = nw_times.first;
+                    p.samples = times.size();
+                    double sum = 0;
+                    for (double t : times) sum += t;
+                    p.mean_usec = sum / times.size();
+                    double var = 0;
+                    for (double t : times) var += (t - p.mean_usec) * (t - p.mean_usec);
+                    double stddev = (times.size() > 1) ? sqrt(var / (times.size() - 1)) : 0;
+                    p.ci95_usec = t95(times.size() - 1) * stddev / sqrt(times.size());
+                    result[run.first].push_back(p);
+                }
+            }
+            for (auto & r : result) {
+                if (r.first.type == "seq" || r.first.type == "seqnovect") continue;
+                // The baseline is the sequential implementation on the same video with the same k
+                Key seq_key = {r.first.video, r.first.k, "none", "seq"};
+                Point * seq = (result.count(seq_key) > 0) ? &result[seq_key][0] : nullptr;
+                Point * one = nullptr;
+                for (Point & p : r.second) if (p.nw == 1) one = &p;
+                for (Point & p : r.second) {
+                    if (seq != nullptr && p.mean_usec > 0) {
+                        p.speedup = seq->mean_usec / p.mean_usec;
+                        // The relative errors of the two means are combined
+                        double rs = seq->ci95_usec / seq->mean_usec;
+                        double rp = p.ci95_usec / p.mean_usec;
+                        p.speedup_ci95 = p.speedup * sqrt(rs * rs + rp * rp);
+                        if (p.nw > 0) p.efficiency = p.speedup / p.nw;
+                    }
+                    if (one != nullptr && p.mean_usec > 0) p.scalability = one->mean_usec / p.mean_usec;
+                }
+            }
+            return result;
+        }
+
+        /**
+         * @brief Fits the serial fraction with Amdahl's and Gustafson's laws and finds where the
+         *        implementation saturates
+         *
+         * @param points the points of the implementation, ordered by number of workers
+         * @return the fit
+         */
+        Fit fit(const vector<Point> & points) {
+            Fit f;
+            // Amdahl: T(n) = a + b / n, with serial fraction a / (a + b), fitted with least squares
+            vector<const Point *> parallel;
+            for (const Point & p : points) if (p.nw > 0) parallel.push_back(&p);
+            if (parallel.size() >= 2) {
+                double sx = 0, sy = 0, sxx = 0, sxy = 0;
+                int n = parallel.size();
+                for (const Point * p : parallel) {
+                    double x = 1.0 / p->nw;
+                    sx += x;
+                    sy += p->mean_usec;
+                    sxx += x * x;
+                    sxy += x * p->mean_usec;
+                }
+                double den = n * sxx - sx * sx;
+                if (den != 0) {
+                    double b = (n * sxy - sx * sy) / den;
+                    double a = (sy - b * sx) / n;
+                    if (a + b > 0) f.amdahl = min(max(a / (a + b), 0.0), 1.0);
+                }
+            }
+            // Gustafson: S(n) = n - s (n - 1), on the scalability, fitted with least squares
+            double num = 0, den = 0;
+            for (const Point * p : parallel) {
+                if (p->nw <= 1 || p->scalability <= 0) continue;
+                num += (p->nw - p->scalability) * (p->nw - 1);
+                den += (double) (p->nw - 1) * (p->nw - 1);
+            }
+            if (den > 0) f.gustafson = min(max(num / den, 0.0), 1.0);
+            // Saturation: fewest workers whose time is within the tolerance (or the confidence
+            // interval, if larger) of the best time
+            const Point * best = nullptr;
+            for (const Point * p : parallel) if (best == nullptr || p->mean_usec < best->mean_usec) best = p;
+            if (best != nullptr) {
+                f.best_nw = best->nw;
+                f.max_speedup = best->speedup;
+                double limit = best->mean_usec + max(best->mean_usec * this->tolerance, best->ci95_usec);
+                for (const Point * p : parallel) {
+                    if (p->mean_usec <= limit) {
+                        f.saturation_nw = p->nw;
+                        break;
+                    }
+                }
+            }
+            return f;
+        }
+
+        /**
+         * @brief Writes the points and the fits in two CSV files and prints a summary
+         *
+         * @param filename name of the file of the points, the fits are written in the same name with _fit
+         */
+        void write(string filename) {
+            map<Key, vector<Point>> all = this->points();
+            ofstream file;
+            file.open(filename);
+            file << "video,k,mapping,type,nw,samples,mean_usec,ci95_usec,speedup,speedup_ci95,scalability,efficiency" << endl;
+            for (auto & r : all) {
+                for (Point & p : r.second) {
+                    file << "\"" << r.first.video << "\"," << r.first.k << "," << r.first.mapping << "," << r.first.type << "," <<
+                        p.nw << "," << p.samples << "," << p.mean_usec << "," << p.ci95_usec << "," << p.speedup << "," <<
+                        p.speedup_ci95 << "," << p.scalability << "," << p.efficiency << endl;
+                }
+            }
+            file.close();
+
+            string fit_filename = filename.substr(0, filename.rfind('.')) + "_fit.csv";
+            file.open(fit_filename);
+            file << "video,k,mapping,type,amdahl_serial_fraction,gustafson_serial_fraction,max_speedup,best_nw,saturation_nw" << endl;
+            cout << left << setw(10) << "type" << setw(8) << "mapping" << setw(5) << "k" << right << setw(10) << "amdahl" <<
+                setw(11) << "gustafson" << setw(13) << "max speedup" << setw(9) << "best nw" << setw(12) << "saturation" << "  video" << endl;
+            for (auto & r : all) {
+                if (r.first.type == "seq" || r.first.type == "seqnovect") continue;
+                Fit f = this->fit(r.second);
+                file << "\"" << r.first.video << "\"," << r.first.k << "," << r.first.mapping << "," << r.first.type << "," <<
+                    f.amdahl << "," << f.gustafson << "," << f.max_speedup << "," << f.best_nw << "," << f.saturation_nw << endl;
+                cout << left << setw(10) << r.first.type << setw(8) << r.first.mapping << setw(5) << r.first.k << right << fixed <<
+                    setprecision(3) << setw(10) << f.amdahl << setw(11) << f.gustafson << setprecision(2) << setw(13) << f.max_speedup <<
+                    setw(9) << f.best_nw << setw(12) << f.saturation_nw << "  " << r.first.video << endl;
+            }
+            file.close();
+            cout << "Points written in " << filename << ", fits in " << fit_filename << endl;
+        }
+};
+
+/**
+ * @brief Print how to use the program
+ *
+ * @param prog the name of the program
+ */
+void print_usage(string prog) {
+    cout << "Basic usage is " << prog << " [results files]" << endl;
+    cout << "Without files all the CSV results in the results directory are read" << endl;
+    cout << "Options are: \n" <<
+    "-o: file where the points are written (default results/scalability.csv), the fits go in the same name with _fit\n" <<
+    "-tolerance: relative distance from the best time under which an implementation is saturated (default 0.05)"
+    << endl;
+}
+
+// Analysis of the scalability of the implementations
+int main(int argc, char * argv[]) {
+
+    string output = "results/scalability.csv";
+    double tolerance = 0.05;
+    vector<string> files;
+
+    // Options parsing
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output = argv[++i];
+        else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) tolerance = max(atof(argv[++i]), 0.0);
+        else files.push_back(argv[i]);
+    }
+
+    // Without files, the results of all the videos are read, skipping the ones written by the tools
+    if (files.empty()) {
+        DIR * dir = opendir("results");
+        if (dir != nullptr) {
+            struct dirent * entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                string name = entry->d_name;
+                if (name.length() < 4 || name.substr(name.length() - 4) != ".csv") continue;
+                if (name == "calibration.csv" || name.rfind("scalability", 0) == 0) continue;
+                files.push_back("results/" + name);
+            }
+            closedir(dir);
+        }
+        sort(files.begin(), files.end());
+    }
+
+    ScalabilityAnalysis analysis(tolerance);
+    int runs = 0;
+    for (string & f : files) runs += analysis.read(f);
+    if (runs == 0) {
+        cout << "No results found" << endl;
+        return 1;
+    }
+    cout << "Read " << runs << " runs from " << files.size() << " files" << endl;
+    analysis.write(output);
+
+    return 0;
+}
@@ -3,6 +3,17 @@
 #include <thread>
 #include <chrono>
 #include "src/utils/file_writer.hpp"
+#include "src/utils/frame_reader.hpp"
+#include "src/utils/roi_mask.hpp"
+#include "src/utils/latency_histogram.hpp"
+#include "src/utils/async_logger.hpp"
+#include "src/utils/perf_counters.hpp"
+#include "src/utils/trace_recorder.hpp"
+#include "src/utils/first_verdict.hpp"
+#include "src/utils/event_index.hpp"
+#include "src/utils/pyramid.hpp"
+#include "src/utils/temporal_median.hpp"
+#include "src/utils/motion_mask.hpp"
 
 using namespace std;
 using namespace cv;
@@ -11,31 +22,32 @@ using namespace cv;
  * @brief Performs smoothing of a matrix given a filter.
  * 
  * @param m matrix to filter
- * @param filter filter matrix
+ * @param roi region of interest, the pixels outside are left to 0
  * @param show flag to show the result matrix
- * @param times flag to show the execution time
  * @return The matrix m with smoothing filter applied
  */
-Mat smoothing(Mat m, bool show) {
+Mat smoothing(Mat m, RoiMask & roi, bool show) {
     Mat res = Mat(m.rows, m.cols, CV_32F, 0.0);
     float * gp = (float *) m.data;
     float * mp = (float *) res.data;
     for(int i=0; i<m.rows; i++) {
-        for (int j=0; j<m.cols; j++) { 
-            int x = j-1;
-            int y = i-1;
-            int width = 3;
-            int height = 3;
-            if (x >= 0 && y >= 0 && x + width < m.cols && y + height < m.rows) {
-                for(int z=y; z<y+height; z++) {
-                    for (int k=x; k<x+width; k++) {
-                        mp[i * res.cols + j] = mp[i * res.cols + j] + (float) (gp[z * m.cols + k] / 9);
-                        //res.at<float>(i,j) = res.at<float>(i,j) + (float) (m.at<float>(z,k)/9);
+        for (const Span & s : roi.row_spans(i)) {
+            for (int j=s.begin; j<s.end; j++) { 
+                int x = j-1;
+                int y = i-1;
+                int width = 3;
+                int height = 3;
+                if (x >= 0 && y >= 0 && x + width < m.cols && y + height < m.rows) {
+                    for(int z=y; z<y+height; z++) {
+                        for (int k=x; k<x+width; k++) {
+                            mp[i * res.cols + j] = mp[i * res.cols + j] + (float) (gp[z * m.cols + k] / 9);
+                            //res.at<float>(i,j) = res.at<float>(i,j) + (float) (m.at<float>(z,k)/9);
+                        }
                     }
                 }
-            }
-            else {
-                mp[i * res.cols + j] = gp[i * res.cols + j];
+                else {
+                    mp[i * res.cols + j] = gp[i * res.cols + j];
+                }
             }
         }
     }
@@ -50,11 +62,11 @@ Mat smoothing(Mat m, bool show) {
  * @brief Converts a matrix from colors to black and white
  * 
  * @param frame matrix to convert
+ * @param roi region of interest, only its pixels and their neighbours are converted
  * @param show flag to show the result matrix
- * @param times flag to show the execution time
  * @return Mat converted to grayscale
  */
-Mat greyscale_conversion(Mat frame, bool show) {
+Mat greyscale_conversion(Mat frame, RoiMask & roi, bool show) {
     Mat gr = Mat(frame.rows, frame.cols, CV_32F);
     float * p = (float *) frame.data;
     float r, g, b;
@@ -62,11 +74,13 @@ Mat greyscale_conversion(Mat frame, bool show) {
     int channels = frame.channels();
     auto start = std::chrono::high_resolution_clock::now();
     for(int i=0; i<frame.rows; i++) {
-        for (int j=0; j<frame.cols; j++) {
-            r = (float) p[i * frame.cols * channels + j * channels];
-            g = (float) p[i * frame.cols * channels + j * channels + 1];
-            b = (float) p[i * frame.cols * channels + j * channels + 2];
-            gp[i* frame.cols + j ] = (float) (r + g + b) / channels;
+        for (const Span & s : roi.row_halo_spans(i)) {
+            for (int j=s.begin; j<s.end; j++) {
+                r = (float) p[i * frame.cols * channels + j * channels];
+                g = (float) p[i * frame.cols * channels + j * channels + 1];
+                b = (float) p[i * frame.cols * channels + j * channels + 2];
+                gp[i* frame.cols + j ] = (float) (r + g + b) / channels;
+            }
         }
     }
     if (show) {
@@ -83,44 +97,22 @@ Mat greyscale_conversion(Mat frame, bool show) {
  * @param frame frame to subtract to background
  * @param back background matrix
  * @param threshold threshold for background subtraction
+ * @param roi region of interest, only its pixels are compared
  * @param show flag to show the result matrix
- * @param times flag to show the execution time
- * @return the fraction of different pixels between the background and the actual frame over the total
+ * @param mask where the different pixels are set, it is reused between frames
+ * @return the fraction of different pixels between the background and the actual frame over the region area
  */
-float different_pixels(Mat frame, Mat back, float threshold, bool show) {
-    int cnt = 0;
-    float * pa = (float *) frame.data;
-    float * pb = (float *) back.data;
-    for(int i=0; i<frame.rows; i++) {
-        for (int j=0; j<frame.cols; j++) {
-            float difference = (float) abs(pb[i * frame.cols + j] - pa[i * frame.cols + j]);
-            pa[i * frame.cols + j] = difference;
-            if (difference > threshold) cnt++;
-        }
-    }
+float different_pixels(Mat frame, Mat back, float threshold, RoiMask & roi, bool show, MotionMask & mask) {
+    // The different pixels are set in a bit mask and counted with popcount
+    long cnt = mask.compare(frame, back, threshold, roi);
     if (show) {
-        imshow("Background subtraction", frame);
+        imshow("Background subtraction", mask.to_image());
         waitKey(25);
     }
-    float diff_fraction = (float) cnt / frame.total();
+    float diff_fraction = (float) cnt / roi.get_area();
     return diff_fraction;
 }
 
-/**
- * @brief Gets the avg time of the times stored in a vector
- * 
- * @param usecs vector that stores the times
- * @return auto average value
- */
-auto get_avg_time(vector<chrono::microseconds> usecs) {
-    int size = usecs.size();
-    chrono::microseconds sum = 0ms;
-    for (int i=0; i<size; i++) {
-        sum += usecs[i];
-    }
-    return (chrono::microseconds) sum/size;
-}
-
 /**
  * @brief Print how to use the program
  * 
@@ -128,9 +120,21 @@ auto get_avg_time(vector<chrono::microseconds> usecs) {
  */
 void print_usage(string prog) {
     cout << "Basic usage is " << prog << " filename k" << endl;
+    cout << "The filename can be synthetic:WIDTHxHEIGHT,frames=N,noise=A,objects=N,size=PX,speed=PX,seed=N,fps=F,truth=FILE \n" <<
+    "to generate a deterministic video with moving objects, writing the ground truth labels in the truth file" << endl;
     cout << "Options are: \n" <<
     "-info: shows times information \n" <<
-    "-show: shows results frames for each stage \n"
+    "-show: shows results frames for each stage \n" <<
+    "-luma: reads the luma plane of the frames and skips greyscale conversion \n" <<
+    "-roi: image or polygons file with the region of interest, pixels outside are not analyzed \n" <<
+    "-bgframes: the background is the per pixel median of this number of first frames, that are not analyzed (default 1) \n" <<
+    "-events: writes the motion events in the given index file, with a JSON sidecar with their regions, used by the extract tool \n" <<
+    "-hysteresis: an event goes on while the fraction of different pixels exceeds this ratio of k (default 0.5) \n" <<
+    "-mingap: events separated by less frames are merged (default 10) \n" <<
+    "-pyramid: analyzes each frame downsampled by this factor (2 or 4) first, and at full resolution only near k \n" <<
+    "-margin: distance in percentage points from k within which the frame is analyzed at full resolution (default 2) \n" <<
+    "-perf: reads the hardware performance counters around each stage \n" <<
+    "-trace: writes a timeline of the stages in the given file, in Chrome Trace format \n"
     << endl;
 }
 
@@ -138,6 +142,7 @@ void print_usage(string prog) {
 int main(int argc, char * argv[]) {
 
     auto complessive_time_start = std::chrono::high_resolution_clock::now();
+    FirstVerdict::start();
 
     if (argc == 1) {
         print_usage(argv[0]);
@@ -147,17 +152,42 @@ int main(int argc, char * argv[]) {
     bool show = false;
     // flag to show the time for each phase
     bool times = false;
+    // flag to read only the luma plane of the frames
+    bool luma = false;
+    // file with the region of interest
+    string roi_file = "";
+    // number of first frames whose median is the background
+    int bgframes = 1;
+    // index file of the motion events, not written if empty, and parameters used to merge the verdicts
+    string events_file = "";
+    float hysteresis = 0.5;
+    int min_gap = 10;
+    // downsampling factor of the coarse analysis, 1 if it is not used, and margin from k in percentage points
+    int pyramid_factor = 1;
+    float margin = 2;
     // Creation of the name of the file to write the results to
     string program_name = argv[0];
     program_name = program_name.substr(2, program_name.length()-1);
     // Name of the video
     string filename = argv[1];
-    string output_file = "results/" + filename.substr(filename.find('/')+1, filename.length() - filename.find('/')-(filename.length() - filename.find('.')) - 1) + ".txt";
+    string output_file = "results/" + filename.substr(filename.find('/')+1, filename.length() - filename.find('/')-(filename.length() - filename.find('.')) - 1) + ".csv";
+    // The frames of a synthetic video are generated from a specification given in place of the file
+    if (SyntheticSource::is_spec(filename)) output_file = "results/synthetic.csv";
     
     // Options parsing
     for (int i=1; i<argc; i++) {
         if (strcmp(argv[i], "-show") == 0) show = true;
         if (strcmp(argv[i], "-info") == 0) times = true;
+        if (strcmp(argv[i], "-luma") == 0) luma = true;
+        if (strcmp(argv[i], "-roi") == 0 && i + 1 < argc) roi_file = argv[i + 1];
+        if (strcmp(argv[i], "-bgframes") == 0 && i + 1 < argc) bgframes = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-events") == 0 && i + 1 < argc) events_file = argv[i + 1];
+        if (strcmp(argv[i], "-hysteresis") == 0 && i + 1 < argc) hysteresis = min(max((float) atof(argv[i + 1]), 0.0f), 1.0f);
+        if (strcmp(argv[i], "-mingap") == 0 && i + 1 < argc) min_gap = max(atoi(argv[i + 1]), 0);
+        if (strcmp(argv[i], "-pyramid") == 0 && i + 1 < argc) pyramid_factor = max(atoi(argv[i + 1]), 1);
+        if (strcmp(argv[i], "-margin") == 0 && i + 1 < argc) margin = max((float) atof(argv[i + 1]), 0.0f);
+        if (strcmp(argv[i], "-perf") == 0) PerfCounters::enable();
+        if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) TraceRecorder::enable(argv[i + 1]);
         if (strcmp(argv[i], "-help") == 0) {
             print_usage(argv[0]);
             return 0;
@@ -168,105 +198,185 @@ int main(int argc, char * argv[]) {
     float percent = (float) k / 100; // percentage of different pixels to esceed to detect a movement
 
     cout << "Sequential implementation" << endl;
-    VideoCapture cap(filename);
+    FrameReader reader(filename, luma);
+    // The verdicts are merged into motion events, written in the index at the end
+    EventIndex events(percent, hysteresis, min_gap, bgframes);
+    double fps = reader.get_fps();
 
     int frame_number = 0;
     int different_frames = 0;
     // Threshold to exceed to consider two pixels different
     float threshold = 0;
 
-    // Vectors to save the execution time for each phase and compute the average values at the end
-    vector<chrono::microseconds> gr_usecs; 
-    vector<chrono::microseconds> sm_usecs; 
-    vector<chrono::microseconds> cmp_usecs; 
+    // The execution time of each phase is saved in histograms to compute the percentiles at the end
+    StageHistograms::enable();
+    TraceRecorder::name_thread("main");
 
-    // The first frame is used as background image
+    // The first frame is used as background image, or the median of the first frames
     Mat background; 
+    vector<Mat> bg_frames;
+    // Greyscale frames of the background before smoothing, from which the coarse background is downsampled
+    vector<Mat> bg_grey;
+    // Region of interest, created when the size of the frames is known
+    RoiMask * roi = nullptr;
+    // Coarse detector of the pyramid mode, created when the background is ready
+    Pyramid * pyramid = nullptr;
+    // Mask of the different pixels of the last frame compared, given to the event index with the verdict
+    MotionMask mask;
 
     // Read the frames from the video and perform the actions
     while(true) {
 
-        // Task generation
-        auto start = std::chrono::high_resolution_clock::now();
+        // Task generation, the reader records its time
         Mat frame; 
-        cap >> frame;
-        if (frame.empty()) break;
-        frame.convertTo(frame, CV_32F, 1.0/255.0);
-        if (times) {
-            auto duration = std::chrono::high_resolution_clock::now() - start;
-            auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-            cout << "Times spent to generate a task: " << usec << " usec" << endl;
+        if (!reader.read(frame)) break;
+        if (roi == nullptr) {
+            roi = (roi_file.empty()) ? new RoiMask(frame.rows, frame.cols) : new RoiMask(roi_file, frame.rows, frame.cols);
+            if (roi->get_area() == 0) {
+                cout << "The region of interest is empty" << endl;
+                return 0;
+            }
         }
 
-        // Greyscale conversion
-        start = std::chrono::high_resolution_clock::now();
-        frame = greyscale_conversion(frame, show);
-        if (times) {
-            auto duration = std::chrono::high_resolution_clock::now() - start;
-            auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-            gr_usecs.push_back(chrono::microseconds(usec));
-            cout << "Times spent on greyscale conversion: " << usec << " usec" << endl;
+        // In pyramid mode the full resolution stages are skipped if the downsampled frame is enough
+        if (pyramid != nullptr) {
+            float fraction;
+            bool decided;
+            {
+                TraceScope tr("coarse", "stage", frame_number);
+                decided = pyramid->decide(frame, fraction);
+            }
+            if (decided) {
+                FirstVerdict::mark();
+                if (fraction > percent) different_frames++;
+                if (!events_file.empty()) events.add({frame_number - bgframes + 1, fraction, fraction > percent});
+                frame_number++;
+                continue;
+            }
+        }
+
+        // The coarse background reads the blocks around the region, so its frames are converted in full
+        if (frame_number < bgframes && pyramid_factor > 1) {
+            RoiMask whole(frame.rows, frame.cols);
+            bg_grey.push_back((frame.channels() > 1) ? greyscale_conversion(frame, whole, false) : frame);
+        }
+
+        // Greyscale conversion, not needed if the frame is read in luma mode
+        auto start = std::chrono::high_resolution_clock::now();
+        if (frame.channels() > 1) {
+            PerfScope p(GREYSCALE, frame.total());
+            TraceScope tr(GREYSCALE, frame_number);
+            frame = greyscale_conversion(frame, *roi, show);
+            StageHistograms::record(GREYSCALE, std::chrono::high_resolution_clock::now() - start);
         }
         
         // Smoothing
         start = std::chrono::high_resolution_clock::now();
-        frame = smoothing(frame, show);
-        if (times) {
-            auto duration = std::chrono::high_resolution_clock::now() - start;
-            auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-            sm_usecs.push_back(chrono::microseconds(usec));
-            cout << "Times spent on smoothing: " << usec << " usec" << endl;
+        {
+            PerfScope p(SMOOTHING, frame.total());
+            TraceScope tr(SMOOTHING, frame_number);
+            frame = smoothing(frame, *roi, show);
         }
+        StageHistograms::record(SMOOTHING, std::chrono::high_resolution_clock::now() - start);
 
-        if (frame_number == 0) { // Case first frame taken as background
-            background = frame;
+        if (frame_number < bgframes) { // Case first frames taken as background
+            bg_frames.push_back(frame);
+            // The background is computed when the last of its frames has been smoothed
+            if (frame_number < bgframes - 1) {
+                frame_number++;
+                continue;
+            }
+            if (bgframes == 1) background = frame;
+            else {
+                background = Mat(frame.rows, frame.cols, CV_32F, 0.0);
+                TemporalMedian::median_rows(bg_frames, background, 0, frame.rows);
+                bg_frames.clear();
+            }
             // Gets the average pixel intensity of the background to create a threshold
             float sum = 0;
-            float * gp = (float *) frame.data;
+            float * gp = (float *) background.data;
             for(int i=0; i<frame.rows; i++) {
-                for (int j=0; j<frame.cols; j++) {
-                    sum = sum + gp[i* frame.cols + j];
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        sum = sum + gp[i* frame.cols + j];
+                    }
                 }
             }
-            float avg_intensity = (float) sum / frame.total();
+            float avg_intensity = (float) sum / roi->get_area();
             avg_intensity = round( avg_intensity * 100.0 ) / 100.0;
             threshold = avg_intensity / 10;
             cout << "Frames resolution: " << background.rows << " x " << background.cols << endl;
             cout << "Background average intensity: " << avg_intensity << endl;
+            if (pyramid_factor > 1) {
+                pyramid = new Pyramid(roi, pyramid_factor, percent, margin / 100, nullptr);
+                Mat grey = bg_grey[0];
+                if (bgframes > 1) {
+                    grey = Mat(frame.rows, frame.cols, CV_32F, 0.0);
+                    TemporalMedian::median_rows(bg_grey, grey, 0, frame.rows);
+                }
+                pyramid->set_background(grey, threshold);
+                bg_grey.clear();
+            }
         }
         else { // Case movement detection
             start = std::chrono::high_resolution_clock::now();
-            float different_pixels_fraction = different_pixels(frame, background, threshold, show);
+            float different_pixels_fraction;
+            {
+                PerfScope p(COMPARE, frame.total());
+                TraceScope tr(COMPARE, frame_number);
+                different_pixels_fraction = different_pixels(frame, background, threshold, *roi, show, mask);
+            }
+            FirstVerdict::mark();
             if (different_pixels_fraction > percent) different_frames++;
+            // The index reads the mask during the call, so it is not copied
+            if (!events_file.empty()) events.add({frame_number - bgframes + 1, different_pixels_fraction, different_pixels_fraction > percent,
+                shared_ptr<const MotionMask>(shared_ptr<const MotionMask>(), &mask)});
+            StageHistograms::record(COMPARE, std::chrono::high_resolution_clock::now() - start);
             if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cmp_usecs.push_back(chrono::microseconds(usec));
-                cout << "Times passed for background subtraction: " << usec << " usec" << endl;
-                cout << "Frames with movement detected until now: " << different_frames << " over " << frame_number << " analyzed" << endl;
+                AsyncLogger::instance().log("Frames with movement detected until now: " + to_string(different_frames) + " over " + to_string(frame_number) + " analyzed");
             }
         }
         // Increment the number of total frames
         frame_number++;
     }
 
-    cap.release();
+    reader.release();
+    if (pyramid != nullptr) {
+        pyramid->print_report();
+        delete pyramid;
+    }
+    delete roi;
 
     auto complessive_duration = std::chrono::high_resolution_clock::now() - complessive_time_start;
     auto complessive_usec = std::chrono::duration_cast<std::chrono::microseconds>(complessive_duration).count();
 
+    // Writes the remaining log messages
+    AsyncLogger::instance().stop();
     cout << "Number of frames with movement detected: " << different_frames << endl;
-    if (times) {
-        cout << "Average time spent for greyscale conversion: " << get_avg_time(gr_usecs).count() << endl;
-        cout << "Average time spent for smoothing: " << get_avg_time(sm_usecs).count() << endl;
-        cout << "Average time spent for background subtraction: " << get_avg_time(cmp_usecs).count() << endl;
+    if (times) StageHistograms::print_report();
+    PerfCounters::print_report(program_name);
+    TraceRecorder::write();
+    cout << "Time to first verdict: " << FirstVerdict::get_usec() << " usec" << endl;
+    if (!events_file.empty()) {
+        int n = events.write(events_file, filename, fps, frame_number);
+        if (n < 0) cout << "Cannot write the event index " << events_file << endl;
+        else cout << "Motion events: " << n << ", index written in " << events_file << endl;
     }
     cout << "Total time passed: " << complessive_usec << endl;
     
     // Write the results in a file
     FileWriter fw(output_file);
-    string time = to_string(complessive_usec);
-    fw.print_results(filename, program_name, k, -1, show, time, different_frames);
+    RunMetrics metrics;
+    metrics.video = filename;
+    metrics.type = program_name;
+    metrics.k = k;
+    metrics.usec = complessive_usec;
+    metrics.different_frames = different_frames;
+    metrics.frames = max(frame_number - bgframes, 0);
+    metrics.rows = background.rows;
+    metrics.cols = background.cols;
+    metrics.first_verdict_usec = FirstVerdict::get_usec();
+    fw.print_results(metrics);
 
     return(0);
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef JOB_PROTOCOL_HPP
+#define JOB_PROTOCOL_HPP
+
+#include <string>
+#include <sstream>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+// Socket on which the daemon listens if no other path is given
+#define DEFAULT_SOCKET "/tmp/motion_detector.sock"
+
+/**
+ * @brief Job sent by the client to the daemon. On the socket it is a line of tab separated fields,
+ *        the video is the last one so that it can contain spaces
+ *
+ */
+struct JobRequest {
+    int k = 10; // percentage of different pixels needed to detect a movement in a frame
+    bool luma = false; // reads the luma plane of the frames and skips greyscale conversion
+    bool verdicts = false; // sends back the result of each frame and the region of its different pixels, not only the totals
+    string roi_file = ""; // region of interest, the whole frame if empty
+    string video;
+
+    /**
+     * @brief Writes the request as a line
+     *
+     * @return the line, with the final newline
+     */
+    string encode() const {
+        return to_string(k) + "\t" + (luma ? "1" : "0") + "\t" + (verdicts ? "1" : "0") + "\t" +
+            (roi_file.empty() ? "-" : roi_file) + "\t" + video + "\n";
+    }
+
+    /**
+     * @brief Reads a request from a line
+     *
+     * @param line the line, without the final newline
+     * @param r where the request is stored
+     * @return false if the line is malformed
+     */
+    static bool decode(string line, JobRequest & r) {
+        stringstream ss(line);
+        string k, luma, verdicts;
+        if (!getline(ss, k, '\t') || !getline(ss, luma, '\t') || !getline(ss, verdicts, '\t') ||
+            !getline(ss, r.roi_file, '\t') || !getline(ss, r.video)) return false;
+        r.k = atoi(k.c_str());
+        r.luma = luma == "1";
+        r.verdicts = verdicts == "1";
+        if (r.roi_file == "-") r.roi_file = "";
+        return !r.video.empty() && r.k >= 0 && r.k <= 100;
+    }
+};
+
+/**
+ * @brief Reads a line from a socket
+ *
+ * @param fd the socket
+ * @param line where the line is stored, without the final newline
+ * @return false if the socket has been closed before the end of the line
+ */
+inline bool read_line(int fd, string & line) {
+    line.clear();
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (c == '\n') return true;
+        line += c;
+    }
+}
+
+/**
+ * @brief Writes a whole string on a socket
+ *
+ * @param fd the socket
+ * @param s the string
+ * @return false if the other side has closed the socket
+ */
+inline bool write_all(int fd, const string & s) {
+    size_t written = 0;
+    while (written < s.size()) {
+        // A client that went away must not kill the daemon with SIGPIPE
+        ssize_t n = send(fd, s.data() + written, s.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+#endif
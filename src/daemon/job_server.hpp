@@ -0,0 +1,296 @@
+#ifndef JOB_SERVER_HPP
+#define JOB_SERVER_HPP
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include "opencv2/opencv.hpp"
+#include "job_protocol.hpp"
+#include "../nthreads/thread_pool.hpp"
+#include "../utils/frame_reader.hpp"
+#include "../utils/roi_mask.hpp"
+#include "../utils/verdict.hpp"
+#include "../utils/seq_greyscale_converter.hpp"
+#include "../utils/seq_smoother.hpp"
+#include "../utils/frame_pool.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Daemon that analyzes the videos sent by the clients on a Unix socket. The workers are created
+ *        once and shared by the running jobs, each job is a stream of the thread pool and the workers
+ *        serve the streams in turn, so that every job gets the same share of them. The frame buffers are
+ *        kept as well, the frames of a job reuse the ones of the previous jobs of the same size
+ *
+ */
+class JobServer {
+
+    private:
+        string socket_path;
+        int listen_fd = -1;
+        ThreadPool * pool;
+        FramePool buffers; // buffers of the frames, shared by the jobs
+
+        // Admission of the jobs: at most max_jobs are read at the same time, the others wait
+        int max_jobs;
+        int running = 0;
+        mutex l;
+        condition_variable slot_free;
+
+        // Connections being served, waited before the pool is stopped
+        int connections = 0;
+        condition_variable no_connections;
+        atomic<long> jobs_done;
+
+        /**
+         * @brief Waits until a job can start
+         *
+         */
+        void admit() {
+            unique_lock<mutex> lock(this->l);
+            (this->slot_free).wait(lock, [&]() { return this->running < this->max_jobs; });
+            this->running++;
+        }
+
+        /**
+         * @brief Frees the slot of a job that has finished
+         *
+         */
+        void leave() {
+            {
+                unique_lock<mutex> lock(this->l);
+                this->running--;
+            }
+            (this->slot_free).notify_one();
+        }
+
+        /**
+         * @brief Analyzes a video with the shared pool
+         *
+         * @param r the request
+         * @param reply where the lines to send to the client are written
+         */
+        void run_job(const JobRequest & r, stringstream & reply) {
+            auto start = std::chrono::high_resolution_clock::now();
+            FrameReader reader(r.video, r.luma);
+            // Takes first frame as background
+            Mat background;
+            if (!reader.read(background)) {
+                reply << "error cannot read " << r.video << endl;
+                return;
+            }
+            // The frames are read in buffers of the pool, of the size and type of the first one
+            int rows = background.rows;
+            int cols = background.cols;
+            int type = background.type();
+            RoiMask roi = (r.roi_file.empty()) ? RoiMask(background.rows, background.cols) : RoiMask(r.roi_file, background.rows, background.cols);
+            if (roi.get_area() == 0) {
+                reply << "error the region of interest is empty" << endl;
+                return;
+            }
+            GreyscaleConverterSeq converter(&roi, false, false);
+            if (background.channels() > 1) background = converter.convert_to_greyscale(background);
+            SmootherSeq s(background, &roi, false, false);
+            background = s.smoothing();
+            float threshold = converter.get_avg_intensity(background) / 10;
+
+            // The results of the frames are collected from the workers and sent at the end, with the region
+            // of their different pixels instead of the mask, that is freed
+            mutex lverdicts;
+            vector<pair<Verdict, Rect>> verdicts;
+            VerdictCallback callback = nullptr;
+            if (r.verdicts) callback = [&](const Verdict & v) {
+                Rect region = (v.mask != nullptr) ? v.mask->bounding_box() : Rect(0, 0, 0, 0);
+                unique_lock<mutex> lock(lverdicts);
+                verdicts.push_back({{v.frame, v.fraction, v.motion}, region});
+            };
+            Smoother * smoother = new Smoother(&roi, false, false);
+            GreyscaleConverter * converter_stage = new GreyscaleConverter(&roi, false, false);
+            Comparer * comparer = new Comparer(background, threshold, &roi, false, false);
+            smoother->set_buffers(&(this->buffers));
+            converter_stage->set_buffers(&(this->buffers));
+            comparer->set_buffers(&(this->buffers));
+            int stream = (this->pool)->open_stream(smoother, converter_stage, comparer, (float) r.k / 100, callback);
+            if (r.verdicts) (this->pool)->set_masks(stream);
+            int frames = 0;
+            while (true) {
+                Mat * frame = (this->buffers).acquire(rows, cols, type);
+                if (!reader.read(*frame)) {
+                    (this->buffers).release(frame);
+                    break;
+                }
+                frames++;
+                if (frame->channels() == 1) (this->pool)->submit_luma_task(frame, frames, chrono::steady_clock::now(), stream);
+                else (this->pool)->submit_conversion_task(frame, frames, chrono::steady_clock::now(), stream);
+            }
+            reader.release();
+            (this->pool)->wait_results(frames, stream);
+            int different_frames = (this->pool)->close_stream(stream);
+            auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+            sort(verdicts.begin(), verdicts.end(), [](const pair<Verdict, Rect> & a, const pair<Verdict, Rect> & b) { return a.first.frame < b.first.frame; });
+            for (pair<Verdict, Rect> & p : verdicts) {
+                Verdict & v = p.first;
+                reply << "frame " << v.frame << " " << v.fraction << " " << (v.motion ? 1 : 0);
+                // Region of the different pixels, x y width height, when there are any
+                if (p.second.width > 0) reply << " " << p.second.x << " " << p.second.y << " " << p.second.width << " " << p.second.height;
+                reply << endl;
+            }
+            reply << "result frames=" << frames << " motion=" << different_frames << " usec=" << usec;
+        }
+
+        /**
+         * @brief Serves a client: reads its request, waits for a slot, runs the job and sends the results
+         *
+         * @param fd the socket of the client
+         */
+        void serve(int fd) {
+            string line;
+            JobRequest r;
+            if (read_line(fd, line)) {
+                stringstream reply;
+                if (!JobRequest::decode(line, r)) reply << "error malformed request" << endl;
+                else {
+                    auto queued = std::chrono::high_resolution_clock::now();
+                    this->admit();
+                    auto wait_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - queued).count();
+                    this->run_job(r, reply);
+                    this->leave();
+                    if (reply.str().rfind("error", 0) != 0) reply << " wait_usec=" << wait_usec << endl;
+                    this->jobs_done++;
+                }
+                write_all(fd, reply.str());
+            }
+            close(fd);
+            {
+                unique_lock<mutex> lock(this->l);
+                this->connections--;
+            }
+            (this->no_connections).notify_all();
+        }
+
+    public:
+
+        /**
+         * @brief Creates the daemon and starts its workers
+         *
+         * @param socket_path path of the Unix socket
+         * @param nw number of workers shared by the jobs
+         * @param max_jobs number of jobs analyzed at the same time
+         * @param mapping flag to map the workers on the cores
+         * @param max_buffers free frame buffers kept between the frames, -1 for the frames that can be in flight
+         */
+        JobServer(string socket_path, int nw, int max_jobs, bool mapping, int max_buffers = -1): socket_path(socket_path),
+            buffers((max_buffers >= 0) ? max_buffers : max(max_jobs, 1) * (11 + nw) + nw), max_jobs(max(max_jobs, 1)) {
+            this->jobs_done = 0;
+            this->pool = new ThreadPool(nw, false, mapping);
+            (this->pool)->start_pool();
+        }
+
+        ~JobServer() {
+            (this->pool)->stop_pool();
+            (this->pool)->get_final_result();
+            delete this->pool;
+        }
+
+        /**
+         * @brief Creates the socket, removing the one left by a previous daemon of the same user. The socket
+         *        can be used only by the user, so that the other users cannot submit jobs
+         *
+         * @return false if the socket cannot be created
+         */
+        bool listen_socket() {
+            struct sockaddr_un addr;
+            if ((this->socket_path).size() >= sizeof(addr.sun_path)) {
+                cout << "Socket path too long: " << this->socket_path << endl;
+                return false;
+            }
+            this->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (this->listen_fd < 0) return false;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, (this->socket_path).c_str());
+            // Any other file at the path, or the socket of another user, is left in place
+            struct stat st;
+            if (lstat((this->socket_path).c_str(), &st) == 0) {
+                if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+                    cout << "Refusing to replace " << this->socket_path << ", it is not a socket of this user" << endl;
+                    close(this->listen_fd);
+                    this->listen_fd = -1;
+                    return false;
+                }
+                unlink((this->socket_path).c_str());
+            }
+            // The socket is created with mode 0600, without a window in which the other users can connect
+            mode_t mask = umask(0177);
+            bool bound = bind(this->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+            umask(mask);
+            if (!bound || chmod((this->socket_path).c_str(), 0600) < 0 || listen(this->listen_fd, 64) < 0) {
+                cout << "Cannot listen on " << this->socket_path << ": " << strerror(errno) << endl;
+                close(this->listen_fd);
+                this->listen_fd = -1;
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Accepts the clients until the socket is shut down, each one is served by its own thread
+         *
+         */
+        void run() {
+            while (true) {
+                int fd = accept(this->listen_fd, nullptr, nullptr);
+                if (fd < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                {
+                    unique_lock<mutex> lock(this->l);
+                    this->connections++;
+                }
+                thread(&JobServer::serve, this, fd).detach();
+            }
+            // Waits for the jobs already accepted
+            unique_lock<mutex> lock(this->l);
+            (this->no_connections).wait(lock, [&]() { return this->connections == 0; });
+            unlink((this->socket_path).c_str());
+        }
+
+        /**
+         * @brief Stops accepting clients, it can be called from a signal handler
+         *
+         */
+        void shutdown_socket() {
+            if (this->listen_fd >= 0) shutdown(this->listen_fd, SHUT_RDWR);
+        }
+
+        /**
+         * @brief Gets the pool of the frame buffers
+         *
+         * @return the pool
+         */
+        FramePool & get_buffers() {
+            return this->buffers;
+        }
+
+        /**
+         * @brief Gets the number of jobs completed
+         *
+         * @return the number of jobs
+         */
+        long get_jobs_done() {
+            return this->jobs_done;
+        }
+};
+
+#endif
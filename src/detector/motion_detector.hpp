@@ -0,0 +1,376 @@
+#ifndef MOTION_DETECTOR_HPP
+#define MOTION_DETECTOR_HPP
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include <ff/ff.hpp>
+#include "../utils/frame_queue.hpp"
+#include "../utils/frame_reader.hpp"
+#include "../utils/roi_mask.hpp"
+#include "../utils/verdict.hpp"
+#include "../utils/inflight_counter.hpp"
+#include "../utils/background_builder.hpp"
+#include "../nthreads/thread_pool.hpp"
+#include "../fastflow/farm/ff_emitter.hpp"
+#include "../fastflow/farm/ff_farm_worker.hpp"
+#include "../fastflow/farm/ff_collector.hpp"
+#include "../fastflow/mw/ff_master.hpp"
+#include "../fastflow/mw/ff_emitter.hpp"
+
+using namespace std;
+using namespace cv;
+using namespace ff;
+
+/**
+ * @brief Implementations that can execute the detector
+ *
+ */
+enum Backend { SEQUENTIAL, THREAD_POOL, FF_FARM, FF_MASTER_WORKER };
+
+/**
+ * @brief Configuration of the detector, that is the same for all the videos it analyzes
+ *
+ */
+struct DetectorConfig {
+    int k = 10; // percentage of different pixels needed to detect a movement in a frame
+    int nw = 4; // number of workers of the parallel backends
+    string roi_file = ""; // image or polygons file with the region of interest, the whole frame if empty
+    size_t queue_capacity = 16; // frames pushed and not read yet, after which the push blocks
+    int bg_frames = 1; // first frames of each video whose per pixel median is the background, they are not analyzed
+    long mem_budget = 0; // bytes of the frames in flight in the parallel backends, 0 if unlimited
+    SchedPolicy policy = POLICY_NEWEST; // order of the tasks of the thread pool backend
+    bool masks = false; // gives the mask of the pixels different from the background with the verdict of each frame
+};
+
+/**
+ * @brief Motion detector that can be embedded in an application. For each video the application calls
+ *        begin, pushes the frames and calls end: the first frame is taken as background and a verdict is
+ *        given to the callback for each of the others. The threads of the parallel backends are created
+ *        with the first video and kept, frozen, for the next ones
+ *
+ */
+class MotionDetector {
+
+    private:
+        Backend backend;
+        DetectorConfig config;
+        float percent;
+
+        // The pushed frames are read by the same reader used for the video files
+        FrameQueue queue;
+        FrameReader reader;
+        // Region of interest of the current video, the stages keep a pointer to it
+        RoiMask roi;
+
+        // State of the current video
+        thread driver;
+        bool running = false;
+        VerdictCallback callback;
+        atomic<int> different_frames;
+        int frames = 0;
+
+        // Thread pool backend
+        ThreadPool * pool = nullptr;
+
+        // Frames in the parallel backends, limited by the memory budget
+        InFlightCounter inflight;
+
+        // FastFlow farm backend, the workers are owned by the farm
+        FarmEmitter * farm_emitter = nullptr;
+        Collector * collector = nullptr;
+        vector<FarmWorker *> farm_workers;
+        ff_Farm<Frame, Frame> * farm = nullptr;
+
+        // FastFlow master-worker backend, the workers are owned by the farm
+        Emitter * mw_emitter = nullptr;
+        Master * master = nullptr;
+        vector<Worker *> mw_workers;
+        ff_Farm<Mat, float> * mw_farm = nullptr;
+        ff_Pipe<Task> * pipe = nullptr;
+
+        /**
+         * @brief Counts a verdict and gives it to the application
+         *
+         * @param v the verdict
+         */
+        void verdict(const Verdict & v) {
+            if (v.motion) this->different_frames++;
+            if (this->callback) this->callback(v);
+        }
+
+        /**
+         * @brief Reads the first frames of a video and prepares the background, the region of interest and
+         *        the threshold
+         *
+         * @param background matrix where the background is stored
+         * @param threshold threshold to consider two pixels different
+         * @return false if the video has no frames or the region of interest is empty
+         */
+        bool prepare_background(Mat & background, float & threshold) {
+            if (!(this->reader).read(background)) return false;
+            // The budget is set from the frames of each video, the backends are empty between videos
+            (this->inflight).set_budget(this->config.mem_budget, InFlightCounter::get_frame_bytes(background));
+            this->roi = (this->config.roi_file.empty()) ? RoiMask(background.rows, background.cols) :
+                RoiMask(this->config.roi_file, background.rows, background.cols);
+            if ((this->roi).get_area() == 0) {
+                cout << "The region of interest is empty" << endl;
+                return false;
+            }
+            vector<Mat> frames(1, background);
+            for (int i=1; i<this->config.bg_frames; i++) {
+                Mat m;
+                if (!(this->reader).read(m)) break;
+                frames.push_back(m);
+            }
+            // The background is built by the driver thread, before the frames are given to the backend
+            BackgroundBuilder builder(frames, &(this->roi), 1, true);
+            builder.wait_ready();
+            background = builder.get_background();
+            threshold = builder.get_threshold();
+            return true;
+        }
+
+        /**
+         * @brief Analyzes the frames in the thread of the reader
+         *
+         */
+        void run_sequential(Mat background, float threshold) {
+            GreyscaleConverter converter(&(this->roi), false, false);
+            Smoother smoother(&(this->roi), false, false);
+            Comparer comparer(background, threshold, &(this->roi), false, false);
+            while (true) {
+                Mat * m = new Mat();
+                if (!(this->reader).read(*m)) {
+                    delete m;
+                    break;
+                }
+                this->frames++;
+                if (m->channels() > 1) m = converter.convert_to_greyscale(m);
+                m = smoother.smoothing(m);
+                shared_ptr<MotionMask> mask = (this->config.masks) ? make_shared<MotionMask>() : nullptr;
+                float fraction = comparer.different_pixels(m, mask.get());
+                this->verdict({this->frames, fraction, fraction > this->percent, mask});
+            }
+        }
+
+        /**
+         * @brief Analyzes the frames with the thread pool, created with the first video
+         *
+         */
+        void run_thread_pool(Mat background, float threshold) {
+            Comparer * comparer = new Comparer(background, threshold, &(this->roi), false, false);
+            if (this->pool == nullptr) {
+                this->pool = new ThreadPool(new Smoother(&(this->roi), false, false), new GreyscaleConverter(&(this->roi), false, false),
+                    comparer, this->config.nw, background, threshold, this->percent, false, false, false);
+                (this->pool)->set_persistent();
+                (this->pool)->set_policy(this->config.policy);
+                if (this->config.mem_budget > 0) (this->pool)->set_inflight(&(this->inflight));
+                (this->pool)->set_callback([this](const Verdict & v) { this->verdict(v); });
+                if (this->config.masks) (this->pool)->set_masks();
+                (this->pool)->start_pool();
+            }
+            else (this->pool)->set_comparer(comparer);
+            (this->pool)->reset_results();
+            while (true) {
+                Mat * frame = new Mat();
+                if (!(this->reader).read(*frame)) {
+                    delete frame;
+                    break;
+                }
+                this->frames++;
+                if (frame->channels() == 1) (this->pool)->submit_luma_task(frame, this->frames);
+                else (this->pool)->submit_conversion_task(frame, this->frames);
+            }
+            (this->pool)->wait_results(this->frames);
+        }
+
+        /**
+         * @brief Analyzes the frames with the FastFlow farm, created with the first video
+         *
+         */
+        void run_farm(Mat background, float threshold) {
+            if (this->farm == nullptr) {
+                this->farm_emitter = new FarmEmitter(background, &(this->reader), nullptr, &(this->inflight), false, false);
+                this->collector = new Collector(this->percent, nullptr, &(this->inflight), false);
+                (this->collector)->set_callback([this](const Verdict & v) { this->verdict(v); });
+                (this->collector)->set_quiet();
+                vector<unique_ptr<ff_node>> workers;
+                for (int i=0; i<this->config.nw; i++) {
+                    unique_ptr<FarmWorker> w = make_unique<FarmWorker>(background, threshold, &(this->roi), nullptr, false, false);
+                    if (this->config.masks) w->set_masks();
+                    (this->farm_workers).push_back(w.get());
+                    workers.push_back(move(w));
+                }
+                this->farm = new ff_Farm<Frame, Frame>(move(workers));
+                (this->farm)->add_emitter(*(this->farm_emitter));
+                (this->farm)->add_collector(*(this->collector));
+                (this->farm)->set_scheduling_ondemand();
+                // The queues are sized with the frames of the first video, the emitter waits on the bytes for the others
+                if (this->config.mem_budget > 0) {
+                    int capacity = max((this->inflight).frames_allowed(DEFAULT_BUFFER_CAPACITY * this->config.nw) / this->config.nw, 1);
+                    (this->farm)->setInputQueueLength(capacity, true);
+                    (this->farm)->setOutputQueueLength(capacity, true);
+                }
+                OptLevel opt;
+                opt.max_mapped_threads = 0;
+                opt.no_default_mapping = true;
+                opt.max_nb_threads = 0;
+                opt.blocking_mode = true;
+                optimize_static(*(this->farm), opt);
+            }
+            else {
+                for (FarmWorker * w : this->farm_workers) w->set_background(background, threshold);
+            }
+            // The emitter ends the stream at the end of the video and the threads are frozen until the next one
+            if ((this->farm)->run_then_freeze() < 0 || (this->farm)->wait_freezing() < 0) cout << "fastflow error" << endl;
+            this->frames = (this->collector)->get_frames_number();
+        }
+
+        /**
+         * @brief Analyzes the frames with the FastFlow master-worker, created with the first video
+         *
+         */
+        void run_master_worker(Mat background, float threshold) {
+            if (this->pipe == nullptr) {
+                this->mw_emitter = new Emitter(background, &(this->reader), nullptr, &(this->inflight), false, false);
+                this->master = new Master(this->percent, nullptr, &(this->inflight), false);
+                (this->master)->set_callback([this](const Verdict & v) { this->verdict(v); });
+                (this->master)->set_quiet();
+                vector<unique_ptr<ff_node>> workers;
+                for (int i=0; i<this->config.nw; i++) {
+                    unique_ptr<Worker> w = make_unique<Worker>(background, threshold, &(this->roi), nullptr, false, false);
+                    if (this->config.masks) w->set_masks();
+                    (this->mw_workers).push_back(w.get());
+                    workers.push_back(move(w));
+                }
+                this->mw_farm = new ff_Farm<Mat, float>(move(workers));
+                (this->mw_farm)->add_emitter(*(this->master));
+                (this->mw_farm)->remove_collector();
+                (this->mw_farm)->set_scheduling_ondemand();
+                (this->mw_farm)->wrap_around();
+                this->pipe = new ff_Pipe<Task>(this->mw_emitter, *(this->mw_farm));
+                if (this->config.mem_budget > 0) {
+                    int capacity = max((this->inflight).frames_allowed(DEFAULT_BUFFER_CAPACITY * this->config.nw) / this->config.nw, 1);
+                    (this->mw_farm)->setInputQueueLength(capacity, true);
+                    (this->pipe)->setXNodeInputQueueLength((this->inflight).frames_allowed(DEFAULT_BUFFER_CAPACITY), true);
+                }
+                OptLevel opt;
+                opt.max_mapped_threads = 0;
+                opt.no_default_mapping = true;
+                opt.max_nb_threads = 0;
+                opt.blocking_mode = true;
+                optimize_static(*(this->pipe), opt);
+            }
+            else {
+                for (Worker * w : this->mw_workers) w->set_background(background, threshold);
+            }
+            if ((this->pipe)->run_then_freeze() < 0 || (this->pipe)->wait_freezing() < 0) cout << "fastflow error" << endl;
+            this->frames = (this->master)->get_frames_number();
+        }
+
+        /**
+         * @brief Analyzes a video, executed by the driver thread between begin and end
+         *
+         */
+        void run_video() {
+            Mat background;
+            float threshold = 0;
+            if (!this->prepare_background(background, threshold)) {
+                // The frames are consumed so that the application does not block on the push
+                Mat m;
+                while ((this->reader).read(m));
+                return;
+            }
+            switch (this->backend) {
+                case SEQUENTIAL: this->run_sequential(background, threshold); break;
+                case THREAD_POOL: this->run_thread_pool(background, threshold); break;
+                case FF_FARM: this->run_farm(background, threshold); break;
+                case FF_MASTER_WORKER: this->run_master_worker(background, threshold); break;
+            }
+        }
+
+    public:
+
+        MotionDetector(Backend backend, DetectorConfig config): backend(backend), config(config),
+            percent((float) config.k / 100), queue(config.queue_capacity), reader(&queue), roi(1, 1) {
+            this->different_frames = 0;
+        }
+
+        ~MotionDetector() {
+            if (this->running) this->end();
+            if (this->pool != nullptr) {
+                (this->pool)->stop_pool();
+                (this->pool)->get_final_result();
+                delete this->pool;
+            }
+            // The frozen threads of FastFlow are terminated before the nodes are deleted
+            if (this->farm != nullptr) {
+                (this->farm)->wait();
+                delete this->farm;
+                delete this->collector;
+                delete this->farm_emitter;
+            }
+            if (this->pipe != nullptr) {
+                (this->pipe)->wait();
+                delete this->pipe;
+                delete this->mw_farm;
+                delete this->master;
+                delete this->mw_emitter;
+            }
+        }
+
+        /**
+         * @brief Starts the analysis of a video, the previous one is ended if needed
+         *
+         * @param callback function called with the verdict of each frame, from the threads of the backend
+         */
+        void begin(VerdictCallback callback) {
+            if (this->running) this->end();
+            this->callback = callback;
+            this->different_frames = 0;
+            this->frames = 0;
+            (this->queue).reopen();
+            this->running = true;
+            this->driver = thread([this]() { this->run_video(); });
+        }
+
+        /**
+         * @brief Pushes a frame of the current video, waiting if the backend is behind. The first frame of
+         *        each video is the background
+         *
+         * @param frame BGR or greyscale frame, with 8 bit values or float values in [0,1], it is copied
+         * @return false if no video has been started
+         */
+        bool push(const Mat & frame) {
+            if (!this->running) return false;
+            return (this->queue).push(frame.clone());
+        }
+
+        /**
+         * @brief Ends the current video and waits for the verdicts of all its frames
+         *
+         * @return the number of frames with movement detected
+         */
+        int end() {
+            if (!this->running) return 0;
+            (this->queue).close();
+            (this->driver).join();
+            this->running = false;
+            return this->different_frames;
+        }
+
+        /**
+         * @brief Gets the number of frames analyzed in the last video, without the background
+         *
+         * @return the number of frames
+         */
+        int get_frames_number() {
+            return this->frames;
+        }
+};
+
+#endif
@@ -1,6 +1,12 @@
 #include <iostream>
 #include "opencv2/opencv.hpp"
 #include <ff/ff.hpp>
+#include "../../utils/realtime.hpp"
+#include "../../utils/async_logger.hpp"
+#include "ff_frame.hpp"
+#include "../../utils/inflight_counter.hpp"
+#include "../../utils/verdict.hpp"
+#include "../../utils/first_verdict.hpp"
 
 using namespace ff;
 using namespace std;
@@ -12,32 +18,75 @@ using namespace cv;
  *        is a movement in the frame
  * 
  */
-class Collector: public ff_minode_t<float> {
+class Collector: public ff_minode_t<Frame> {
     private:
         int frames_with_movement = 0;
         int frame_number = 0;
         float percent;
         bool has_finished = false;
         bool times;
+        RealTime * rt; // real time controller, nullptr if real time mode is not used
+        InFlightCounter * inflight; // frames between the emitter and the collector
+        VerdictCallback on_verdict = nullptr; // function called with the result of each frame, nullptr if not used
+        bool quiet = false; // true if the results are not printed at the end
 
 
     public:
 
-        Collector(float percent, bool times): percent(percent), times(times) {}
+        Collector(float percent, RealTime * rt, InFlightCounter * inflight, bool times): percent(percent), rt(rt), inflight(inflight), times(times) {}
+
+        /**
+         * @brief Names the thread of the node in the trace and resets the counters, since the farm can be
+         *        run again on another video after it has been frozen
+         * 
+         * @return 0 to start the node
+         */
+        int svc_init() {
+            TraceRecorder::name_thread("collector");
+            this -> frames_with_movement = 0;
+            this -> frame_number = 0;
+            this -> has_finished = false;
+            return 0;
+        }
+
+        /**
+         * @brief Sets the function called with the result of each frame
+         * 
+         * @param callback the function
+         */
+        void set_callback(VerdictCallback callback) {
+            this -> on_verdict = callback;
+        }
+
+        /**
+         * @brief Does not print the results at the end, when they are given to the callback
+         * 
+         */
+        void set_quiet() {
+            this -> quiet = true;
+        }
 
         /**
          * @brief Main function of the node
          * 
-         * @param diff the percentage of different pixels out of the total
-         * @return float* 
+         * @param f the frame with the percentage of different pixels out of the total
+         * @return Frame* 
          */
-        float * svc(float * diff) {
-            float &d = *diff;
-            if (d > this->percent) (this->frames_with_movement)++;
-            // Deletes the number when it has been analyzed
-            delete diff;
+        Frame * svc(Frame * f) {
+            inflight->leave();
+            // Frames dropped by the workers in real time mode have no result
+            if (f->result < 0) {
+                delete f;
+                return GO_ON;
+            }
+            FirstVerdict::mark();
+            if (f->result > this->percent) (this->frames_with_movement)++;
+            if (on_verdict) on_verdict({f->number, f->result, f->result > this->percent, f->mask});
+            if (rt != nullptr) rt->complete(f->arrival);
+            // Deletes the frame when it has been analyzed
+            delete f;
             (this -> frame_number)++;
-            if (times) cout << "Frames with movement detected until now: " << frames_with_movement << " over " << frame_number << " analyzed" << endl;
+            if (times) AsyncLogger::instance().log("Frames with movement detected until now: " + to_string(frames_with_movement) + " over " + to_string(frame_number) + " analyzed");
             return GO_ON;
         }
 
@@ -46,10 +95,19 @@ class Collector: public ff_minode_t<float> {
          * 
          */
         void svc_end() {
-            cout << "Number of frames with movement detected: " << frames_with_movement << " on a total of " << frame_number << " frames" << endl;
+            if (!quiet) cout << "Number of frames with movement detected: " << frames_with_movement << " on a total of " << frame_number << " frames" << endl;
             this -> has_finished = true;
         }
 
+        /**
+         * @brief Gets the number of frames analyzed
+         * 
+         * @return the number of frames with a result
+         */
+        int get_frames_number() {
+            return this->frame_number;
+        }
+
         /**
          * @brief Gets the number of frames with movement detected from outside the node if the stream is finished
          * 
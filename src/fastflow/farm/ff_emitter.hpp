@@ -1,6 +1,10 @@
 #include <iostream>
 #include "opencv2/opencv.hpp"
 #include <ff/ff.hpp>
+#include "../../utils/frame_reader.hpp"
+#include "../../utils/realtime.hpp"
+#include "ff_frame.hpp"
+#include "../../utils/inflight_counter.hpp"
 
 using namespace std;
 using namespace cv;
@@ -11,33 +15,72 @@ using namespace ff;
  *        performs grayscale conversion and smoothing
  * 
  */
-class Emitter: public ff_monode_t<Mat> {
+class FarmEmitter: public ff_monode_t<Frame> {
 
     private:
         bool show = false;
         bool times = false;
+        int frame_number = 0;
+        RealTime * rt; // real time controller, nullptr if real time mode is not used
+        InFlightCounter * inflight; // frames between the emitter and the collector
+        long stall_usec = 0; // time spent waiting for room in the queues of the workers
         // Background matrix needed to know the frames size
         Mat background;
-        VideoCapture cap;
+        FrameReader * reader;
 
     public:
-        Emitter(Mat background, VideoCapture cap, bool show, bool times): cap(cap), background(background), show(show), times(times) {}
+        FarmEmitter(Mat background, FrameReader * reader, RealTime * rt, InFlightCounter * inflight, bool show, bool times): reader(reader), rt(rt), inflight(inflight), background(background), show(show), times(times) {}
 
         /**
          * @brief Main function of the emitter node, it reads frames and submits them to next node
          * 
          * @return EOS when the frames are finished
          */
-        Mat * svc (Mat *) {
+        Frame * svc (Frame *) {
+            TraceRecorder::name_thread("reader");
+            // The farm can be run again on another video after it has been frozen
+            this->frame_number = 0;
             while (true) {
+                // In real time mode waits until the next frame is available from the source
+                TimePoint arrival = (rt != nullptr) ? rt->pace() : chrono::steady_clock::now();
                 // Reads frames and sends it to a worker
-                Mat * frame = new Mat(background.rows, background.cols, CV_32FC3);
-                this -> cap >> *frame;
-                if (frame->empty()) break;
-                frame->convertTo(*frame, CV_32F, 1.0/255.0);
-                ff_send_out(frame);
+                Mat * frame = new Mat();
+                if (!(this->reader)->read(*frame)) {
+                    delete frame;
+                    break;
+                }
+                this->frame_number++;
+                // In real time mode drops the frame if it is stale or if the farm is full
+                if (rt != nullptr && !rt->admit(arrival)) {
+                    delete frame;
+                    continue;
+                }
+                Frame * f = new Frame;
+                f -> m = frame;
+                f -> number = this -> frame_number;
+                f -> arrival = arrival;
+                f -> result = 0;
+                // The frame waits for room in the memory budget, and the send blocks when the queues are full
+                auto start = std::chrono::high_resolution_clock::now();
+                // The reader is traced as blocked only when it waits, the send is tried once before waiting
+                bool entered = inflight->try_enter();
+                if (!entered || !ff_send_out(f, -1, 1)) {
+                    TraceScope tr("blocked", "reader", f -> number);
+                    if (!entered) inflight->enter();
+                    ff_send_out(f);
+                }
+                this->stall_usec += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
             }
-            (this->cap).release();
+            (this->reader)->release();
             return EOS;
         }
+
+        /**
+         * @brief Gets the time spent by the emitter waiting to send the frames
+         * 
+         * @return the time in usec
+         */
+        long get_stall_usec() {
+            return this->stall_usec;
+        }
 };
\ No newline at end of file
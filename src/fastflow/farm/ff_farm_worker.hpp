@@ -1,6 +1,15 @@
 #include <iostream>
 #include "opencv2/opencv.hpp"
 #include <ff/ff.hpp>
+#include "../../utils/roi_mask.hpp"
+#include "../../utils/latency_histogram.hpp"
+#include "../../utils/realtime.hpp"
+#include "../../utils/perf_counters.hpp"
+#include "../../utils/trace_recorder.hpp"
+#include "../../utils/background_builder.hpp"
+#include "../../utils/pyramid.hpp"
+#include "../../utils/motion_mask.hpp"
+#include "ff_frame.hpp"
 
 using namespace ff;
 using namespace std;
@@ -10,12 +19,36 @@ using namespace cv;
  * @brief Class that represents a worker that performs smoothing on the given matrix
  * 
  */
-class FarmWorker: public ff_node_t<Mat, float> {
+class FarmWorker: public ff_node_t<Frame, Frame> {
     private:
         bool show = false;
         bool times = false;
         Mat background; // background matrix
         float threshold; // threshold to consider two pixels different
+        RoiMask * roi; // region of interest of the frames
+        BackgroundBuilder * builder = nullptr; // builder of the background until this worker has it, nullptr after
+        RealTime * rt; // real time controller, nullptr if real time mode is not used
+        Pyramid * pyramid = nullptr; // coarse detector shared by the workers, nullptr if pyramid mode is not used
+        bool masks = false; // each frame is compared in a new mask, sent with its result
+
+        /**
+         * @brief Tells if the frame has exceeded its deadline in real time mode, in that case it is dropped
+         * 
+         * @param f the frame to check
+         * @return true if the frame has been dropped
+         */
+        bool dropped(Frame * f) {
+            if (rt == nullptr || !rt->expired(f->arrival)) return false;
+            delete f->m;
+            f->m = nullptr;
+            f->result = -1;
+            rt->drop();
+            return true;
+        }
+
+    public:
+
+        // The stage methods are public so that they can be benchmarked in isolation
 
         /**
          * @brief Converts a frames in black and white
@@ -31,20 +64,19 @@ class FarmWorker: public ff_node_t<Mat, float> {
             float r = 0;
             float b = 0;
             float g = 0;
+            // Only the pixels of the region of interest and their neighbours are converted
             for (int i=0; i<gr->rows; i++) {
-                for (int j=0; j<gr->cols; j++) {
-                    r = (float) pm[i * gr->cols * channels + j * channels];
-                    g = (float) pm[i * gr->cols * channels + j * channels + 1];
-                    b = (float) pm[i * gr->cols * channels + j * channels + 2];
-                    pl[i * gr->cols + j] = (float) (r + g + b) / channels;
+                for (const Span & s : roi->row_halo_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        r = (float) pm[i * gr->cols * channels + j * channels];
+                        g = (float) pm[i * gr->cols * channels + j * channels + 1];
+                        b = (float) pm[i * gr->cols * channels + j * channels + 2];
+                        pl[i * gr->cols + j] = (float) (r + g + b) / channels;
+                    }
                 }
             }
             delete m;
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times spent on grayscale conversion: " << usec << " usec" << endl;
-            }
+            StageHistograms::record(GREYSCALE, std::chrono::high_resolution_clock::now() - start);
             if (show) {
                 imshow("Frame", *gr);
                 waitKey(25);
@@ -63,32 +95,31 @@ class FarmWorker: public ff_node_t<Mat, float> {
             Mat * res = new Mat(m->rows, m->cols, CV_32F, 0.0);
             float * sp = (float *) m->data;
             float * mp = (float *) res->data;
-            for(int i=i; i<m->rows; i++) {
-                for (int j=0; j<m->cols; j++) {
-                    int x = j-1;
-                    int y = i-1;
-                    int width = 3;
-                    int height = 3;
-                    // Check that the bounds of the 3x3 kernel do not exceed the frame size
-                    if (x >= 0 && y >= 0 && x + width < m->cols && y + height < m->rows) {
-                        for(int z=y; z<y+height; z++) {
-                            for (int k=x; k<x+width; k++) {
-                                mp[i * res->cols + j] = mp[i * res->cols + j] + (float) (sp[z * m->cols + k] / 9);
+            // Only the pixels of the region of interest are smoothed, the others are left to 0
+            for(int i=0; i<m->rows; i++) {
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        int x = j-1;
+                        int y = i-1;
+                        int width = 3;
+                        int height = 3;
+                        // Check that the bounds of the 3x3 kernel do not exceed the frame size
+                        if (x >= 0 && y >= 0 && x + width < m->cols && y + height < m->rows) {
+                            for(int z=y; z<y+height; z++) {
+                                for (int k=x; k<x+width; k++) {
+                                    mp[i * res->cols + j] = mp[i * res->cols + j] + (float) (sp[z * m->cols + k] / 9);
+                                }
                             }
                         }
+                        // Do not change the values at first and last column or row
+                        else {                            
+                            mp[i * res->cols + j] = sp[i * res->cols + j];
+                        } 
                     }
-                    // Do not change the values at first and last column or row
-                    else {                            
-                        mp[i * res->cols + j] = sp[i * res->cols + j];
-                    } 
                 }
             }
             delete m;
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times spent for smoothing: " << usec << " usec" << endl;
-            }
+            StageHistograms::record(SMOOTHING, std::chrono::high_resolution_clock::now() - start);
             if (show) {
                 imshow("Smoothing", *res);
                 waitKey(25);
@@ -100,47 +131,131 @@ class FarmWorker: public ff_node_t<Mat, float> {
          * @brief Counts the number of frames between the frame and the background out of the total 
          * 
          * @param frame the frame to compare with background
-         * @return a pointer to a float representing percentage of different pixels out of the total
+         * @param mask where the mask of the different pixels is stored, nullptr if it is not needed
+         * @return float percentage of different pixels out of the total
          */
-        float * different_pixels(Mat * frame) {
+        float different_pixels(Mat * frame, MotionMask * mask = nullptr) {
             auto start = std::chrono::high_resolution_clock::now();
-            int cnt = 0;
-            float * pa = (float *) frame->data;
-            float * pb = (float *) (this->background).data;
-            for(int i=0; i<frame->rows; i++) {
-                for (int j=0; j<frame->cols; j++) {
-                    float difference = (float) abs(pb[i * frame->cols + j] - pa[i * frame->cols + j]);
-                    pa[i * frame->cols + j] = difference;
-                    if (difference > threshold) cnt++;
-                }
-            }
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Time spent for background subtraction: " << usec << " usec" << endl;
-            }
+            // Without an output the mask of the thread is reused, so that it is not allocated for each frame
+            static thread_local MotionMask local;
+            MotionMask & m = (mask != nullptr) ? *mask : local;
+            long cnt = m.compare(*frame, this->background, threshold, *roi);
+            StageHistograms::record(COMPARE, std::chrono::high_resolution_clock::now() - start);
             if (show) {
-                imshow("Background subtraction", *frame);
+                imshow("Background subtraction", m.to_image());
                 waitKey(25);
             }
-            float diff_fraction = (float) cnt / frame->total();
+            // Fraction of different pixels over the area of the region of interest
+            float diff_fraction = (float) cnt / roi->get_area();
             delete frame;
-            return new float(diff_fraction);
+            return diff_fraction;
         }
 
-    public:
-        FarmWorker(Mat background, float threshold, bool show, bool times): background(background), threshold(threshold), show(show), times(times) {}
+        FarmWorker(Mat background, float threshold, RoiMask * roi, RealTime * rt, bool show, bool times): background(background), threshold(threshold), roi(roi), rt(rt), show(show), times(times) {}
+
+        /**
+         * @brief Names the thread of the node in the trace
+         * 
+         * @return 0 to start the node
+         */
+        int svc_init() {
+            TraceRecorder::name_thread("worker");
+            // The workers prepare the background together while the emitter reads the first frames
+            if (this->builder != nullptr) (this->builder)->work();
+            return 0;
+        }
+
+        /**
+         * @brief Sets the builder of the background, when the background is prepared by the workers
+         * 
+         * @param builder the builder, the background and threshold are taken from it when it is ready
+         */
+        void set_builder(BackgroundBuilder * builder) {
+            this->builder = builder;
+        }
+
+        /**
+         * @brief Sets the coarse detector, the frames far from the percentage are decided downsampled
+         * 
+         * @param pyramid the coarse detector
+         */
+        void set_pyramid(Pyramid * pyramid) {
+            this->pyramid = pyramid;
+        }
+
+        /**
+         * @brief Keeps the mask of the different pixels of each frame, that is given with its verdict
+         * 
+         */
+        void set_masks() {
+            this->masks = true;
+        }
+
+        /**
+         * @brief Waits for the background before the first comparison, helping to prepare it
+         * 
+         */
+        void wait_background() {
+            if (this->builder == nullptr) return;
+            (this->builder)->wait_ready();
+            this->background = (this->builder)->get_background();
+            this->threshold = (this->builder)->get_threshold();
+            this->builder = nullptr;
+        }
+
+        /**
+         * @brief Sets the background of a new video, while the workers are frozen between two videos
+         * 
+         * @param background the background matrix
+         * @param threshold threshold to consider two pixels different
+         */
+        void set_background(Mat background, float threshold) {
+            this->background = background;
+            this->threshold = threshold;
+            this->builder = nullptr;
+        }
 
         /**
          * @brief Main function of the node, it performs actions on the given matrix and submits the collector
          *        to the next node
          * 
-         * @param m matrix on which perform actions
-         * @return final result from the given matrix
+         * @param f frame on which perform actions
+         * @return the frame with the final result
          */
-        float * svc(Mat * m) {
-            m = this->convert_to_greyscale(m);
-            m = this->smoothing(m); 
-            return this->different_pixels(m);
+        Frame * svc(Frame * f) {
+            if (this->dropped(f)) return f;
+            // In pyramid mode the full resolution stages are skipped if the downsampled frame is enough
+            if (this->pyramid != nullptr) {
+                TraceScope tr("coarse", "stage", f->number);
+                float fraction;
+                if ((this->pyramid)->decide(*(f->m), fraction)) {
+                    delete f->m;
+                    f->m = nullptr;
+                    f->result = fraction;
+                    return f;
+                }
+            }
+            long pixels = f->m->total();
+            // Frames read in luma mode are already in greyscale
+            if (f->m->channels() > 1) {
+                PerfScope p(GREYSCALE, pixels);
+                TraceScope tr(GREYSCALE, f->number);
+                f->m = this->convert_to_greyscale(f->m);
+            }
+            if (this->dropped(f)) return f;
+            {
+                PerfScope p(SMOOTHING, pixels);
+                TraceScope tr(SMOOTHING, f->number);
+                f->m = this->smoothing(f->m);
+            }
+            this->wait_background();
+            {
+                PerfScope p(COMPARE, pixels);
+                TraceScope tr(COMPARE, f->number);
+                if (this->masks) f->mask = make_shared<MotionMask>();
+                f->result = this->different_pixels(f->m, (f->mask).get());
+            }
+            f->m = nullptr;
+            return f;
         }
 };
\ No newline at end of file
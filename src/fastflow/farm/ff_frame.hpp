@@ -0,0 +1,24 @@
+#ifndef FF_FRAME_HPP
+#define FF_FRAME_HPP
+
+#include <memory>
+#include "opencv2/opencv.hpp"
+#include "../../utils/realtime.hpp"
+#include "../../utils/motion_mask.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Frame that flows through the farm, from the emitter to the collector
+ * 
+ */
+struct Frame {
+    Mat * m;
+    int number;
+    TimePoint arrival; // time at which the frame became available to the emitter
+    float result; // fraction of different pixels, negative if the frame has been dropped
+    shared_ptr<MotionMask> mask; // different pixels of the frame when the masks are kept, nullptr otherwise
+};
+
+#endif
@@ -1,6 +1,9 @@
 #include <iostream>
 #include "opencv2/opencv.hpp"
 #include <ff/ff.hpp>
+#include "../../utils/frame_reader.hpp"
+#include "../../utils/realtime.hpp"
+#include "../../utils/inflight_counter.hpp"
 
 using namespace std;
 using namespace cv;
@@ -16,12 +19,15 @@ class Emitter: public ff_monode_t<Task> {
         bool show = false;
         bool times = false;
         int frame_number = 0;
+        RealTime * rt; // real time controller, nullptr if real time mode is not used
+        InFlightCounter * inflight; // frames between the emitter and the end of background subtraction
+        long stall_usec = 0; // time spent waiting for room in the queue of the master
         // Background matrix to know the frames size
         Mat background;
-        VideoCapture cap;
+        FrameReader * reader;
 
     public:
-        Emitter(Mat background, VideoCapture cap, bool show, bool times): cap(cap), background(background), show(show), times(times) {}
+        Emitter(Mat background, FrameReader * reader, RealTime * rt, InFlightCounter * inflight, bool show, bool times): reader(reader), rt(rt), inflight(inflight), background(background), show(show), times(times) {}
 
         /**
          * @brief Main function of the emitter node, it reads frames, prepares tasks and submits them to workers
@@ -29,24 +35,58 @@ class Emitter: public ff_monode_t<Task> {
          * @return EOS when the frames are finished
          */
         Task * svc (Task *) {
+            TraceRecorder::name_thread("reader");
+            // The pipe can be run again on another video after it has been frozen
+            this->frame_number = 0;
+            int read_frames = 0;
             while (true) {
+                // In real time mode waits until the next frame is available from the source
+                TimePoint arrival = (rt != nullptr) ? rt->pace() : chrono::steady_clock::now();
                 // Reads frames and generate tasks
-                Mat * frame = new Mat(background.rows, background.cols, CV_32FC3);
-                this -> cap >> *frame;
-                if (frame->empty()) break;
-                frame->convertTo(*frame, CV_32F, 1.0/255.0);
+                Mat * frame = new Mat();
+                if (!(this->reader)->read(*frame)) {
+                    delete frame;
+                    break;
+                }
+                read_frames++;
+                // In real time mode drops the frame if it is stale or if the pipe is full
+                if (rt != nullptr && !rt->admit(arrival)) {
+                    delete frame;
+                    continue;
+                }
                 this->frame_number++;
                 // Task creation
                 Task * t = new Task;
                 t -> m = frame;
-                t -> n = 2; // Task code for greyscale conversion
-                ff_send_out(t);
+                t -> frame_number = read_frames;
+                t -> arrival = arrival;
+                // Task code for greyscale conversion, frames read in luma mode go directly to smoothing
+                t -> n = (frame->channels() == 1) ? 3 : 2;
+                // The frame waits for room in the memory budget, and the send blocks when the queue is full
+                auto start = std::chrono::high_resolution_clock::now();
+                // The reader is traced as blocked only when it waits, the send is tried once before waiting
+                bool entered = inflight->try_enter();
+                if (!entered || !ff_send_out(t, -1, 1)) {
+                    TraceScope tr("blocked", "reader", t -> frame_number);
+                    if (!entered) inflight->enter();
+                    ff_send_out(t);
+                }
+                this->stall_usec += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
             }
-            (this->cap).release();
+            (this->reader)->release();
             // Sends the total number of frames as task code
             Task * t = new Task;
             t -> n = this -> frame_number;
             ff_send_out(t);
             return EOS;
         }
+
+        /**
+         * @brief Gets the time spent by the emitter waiting to send the frames
+         * 
+         * @return the time in usec
+         */
+        long get_stall_usec() {
+            return this->stall_usec;
+        }
 };
\ No newline at end of file
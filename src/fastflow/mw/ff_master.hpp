@@ -2,6 +2,11 @@
 #include "opencv2/opencv.hpp"
 #include <ff/ff.hpp>
 #include "../mw//ff_worker.hpp"
+#include "../../utils/realtime.hpp"
+#include "../../utils/async_logger.hpp"
+#include "../../utils/inflight_counter.hpp"
+#include "../../utils/verdict.hpp"
+#include "../../utils/first_verdict.hpp"
 
 using namespace ff;
 using namespace std;
@@ -21,16 +26,89 @@ class Master: public ff_monode_t<Task> {
         bool has_finished = false;
         bool times = false;
         bool eos_received = false;
+        int dropped_frames = 0;
+        RealTime * rt; // real time controller, nullptr if real time mode is not used
+        InFlightCounter * inflight; // frames between the emitter and the end of background subtraction
+        VerdictCallback on_verdict = nullptr; // function called with the result of each frame, nullptr if not used
+        bool quiet = false; // true if the results are not printed at the end
+        bool affinity = false; // true if the next stage of a frame is sent to the worker of the previous one
+        long kept = 0; // stages sent to the worker of the previous one in affinity mode
 
     public:
-        Master(float percent, bool times): percent(percent), times(times) {}
+        Master(float percent, RealTime * rt, InFlightCounter * inflight, bool times): percent(percent), rt(rt), inflight(inflight), times(times) {}
+
+        /**
+         * @brief Names the thread of the node in the trace and resets the counters, since the pipe can be
+         *        run again on another video after it has been frozen
+         * 
+         * @return 0 to start the node
+         */
+        int svc_init() {
+            TraceRecorder::name_thread("master");
+            this -> frames_with_movement = 0;
+            this -> total_frames = -1;
+            this -> frame_number = 0;
+            this -> has_finished = false;
+            this -> eos_received = false;
+            this -> dropped_frames = 0;
+            return 0;
+        }
+
+        /**
+         * @brief Sets the function called with the result of each frame
+         * 
+         * @param callback the function
+         */
+        void set_callback(VerdictCallback callback) {
+            this -> on_verdict = callback;
+        }
+
+        /**
+         * @brief Sends the next stage of a frame to the worker that ran the previous one, if its queue has
+         *        room, otherwise to the first worker that asks for a task
+         * 
+         */
+        void set_affinity() {
+            this -> affinity = true;
+        }
+
+        /**
+         * @brief Gets the number of stages sent back to the worker of the previous one
+         * 
+         * @return the number of stages
+         */
+        long get_kept() {
+            return this->kept;
+        }
+
+        /**
+         * @brief Does not print the results at the end, when they are given to the callback
+         * 
+         */
+        void set_quiet() {
+            this -> quiet = true;
+        }
 
         Task * svc(Task * t) {
+            if (t -> n < 0) { // Case frame dropped by a worker in real time mode
+                inflight->leave();
+                this->frame_number++;
+                this->dropped_frames++;
+                delete t;
+                if (this->eos_received && this->total_frames != -1 && this->total_frames == this->frame_number) {
+                    broadcast_task(EOS);
+                }
+                return GO_ON;
+            }
             if (t -> n >= 0 && t -> n <= 1) {// Case result of background subtraction
+                inflight->leave();
+                FirstVerdict::mark();
                 this->frame_number++;
                 if (t->n >= this->percent) this->frames_with_movement++;
+                if (on_verdict) on_verdict({t->frame_number, t->n, t->n >= this->percent, t->mask});
+                if (rt != nullptr) rt->complete(t->arrival);
                 delete t;
-                if (times) cout << "Frames with movement detected until now: " << frames_with_movement << " over " << frame_number << " analyzed" << endl;
+                if (times) AsyncLogger::instance().log("Frames with movement detected until now: " + to_string(frames_with_movement) + " over " + to_string(frame_number) + " analyzed");
                 // If EOS is received and the frames are finished broadcasts EOS to the workers
                 if (this->eos_received && this->total_frames != -1 && this->total_frames == this->frame_number) {
                     broadcast_task(EOS);
@@ -45,7 +123,12 @@ class Master: public ff_monode_t<Task> {
                 delete t;
                 return GO_ON;
             }
-            // Case general task received, sends it to the workers
+            // Case general task received, sends it to the workers; in affinity mode the worker that ran the
+            // previous stage gets it if it can take it now, without waiting
+            if (affinity && t->worker >= 0 && ff_send_out_to(t, t->worker, 1, 0)) {
+                this->kept++;
+                return GO_ON;
+            }
             return t;
         }
 
@@ -70,10 +153,19 @@ class Master: public ff_monode_t<Task> {
          *
          */
         void svc_end() {
-            cout << "Number of frames with movement detected: " << frames_with_movement << " on a total of " << frame_number << " frames" << endl;
+            if (!quiet) cout << "Number of frames with movement detected: " << frames_with_movement << " on a total of " << frame_number - dropped_frames << " frames" << endl;
             this -> has_finished = true;
         }
 
+        /**
+         * @brief Gets the number of frames analyzed
+         * 
+         * @return the number of frames with a result
+         */
+        int get_frames_number() {
+            return this->frame_number - this->dropped_frames;
+        }
+
         /**
          * @brief Gets the number of frames with movement detected from outside the node if the stream is finished
          * 
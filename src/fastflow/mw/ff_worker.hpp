@@ -1,6 +1,16 @@
 #include <iostream>
 #include "opencv2/opencv.hpp"
 #include <ff/ff.hpp>
+#include "../../utils/roi_mask.hpp"
+#include "../../utils/latency_histogram.hpp"
+#include "../../utils/realtime.hpp"
+#include "../../utils/perf_counters.hpp"
+#include "../../utils/trace_recorder.hpp"
+#include "../../utils/background_builder.hpp"
+#include "../../utils/pyramid.hpp"
+#include "../../utils/motion_mask.hpp"
+#include "../../utils/half_float.hpp"
+#include "../../utils/stage_migrations.hpp"
 
 using namespace ff;
 using namespace std;
@@ -9,6 +19,12 @@ using namespace cv;
 struct Task {  
     Mat * m;
     float n;
+    int frame_number;
+    TimePoint arrival; // time at which the frame became available to the emitter
+    bool coarse = false; // true when the frame has been analyzed downsampled in pyramid mode
+    int worker = -1; // worker that ran the previous stage, -1 if the task comes from the emitter
+    int core = -1; // core on which the previous stage ran
+    shared_ptr<MotionMask> mask; // different pixels of the frame when the masks are kept, nullptr otherwise
 };
 
 /**
@@ -23,6 +39,33 @@ class Worker: public ff_node_t<Task> {
         bool times = false;
         Mat background; // background matrix
         float threshold; // threshold to consider two pixels different
+        RoiMask * roi; // region of interest of the frames
+        BackgroundBuilder * builder = nullptr; // builder of the background until this worker has it, nullptr after
+        RealTime * rt; // real time controller, nullptr if real time mode is not used
+        Pyramid * pyramid = nullptr; // coarse detector shared by the workers, nullptr if pyramid mode is not used
+        bool masks = false; // each frame is compared in a new mask, sent with its result
+        bool half = false; // the greyscale and smoothed frames sent back to the master are stored as half floats
+        Mat half_background; // background as half floats, converted at the first half frame
+
+        /**
+         * @brief Tells if the frame of the task has exceeded its deadline in real time mode, in that case
+         *        it is dropped and the task code is set to -1
+         * 
+         * @param t the task to check
+         * @return true if the frame has been dropped
+         */
+        bool dropped(Task * t) {
+            if (rt == nullptr || !rt->expired(t->arrival)) return false;
+            delete t->m;
+            t->m = nullptr;
+            t->n = -1;
+            rt->drop();
+            return true;
+        }
+
+    public:
+
+        // The stage methods are public so that they can be benchmarked in isolation
 
         /**
          * @brief Converts a frames in black and white
@@ -31,6 +74,16 @@ class Worker: public ff_node_t<Task> {
          */
         Mat * convert_to_greyscale(Mat * m) {
             auto start = std::chrono::high_resolution_clock::now();
+            if (this->half) {
+                Mat * gr = new Mat(HalfFloat::greyscale(*m, *roi));
+                delete m;
+                StageHistograms::record(GREYSCALE, std::chrono::high_resolution_clock::now() - start);
+                if (show) {
+                    imshow("Frame", HalfFloat::to_float(*gr));
+                    waitKey(25);
+                }
+                return gr;
+            }
             Mat * gr = new Mat(m->rows, m->cols, CV_32F);
             int channels = m->channels();
             float * pl = (float *) gr->data;
@@ -38,20 +91,19 @@ class Worker: public ff_node_t<Task> {
             float r = 0;
             float b = 0;
             float g = 0;
+            // Only the pixels of the region of interest and their neighbours are converted
             for (int i=0; i<gr->rows; i++) {
-                for (int j=0; j<gr->cols; j++) {
-                    r = (float) pm[i * gr->cols * channels + j * channels];
-                    g = (float) pm[i * gr->cols * channels + j * channels + 1];
-                    b = (float) pm[i * gr->cols * channels + j * channels + 2];
-                    pl[i * gr->cols + j] = (float) (r + g + b) / channels;
+                for (const Span & s : roi->row_halo_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        r = (float) pm[i * gr->cols * channels + j * channels];
+                        g = (float) pm[i * gr->cols * channels + j * channels + 1];
+                        b = (float) pm[i * gr->cols * channels + j * channels + 2];
+                        pl[i * gr->cols + j] = (float) (r + g + b) / channels;
+                    }
                 }
             }
             delete m;
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times spent on grayscale conversion: " << usec << " usec" << endl;
-            }
+            StageHistograms::record(GREYSCALE, std::chrono::high_resolution_clock::now() - start);
             if (show) {
                 imshow("Frame", *gr);
                 waitKey(25);
@@ -67,35 +119,45 @@ class Worker: public ff_node_t<Task> {
          */
         Mat * smoothing(Mat * m) {
             auto start = std::chrono::high_resolution_clock::now();
+            // The frames read in luma mode are converted to half floats here
+            if (this->half || m->depth() == CV_16F) {
+                Mat * res = new Mat(HalfFloat::smoothing((m->depth() == CV_16F) ? *m : HalfFloat::to_half(*m), *roi));
+                delete m;
+                StageHistograms::record(SMOOTHING, std::chrono::high_resolution_clock::now() - start);
+                if (show) {
+                    imshow("Smoothing", HalfFloat::to_float(*res));
+                    waitKey(25);
+                }
+                return res;
+            }
             Mat * res = new Mat(m->rows, m->cols, CV_32F, 0.0);
             float * sp = (float *) m->data;
             float * mp = (float *) res->data;
-            for(int i=i; i<m->rows; i++) {
-                for (int j=0; j<m->cols; j++) {
-                    int x = j-1;
-                    int y = i-1;
-                    int width = 3;
-                    int height = 3;
-                    // Check that the bounds of the 3x3 kernel do not exceed the frame size
-                    if (x >= 0 && y >= 0 && x + width < m->cols && y + height < m->rows) {
-                        for(int z=y; z<y+height; z++) {
-                            for (int k=x; k<x+width; k++) {
-                                mp[i * res->cols + j] = mp[i * res->cols + j] + (float) (sp[z * m->cols + k] / 9);
+            // Only the pixels of the region of interest are smoothed, the others are left to 0
+            for(int i=0; i<m->rows; i++) {
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        int x = j-1;
+                        int y = i-1;
+                        int width = 3;
+                        int height = 3;
+                        // Check that the bounds of the 3x3 kernel do not exceed the frame size
+                        if (x >= 0 && y >= 0 && x + width < m->cols && y + height < m->rows) {
+                            for(int z=y; z<y+height; z++) {
+                                for (int k=x; k<x+width; k++) {
+                                    mp[i * res->cols + j] = mp[i * res->cols + j] + (float) (sp[z * m->cols + k] / 9);
+                                }
                             }
                         }
+                        // Do not change the values at first and last column or row
+                        else {                            
+                            mp[i * res->cols + j] = sp[i * res->cols + j];
+                        } 
                     }
-                    // Do not change the values at first and last column or row
-                    else {                            
-                        mp[i * res->cols + j] = sp[i * res->cols + j];
-                    } 
                 }
             }
             delete m;
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times spent for smoothing: " << usec << " usec" << endl;
-            }
+            StageHistograms::record(SMOOTHING, std::chrono::high_resolution_clock::now() - start);
             if (show) {
                 imshow("Smoothing", *res);
                 waitKey(25);
@@ -107,36 +169,103 @@ class Worker: public ff_node_t<Task> {
          * @brief Counts the number of frames between the frame and the background out of the total 
          * 
          * @param frame the frame to compare with background
+         * @param mask where the mask of the different pixels is stored, nullptr if it is not needed
          * @return float percentage of different pixels out of the total
          */
-        float different_pixels(Mat * frame) {
+        float different_pixels(Mat * frame, MotionMask * mask = nullptr) {
             auto start = std::chrono::high_resolution_clock::now();
-            int cnt = 0;
-            float * pa = (float *) frame->data;
-            float * pb = (float *) (this->background).data;
-            for(int i=0; i<frame->rows; i++) {
-                for (int j=0; j<frame->cols; j++) {
-                    float difference = (float) abs(pb[i * frame->cols + j] - pa[i * frame->cols + j]);
-                    pa[i * frame->cols + j] = difference;
-                    if (difference > threshold) cnt++;
-                }
-            }
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Time spent for background subtraction: " << usec << " usec" << endl;
-            }
+            // The frames stored as half floats are compared with the background converted to half floats
+            if (frame->depth() == CV_16F && (this->half_background).empty()) this->half_background = HalfFloat::to_half(this->background);
+            const Mat & bg = (frame->depth() == CV_16F) ? this->half_background : this->background;
+            // Without an output the mask of the thread is reused, so that it is not allocated for each frame
+            static thread_local MotionMask local;
+            MotionMask & m = (mask != nullptr) ? *mask : local;
+            long cnt = m.compare(*frame, bg, threshold, *roi);
+            StageHistograms::record(COMPARE, std::chrono::high_resolution_clock::now() - start);
             if (show) {
-                imshow("Background subtraction", *frame);
+                imshow("Background subtraction", m.to_image());
                 waitKey(25);
             }
-            float diff_fraction = (float) cnt / frame->total();
+            // Fraction of different pixels over the area of the region of interest
+            float diff_fraction = (float) cnt / roi->get_area();
             delete frame;
             return diff_fraction;
         }
 
-    public:
-        Worker(Mat background, float threshold, bool show, bool times): background(background), threshold(threshold), show(show), times(times) {}
+        Worker(Mat background, float threshold, RoiMask * roi, RealTime * rt, bool show, bool times): background(background), threshold(threshold), roi(roi), rt(rt), show(show), times(times) {}
+
+        /**
+         * @brief Names the thread of the node in the trace
+         * 
+         * @return 0 to start the node
+         */
+        int svc_init() {
+            TraceRecorder::name_thread("worker");
+            // The workers prepare the background together while the emitter reads the first frames
+            if (this->builder != nullptr) (this->builder)->work();
+            return 0;
+        }
+
+        /**
+         * @brief Sets the builder of the background, when the background is prepared by the workers
+         * 
+         * @param builder the builder, the background and threshold are taken from it when it is ready
+         */
+        void set_builder(BackgroundBuilder * builder) {
+            this->builder = builder;
+        }
+
+        /**
+         * @brief Sets the coarse detector, the frames far from the percentage are decided downsampled
+         * 
+         * @param pyramid the coarse detector
+         */
+        void set_pyramid(Pyramid * pyramid) {
+            this->pyramid = pyramid;
+        }
+
+        /**
+         * @brief Keeps the mask of the different pixels of each frame, that is given with its verdict
+         * 
+         */
+        void set_masks() {
+            this->masks = true;
+        }
+
+        /**
+         * @brief Stores the greyscale and smoothed frames as half floats, so that the frames queued in the
+         *        master between two stages take half of the memory
+         * 
+         */
+        void set_half() {
+            this->half = true;
+        }
+
+        /**
+         * @brief Waits for the background before the first comparison, helping to prepare it
+         * 
+         */
+        void wait_background() {
+            if (this->builder == nullptr) return;
+            (this->builder)->wait_ready();
+            this->background = (this->builder)->get_background();
+            this->threshold = (this->builder)->get_threshold();
+            this->half_background = Mat();
+            this->builder = nullptr;
+        }
+
+        /**
+         * @brief Sets the background of a new video, while the workers are frozen between two videos
+         * 
+         * @param background the background matrix
+         * @param threshold threshold to consider two pixels different
+         */
+        void set_background(Mat background, float threshold) {
+            this->background = background;
+            this->threshold = threshold;
+            this->half_background = Mat();
+            this->builder = nullptr;
+        }
 
         /**
          * @brief Main function of the node, it performs smoothing on the given matrix and submits the result 
@@ -146,20 +275,47 @@ class Worker: public ff_node_t<Task> {
          * @return next task to be computed
          */
         Task * svc(Task * t) {
+            // The master sends the next stage back to the worker of the previous one in affinity mode
+            StageMigrations::record(t->worker, get_my_id(), t->core, StageMigrations::current_core());
+            t->worker = get_my_id();
+            t->core = StageMigrations::current_core();
+            // In real time mode stale frames are dropped before greyscale conversion and smoothing
+            if ((t -> n == 2 || t -> n == 3) && this->dropped(t)) return t;
+            // In pyramid mode the full resolution stages are skipped if the downsampled frame is enough,
+            // the fraction is sent to the master as the result of background subtraction
+            if ((t -> n == 2 || t -> n == 3) && this->pyramid != nullptr && !t->coarse) {
+                TraceScope tr("coarse", "stage", t->frame_number);
+                t->coarse = true;
+                float fraction;
+                if ((this->pyramid)->decide(*(t->m), fraction)) {
+                    delete t->m;
+                    t->m = nullptr;
+                    t->n = fraction;
+                    return t;
+                }
+            }
             // Selects what to do depending on the code received
             if (t -> n == 2) { // Case grayscale conversion
+                PerfScope p(GREYSCALE, t->m->total());
+                TraceScope tr(GREYSCALE, t->frame_number);
                 t->m = this->convert_to_greyscale(t->m);
                 // Updates task code
                 t->n = 3;
             }
             else if (t -> n == 3) { // Case smoothing
+                PerfScope p(SMOOTHING, t->m->total());
+                TraceScope tr(SMOOTHING, t->frame_number);
                 t->m = this->smoothing(t->m);
                 // Updates task code
                 t->n = 4;
             }
             else if (t -> n == 4) { // Case background subtraction
+                this->wait_background();
+                PerfScope p(COMPARE, t->m->total());
+                TraceScope tr(COMPARE, t->frame_number);
                 // Uses task code to communicate the result
-                t->n = this->different_pixels(t->m);
+                if (this->masks) t->mask = make_shared<MotionMask>();
+                t->n = this->different_pixels(t->m, (t->mask).get());
             }
             return t;
         }
@@ -7,6 +7,12 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include "../utils/roi_mask.hpp"
+#include "../utils/latency_histogram.hpp"
+#include "../utils/background_builder.hpp"
+#include "../utils/half_float.hpp"
+#include "../utils/motion_mask.hpp"
+#include "../utils/frame_pool.hpp"
 
 using namespace std;
 using namespace cv;
@@ -23,40 +29,64 @@ class Comparer {
         bool show = false;
         float threshold;
         bool times = false;
+        RoiMask * roi; // region of interest of the frames
+        BackgroundBuilder * builder = nullptr; // builder of the background when it is prepared by the workers
+        Mat half_background; // background as half floats, converted at the first half frame
+        once_flag half_once;
+        FramePool * buffers = nullptr; // pool the compared frames are given back to, nullptr if they are deleted
     
     public:
 
-        Comparer(Mat background, float threshold, bool show, bool times):
-            background(background), threshold(threshold), show(show), times(times) {}
+        Comparer(Mat background, float threshold, RoiMask * roi, bool show, bool times):
+            background(background), threshold(threshold), roi(roi), show(show), times(times) {}
+
+        /**
+         * @brief Creates the comparer of a background prepared in parallel, the frames compared before it
+         *        is ready wait for it
+         * 
+         */
+        Comparer(BackgroundBuilder * builder, RoiMask * roi, bool show, bool times):
+            threshold(0), roi(roi), builder(builder), show(show), times(times) {}
+
+        /**
+         * @brief Gives back the compared frames to a pool of buffers, instead of deleting them
+         * 
+         * @param buffers the pool
+         */
+        void set_buffers(FramePool * buffers) {
+            this->buffers = buffers;
+        }
 
         /**
          * @brief Performs background subtraction
          * 
+         * @param frame the smoothed frame, deleted at the end
+         * @param mask where the mask of the different pixels is stored, nullptr if it is not needed
          * @return the fraction of different pixels between the background and the actual frame over the total
          */
-        float different_pixels(Mat * frame) {
+        float different_pixels(Mat * frame, MotionMask * mask = nullptr) {
+            // The first frames wait for the background, helping to prepare it
+            if (builder != nullptr) builder->wait_ready();
+            Mat bg = (builder != nullptr) ? builder->get_background() : this->background;
+            float thr = (builder != nullptr) ? builder->get_threshold() : this->threshold;
             auto start = std::chrono::high_resolution_clock::now();
-            int cnt = 0;
-            float * pa = (float *) frame->data;
-            float * pb = (float *) (this->background).data;
-            for(int i=0; i<frame->rows; i++) {
-                for (int j=0; j<frame->cols; j++) {
-                    float difference = (float) abs(pb[i * frame->cols + j] - pa[i * frame->cols + j]);
-                    pa[i * frame->cols + j] = difference;
-                    if (difference > threshold) cnt++;
-                }
-            }
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Time spent for background subtraction: " << usec << " usec" << endl;
+            // The frames stored as half floats are compared with the background converted once to half floats
+            if (frame->depth() == CV_16F) {
+                call_once(this->half_once, [&]() { this->half_background = HalfFloat::to_half(bg); });
+                bg = this->half_background;
             }
+            // Without an output the mask of the thread is reused, so that it is not allocated for each frame
+            static thread_local MotionMask local;
+            MotionMask & m = (mask != nullptr) ? *mask : local;
+            long cnt = m.compare(*frame, bg, thr, *roi);
+            StageHistograms::record(COMPARE, std::chrono::high_resolution_clock::now() - start);
             if (show) {
-                imshow("Background subtraction", *frame);
+                imshow("Background subtraction", m.to_image());
                 waitKey(25);
             }
-            float diff_fraction = (float) cnt / frame->total();
-            delete frame; 
+            // Fraction of different pixels over the area of the region of interest
+            float diff_fraction = (float) cnt / roi->get_area();
+            FramePool::give_back(this->buffers, frame);
             return diff_fraction;
         }
 };
\ No newline at end of file
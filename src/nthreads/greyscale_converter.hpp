@@ -7,6 +7,10 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include "../utils/roi_mask.hpp"
+#include "../utils/latency_histogram.hpp"
+#include "../utils/half_float.hpp"
+#include "../utils/frame_pool.hpp"
 
 using namespace std;
 using namespace cv;
@@ -20,10 +24,31 @@ class GreyscaleConverter {
     private:
         bool show = false;
         bool times = false;
+        RoiMask * roi; // region of interest of the frames
+        bool half = false; // the greyscale frames are stored as half floats
+        FramePool * buffers = nullptr; // pool of the frames, nullptr if they are allocated
 
     public:
 
-        GreyscaleConverter(bool show, bool times): show(show), times(times) {}
+        GreyscaleConverter(RoiMask * roi, bool show, bool times): roi(roi), show(show), times(times) {}
+
+        /**
+         * @brief Stores the greyscale frames as half floats, that take half of the memory
+         * 
+         */
+        void set_half() {
+            this->half = true;
+        }
+
+        /**
+         * @brief Takes the greyscale frames from a pool of buffers and gives back the frames consumed, instead of
+         *        allocating and deleting them
+         * 
+         * @param buffers the pool
+         */
+        void set_buffers(FramePool * buffers) {
+            this->buffers = buffers;
+        }
 
         /**
          * @brief Gets the avg intensity of pixel the black and white matrix
@@ -37,11 +62,13 @@ class GreyscaleConverter {
             float * p = (float *) bn.data;
             float sum = 0;
             for(int i=0; i<bn.rows; i++) {
-                for (int j=0; j<bn.cols; j++) {
-                    sum = sum + p[i * bn.cols + j];
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        sum = sum + p[i * bn.cols + j];
+                    }
                 }
             }
-            float avg = (float) sum / bn.total();
+            float avg = (float) sum / roi->get_area();
             avg = round( avg * 100.0 ) / 100.0;
             return avg;
         }
@@ -54,25 +81,34 @@ class GreyscaleConverter {
          */
         Mat * convert_to_greyscale(Mat * frame) {
             auto start = std::chrono::high_resolution_clock::now();
-            Mat * gr = new Mat(frame->rows, frame->cols, CV_32F);
+            if (this->half) {
+                Mat * gr = new Mat(HalfFloat::greyscale(*frame, *roi));
+                FramePool::give_back(this->buffers, frame);
+                StageHistograms::record(GREYSCALE, std::chrono::high_resolution_clock::now() - start);
+                if (this->show) {
+                    imshow("Frame", HalfFloat::to_float(*gr));
+                    waitKey(25);
+                }
+                return gr;
+            }
+            Mat * gr = FramePool::take(this->buffers, frame->rows, frame->cols, CV_32F);
             float * p = (float *) frame->data;
             float r, g, b;
             float * gp = (float *) gr->data;
             int channels = frame->channels();
+            // Only the pixels of the region of interest and their neighbours are converted
             for(int i=0; i<frame->rows; i++) {
-                for (int j=0; j<frame->cols; j++) {
-                    r = (float) p[i * frame->cols * channels + j * channels];
-                    g = (float) p[i * frame->cols * channels + j * channels + 1];
-                    b = (float) p[i * frame->cols * channels + j * channels + 2];
-                    gp[i* frame->cols + j ] = (float) (r + g + b) / channels;
+                for (const Span & s : roi->row_halo_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        r = (float) p[i * frame->cols * channels + j * channels];
+                        g = (float) p[i * frame->cols * channels + j * channels + 1];
+                        b = (float) p[i * frame->cols * channels + j * channels + 2];
+                        gp[i* frame->cols + j ] = (float) (r + g + b) / channels;
+                    }
                 }
             }
-            delete frame;
-            if (this->times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times spent to convert to greyscale: " << usec << " usec" << endl;
-            }
+            FramePool::give_back(this->buffers, frame);
+            StageHistograms::record(GREYSCALE, std::chrono::high_resolution_clock::now() - start);
             if (this->show) {
                 imshow("Frame", *gr);
                 waitKey(25);
@@ -7,6 +7,10 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include "../utils/roi_mask.hpp"
+#include "../utils/latency_histogram.hpp"
+#include "../utils/half_float.hpp"
+#include "../utils/frame_pool.hpp"
 
 using namespace std;
 using namespace cv;
@@ -16,9 +20,30 @@ class Smoother {
         bool show = false;
         bool times = false;
         vector<chrono::microseconds> usecs; 
+        RoiMask * roi; // region of interest of the frames
+        bool half = false; // the smoothed frames are stored as half floats
+        FramePool * buffers = nullptr; // pool of the frames, nullptr if they are allocated
 
     public:
-        Smoother(bool show, bool times): show(show), times(times) {}
+        Smoother(RoiMask * roi, bool show, bool times): roi(roi), show(show), times(times) {}
+
+        /**
+         * @brief Stores the smoothed frames as half floats, the frames read in luma mode are converted
+         * 
+         */
+        void set_half() {
+            this->half = true;
+        }
+
+        /**
+         * @brief Takes the smoothed frames from a pool of buffers and gives back the frames consumed, instead of
+         *        allocating and deleting them
+         * 
+         * @param buffers the pool
+         */
+        void set_buffers(FramePool * buffers) {
+            this->buffers = buffers;
+        }
 
         /**
          * @brief Performs smoothing of a matrix given a filter.
@@ -28,35 +53,45 @@ class Smoother {
          */
         Mat * smoothing(Mat * m) {
             auto start = std::chrono::high_resolution_clock::now();
-            Mat * res = new Mat(m->rows, m->cols, CV_32F, 0.0);
+            if (this->half || m->depth() == CV_16F) {
+                Mat * res = new Mat(HalfFloat::smoothing((m->depth() == CV_16F) ? *m : HalfFloat::to_half(*m), *roi));
+                FramePool::give_back(this->buffers, m);
+                StageHistograms::record(SMOOTHING, std::chrono::high_resolution_clock::now() - start);
+                if (show) {
+                    imshow("Smoothing", HalfFloat::to_float(*res));
+                    waitKey(25);
+                }
+                return res;
+            }
+            // The pixels outside the region are left to 0, so a reused buffer is cleared only with a region
+            Mat * res = FramePool::take(this->buffers, m->rows, m->cols, CV_32F, roi->get_area() < (long) m->total());
             float * sp = (float *) m->data;
             float * mp = (float *) res->data;
-            for(int i=i; i<m->rows; i++) {
-                for (int j=0; j<m->cols; j++) {
-                    int x = j-1;
-                    int y = i-1;
-                    int width = 3;
-                    int height = 3;
-                    // Check that the bounds of the 3x3 kernel do not exceed the frame size
-                    if (x >= 0 && y >= 0 && x + width < m->cols && y + height < m->rows) {
-                        for(int z=y; z<y+height; z++) {
-                            for (int k=x; k<x+width; k++) {
-                                mp[i * res->cols + j] = mp[i * res->cols + j] + (float) (sp[z * m->cols + k] / 9);
+            // Only the pixels of the region of interest are smoothed, the others are left to 0
+            for(int i=0; i<m->rows; i++) {
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        int x = j-1;
+                        int y = i-1;
+                        int width = 3;
+                        int height = 3;
+                        // Check that the bounds of the 3x3 kernel do not exceed the frame size
+                        if (x >= 0 && y >= 0 && x + width < m->cols && y + height < m->rows) {
+                            for(int z=y; z<y+height; z++) {
+                                for (int k=x; k<x+width; k++) {
+                                    mp[i * res->cols + j] = mp[i * res->cols + j] + (float) (sp[z * m->cols + k] / 9);
+                                }
                             }
                         }
+                        // Do not change the values at first and last column or row
+                        else {                            
+                            mp[i * res->cols + j] = sp[i * res->cols + j];
+                        } 
                     }
-                    // Do not change the values at first and last column or row
-                    else {                            
-                        mp[i * res->cols + j] = sp[i * res->cols + j];
-                    } 
                 }
             }
-            delete m;
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times spent for smoothing: " << usec << " usec" << endl;
-            }
+            FramePool::give_back(this->buffers, m);
+            StageHistograms::record(SMOOTHING, std::chrono::high_resolution_clock::now() - start);
             if (show) {
                 imshow("Smoothing", *res);
                 waitKey(25);
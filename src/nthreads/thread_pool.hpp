@@ -6,23 +6,127 @@
 #include <queue>
 #include <mutex>
 #include <vector>
+#include <map>
+#include <optional>
+#include <climits>
 #include <condition_variable>
-#include <future>
+#include <cstring>
 #include <unistd.h>
 #include <sched.h>
 #include "../nthreads/comparer.hpp"
 #include "../nthreads/smoother.hpp"
 #include "../nthreads/greyscale_converter.hpp"
+#include "../utils/realtime.hpp"
+#include "../utils/async_logger.hpp"
+#include "../utils/perf_counters.hpp"
+#include "../utils/trace_recorder.hpp"
+#include "../utils/verdict.hpp"
+#include "../utils/first_verdict.hpp"
+#include "../utils/pyramid.hpp"
+#include "../utils/tiled_stages.hpp"
+#include "../utils/inflight_counter.hpp"
+#include "../utils/stage_migrations.hpp"
+#include "../utils/allocation_counter.hpp"
+#include "../utils/latency_histogram.hpp"
 
 using namespace std;
 using namespace cv;
 
-struct Task {  
-    function<float()> f;
+/**
+ * @brief Stages run by the tasks of the pool
+ * 
+ */
+enum PoolStage { POOL_CONVERSION, POOL_LUMA, POOL_SMOOTHING, POOL_COMPARE, POOL_TILE, POOL_BACKGROUND };
+
+/**
+ * @brief State shared by the tiles of a frame in tiled mode, recycled by the pool for the next frames
+ * 
+ */
+struct TiledFrame {
+    atomic<long> cnt; // different pixels of the tiles run
+    atomic<int> left; // tiles still to run, the last one gives the result
+    mutex l;
+    bool checked; // the first tile run checks the deadline and the coarse detector for all
+    bool dropped;
+    bool decided;
+    float fraction; // fraction of the coarse detector when the frame is decided
+    shared_ptr<MotionMask> mask; // mask of the frame set by the tiles, nullptr if the masks are not kept
+};
+
+/**
+ * @brief Descriptor of a task, with the stage to run and the frame to run it on. It has a fixed size and
+ *        is copied by value in the queues, so creating and dispatching a task makes no allocation
+ * 
+ */
+struct PoolTask {  
+    PoolStage stage;
     int frame_number;
+    int stream; // video of the frame, 0 for the one given to the constructor
+    Mat * m; // the frame, nullptr for the preparation of the background
+    TimePoint arrival; // time at which the frame became available to the reader
+    TiledFrame * tiled; // state shared by the tiles of the frame in tiled mode, nullptr otherwise
+    int tile; // index of the tile in tiled mode
+    int worker; // worker that ran the previous stage of the frame, -1 if it comes from the reader
+    int core; // core on which the previous stage ran
+    long seq; // order in which the task has been queued
 };
 
+/**
+ * @brief Orders in which the workers take the tasks of a stream
+ * 
+ */
+enum SchedPolicy {
+    POLICY_NEWEST, // the tasks of the newest frame first, the default: the frame just read is still in cache
+    POLICY_FIFO, // the tasks in the order in which they have been queued
+    POLICY_OLDEST, // the tasks of the oldest frame first, that bounds the latency of the frames
+    POLICY_STAGE // the later stages first, that finish the frames in flight before starting new ones
+};
+
+/**
+ * @brief Gets the name of a scheduling policy
+ * 
+ * @param policy the policy
+ * @return the name, as given to the -policy option
+ */
+inline const char * policy_name(SchedPolicy policy) {
+    static const char * names[] = {"newest", "fifo", "oldest", "stage"};
+    return names[policy];
+}
+
+/**
+ * @brief Parses the name of a scheduling policy
+ * 
+ * @param name the name
+ * @param policy where the policy is stored
+ * @return true if the name is a policy
+ */
+inline bool parse_policy(const char * name, SchedPolicy & policy) {
+    for (int p=POLICY_NEWEST; p<=POLICY_STAGE; p++) {
+        if (strcmp(name, policy_name((SchedPolicy) p)) == 0) {
+            policy = (SchedPolicy) p;
+            return true;
+        }
+    }
+    return false;
+}
+
 struct CompareTasks {
+    SchedPolicy policy;
+
+    CompareTasks(SchedPolicy policy = POLICY_NEWEST): policy(policy) {}
+
+    /**
+     * @brief Rank of the stage of a task, the first stage of a frame has rank 0
+     * 
+     * @param t the task
+     * @return the rank
+     */
+    static int rank(PoolTask const& t) {
+        if (t.stage == POOL_SMOOTHING) return 1;
+        if (t.stage == POOL_COMPARE) return 2;
+        return 0;
+    }
+
     /**
      * @brief Return true if t1 is ordered before t2
      * 
@@ -31,8 +135,82 @@ struct CompareTasks {
      * @return true if t1 is ordered before t2
      * @return false if t2 is ordered before t1 or it is equal to t1
      */
-    bool operator()(Task const& t1, Task const& t2){
-        return t1.frame_number < t2.frame_number;
+    bool operator()(PoolTask const& t1, PoolTask const& t2) const {
+        // With every policy the preparation of the background comes before the frames, that wait for it
+        bool b1 = t1.stage == POOL_BACKGROUND;
+        bool b2 = t2.stage == POOL_BACKGROUND;
+        if (b1 != b2) return b2;
+        switch (policy) {
+            case POLICY_FIFO:
+                return t1.seq > t2.seq;
+            case POLICY_OLDEST:
+                if (t1.frame_number != t2.frame_number) return t1.frame_number > t2.frame_number;
+                return t1.seq > t2.seq;
+            case POLICY_STAGE:
+                if (rank(t1) != rank(t2)) return rank(t1) < rank(t2);
+                if (t1.frame_number != t2.frame_number) return t1.frame_number > t2.frame_number;
+                return t1.seq > t2.seq;
+            default:
+                return t1.frame_number < t2.frame_number;
+        }
+    }
+};
+
+/**
+ * @brief Priority queue of the tasks whose storage can be reserved, so that it does not allocate once it
+ *        can hold the tasks allowed in the pool
+ * 
+ */
+struct TaskQueue : public priority_queue<PoolTask, std::vector<PoolTask>, CompareTasks> {
+    TaskQueue(CompareTasks compare = CompareTasks()): priority_queue<PoolTask, std::vector<PoolTask>, CompareTasks>(compare) {}
+
+    void reserve(size_t n) {
+        (this->c).reserve(n);
+    }
+};
+
+/**
+ * @brief Video analyzed by the pool, with its own stages and results. Several streams share the
+ *        workers of a persistent pool
+ * 
+ */
+struct PoolStream {
+    int id;
+    Smoother * smoother;
+    GreyscaleConverter * converter;
+    Comparer * comparer;
+    float percent; // percentage of different pixels between frame and background to detect movement
+    VerdictCallback on_verdict = nullptr; // function called with the result of each frame, nullptr if not used
+    bool masks = false; // the mask of the different pixels of each frame is given with its verdict
+    Pyramid * pyramid = nullptr; // coarse detector, nullptr if pyramid mode is not used
+    TiledStages * tiled = nullptr; // stages run on the tiles of the frames, nullptr if tiled mode is not used
+    InFlightCounter * inflight = nullptr; // frames between the reader and their result with a memory budget, nullptr if not used
+    atomic<int> res_number;
+    atomic<int> different_frames;
+    // Tasks of the stream, in the order of the scheduling policy of the pool
+    TaskQueue queue;
+
+    PoolStream(int id, Smoother * smoother, GreyscaleConverter * converter, Comparer * comparer, float percent,
+        SchedPolicy policy = POLICY_NEWEST): id(id), smoother(smoother), converter(converter), comparer(comparer), percent(percent) {
+            this -> res_number = 0;
+            this -> different_frames = 0;
+            this -> set_policy(policy);
+        }
+
+    /**
+     * @brief Sets the order of the tasks, the queue must be empty
+     * 
+     * @param policy the scheduling policy
+     */
+    void set_policy(SchedPolicy policy) {
+        this -> queue = TaskQueue(CompareTasks(policy));
+        (this -> queue).reserve(64);
+    }
+
+    ~PoolStream() {
+        delete smoother;
+        delete converter;
+        delete comparer;
     }
 };
 
@@ -49,132 +227,655 @@ class ThreadPool {
         bool show = false;
         bool times = false;
         bool mapping = false;
+        int cpu_offset = 0; // first core used for the workers when mapping is used
 
         // Variables and values used by the program
         int frame_number = 0;
         float threshold; // threshold to exceed to consider two pixels different
-        float percent; // percentage of different pixels between frame and background to detect movement
         Mat background; // background frame
 
         // Variables for concurrency
         mutex lstop; // lock to set stop flag
         mutex l;
-        atomic<int> res_number;
-        atomic<int> different_frames;
         atomic<bool> stop; // flag to stop the thread pool
-        priority_queue<Task, std::vector<Task>, CompareTasks> queue;
+        // Streams by id, the workers take their tasks in turn so that each video gets a fair share
+        map<int, PoolStream *> streams;
+        PoolStream * main = nullptr; // stream given to the constructor, nullptr for a pool of streams only
+        int next_stream = 1; // id of the next stream opened
+        int turn = 0; // id from which the workers look for the next task
+        size_t pending = 0; // tasks in the queues of all the streams
         condition_variable cond;
         vector<thread> tids;
+        long queue_high_water = 0; // maximum length reached by the queue
+        atomic<long> stall_usec{0}; // time spent by the readers waiting for room in the queue
+
+        // Order of the tasks of the streams, and its effect on the frames
+        SchedPolicy policy = POLICY_NEWEST;
+        long next_seq = 0; // order of the next task queued
+        vector<LatencyHistogram> frame_latency; // latency of the frames from the reader to the result, for each worker
+        atomic<long> frames_in_flight{0}; // frames submitted and without a result
+        atomic<long> in_flight_high_water{0};
+        atomic<long> frames_done{0}; // frames with a result
+        atomic<long> frames_dropped{0}; // frames dropped without a result
+        once_flag started; // set by the submission of the first frame
+        TimePoint first_frame; // submission of the first frame
+        atomic<long> last_frame_usec{0}; // result of the last frame, from the first submission
         
-        // Classes to operate with frames
-        Smoother * smoother;
-        GreyscaleConverter * converter;
-        Comparer * comparer;
+        // Real time controller, nullptr if real time mode is not used
+        RealTime * rt = nullptr;
+
+        // With stage affinity the next stage of a frame is kept by the worker that submits it, the other
+        // workers take it only when they have nothing else to do and the worker has a backlog of kept tasks
+        bool affinity = false;
+        vector<vector<PoolTask>> local; // tasks kept by each worker
+        size_t local_pending = 0; // tasks in the local queues, counted also in pending
+        int waiting = 0; // workers waiting for a task
+        atomic<long> steals{0}; // tasks taken from the local queue of another worker
+
+        /**
+         * @brief Gets the index of the worker running the calling thread
+         * 
+         * @return the index, -1 for the threads that are not workers
+         */
+        static int & worker_id() {
+            static thread_local int id = -1;
+            return id;
+        }
+
+        /**
+         * @brief Gets the mask of the frame just finished by the calling worker, given with its verdict
+         * 
+         * @return the mask, nullptr if the masks are not kept
+         */
+        static shared_ptr<MotionMask> & frame_mask() {
+            static thread_local shared_ptr<MotionMask> mask;
+            return mask;
+        }
+
+        // In persistent mode the workers are kept alive between videos, until the pool is stopped
+        bool persistent = false;
+        mutex lresults; // lock to wait for the results in persistent mode
+        condition_variable results_cond;
+
+        BackgroundBuilder * builder = nullptr; // builder run by the background tasks
+        vector<TiledFrame *> free_tiled; // states of the tiled frames that have been analyzed, reused for the next ones
+
+        /**
+         * @brief Creates a task descriptor
+         * 
+         * @param stage the stage run by the task
+         * @param m the frame
+         * @param n the number of the frame
+         * @param arrival time at which the frame became available to the reader
+         * @param stream the video of the frame
+         * @return the task
+         */
+        static PoolTask make_task(PoolStage stage, Mat * m, int n, TimePoint arrival, int stream) {
+            PoolTask t;
+            t.stage = stage;
+            t.frame_number = n;
+            t.stream = stream;
+            t.m = m;
+            t.arrival = arrival;
+            t.tiled = nullptr;
+            t.tile = 0;
+            t.worker = -1;
+            t.core = -1;
+            t.seq = 0;
+            return t;
+        }
+
+        /**
+         * @brief Counts a frame that has left the pool, recording its latency if it has a result
+         * 
+         * @param id the worker that finished the frame
+         * @param t the last task of the frame
+         * @param fraction the result of the frame, negative if it has been dropped
+         */
+        void frame_left(int id, const PoolTask & t, float fraction) {
+            TimePoint now = chrono::steady_clock::now();
+            if (fraction >= 0) frame_latency[id].record(chrono::duration_cast<chrono::nanoseconds>(now - t.arrival).count());
+            long usec = chrono::duration_cast<chrono::microseconds>(now - first_frame).count();
+            long last = last_frame_usec;
+            while (usec > last && !last_frame_usec.compare_exchange_weak(last, usec)) {}
+            frames_in_flight--;
+            if (fraction >= 0) frames_done++;
+            else frames_dropped++;
+        }
+
+        /**
+         * @brief Starts the clock of the throughput at the submission of the first frame, before its tasks
+         *        are queued
+         * 
+         */
+        void frame_submitted() {
+            call_once(started, [this] { first_frame = chrono::steady_clock::now(); });
+        }
+
+        /**
+         * @brief Counts a frame submitted by the reader, after its tasks are queued, so that the time the
+         *        reader waits for room in the queue is not counted in flight. A worker can finish the frame
+         *        before it is counted, then the frames in flight are one less for a moment
+         * 
+         */
+        void frame_entered() {
+            long n = ++frames_in_flight;
+            long h = in_flight_high_water;
+            while (n > h && !in_flight_high_water.compare_exchange_weak(h, n)) {}
+        }
+
+        /**
+         * @brief Gets the state of a tiled frame, reusing the one of a frame already analyzed
+         * 
+         * @param tiles number of tiles of the frame
+         * @return the state, reset
+         */
+        TiledFrame * get_tiled_frame(int tiles) {
+            TiledFrame * tf = nullptr;
+            {
+                unique_lock<mutex> lock(this -> l);
+                if (!free_tiled.empty()) {
+                    tf = free_tiled.back();
+                    free_tiled.pop_back();
+                }
+            }
+            if (tf == nullptr) {
+                AllocationScope a;
+                tf = new TiledFrame;
+            }
+            tf->cnt = 0;
+            tf->left = tiles;
+            tf->checked = false;
+            tf->dropped = false;
+            tf->decided = false;
+            tf->fraction = 0;
+            return tf;
+        }
+
+        /**
+         * @brief Runs the stage of a task, submitting the task of the next stage of the frame
+         * 
+         * @param s the stream of the task
+         * @param t the task
+         * @param fraction where the fraction of different pixels is stored when the frame is finished, -1
+         *        if it has been dropped
+         * @return true if the frame is finished
+         */
+        bool execute(PoolStream * s, PoolTask & t, float & fraction) {
+            int n = t.frame_number;
+            switch (t.stage) {
+                case POOL_CONVERSION:
+                case POOL_LUMA:
+                    // A negative fraction means that the frame has been dropped
+                    if (dropped(t.m, t.arrival)) {
+                        fraction = -1;
+                        return true;
+                    }
+                    if (coarse(s, t.m, n, t.arrival, fraction)) return true;
+                    if (t.stage == POOL_LUMA) {
+                        // The frame read in luma mode is already in greyscale
+                        t.stage = POOL_SMOOTHING;
+                        return execute(s, t, fraction);
+                    }
+                    {
+                        PerfScope p(GREYSCALE, t.m->total());
+                        TraceScope tr(GREYSCALE, n);
+                        t.m = s->converter -> convert_to_greyscale(t.m);
+                    }
+                    t.stage = POOL_SMOOTHING;
+                    submit_task(t);
+                    return false;
+                case POOL_SMOOTHING:
+                    if (dropped(t.m, t.arrival)) {
+                        fraction = -1;
+                        return true;
+                    }
+                    {
+                        PerfScope p(SMOOTHING, t.m->total());
+                        TraceScope tr(SMOOTHING, n);
+                        t.m = (s->smoother)->smoothing(t.m);
+                    }
+                    t.stage = POOL_COMPARE;
+                    submit_task(t);
+                    return false;
+                case POOL_COMPARE:
+                    {
+                        PerfScope p(COMPARE, t.m->total());
+                        TraceScope tr(COMPARE, n);
+                        if (s->masks) frame_mask() = make_shared<MotionMask>();
+                        fraction = s->comparer->different_pixels(t.m, frame_mask().get());
+                    }
+                    if (rt != nullptr) rt->complete(t.arrival);
+                    return true;
+                case POOL_TILE:
+                    return execute_tile(s, t, fraction);
+                case POOL_BACKGROUND:
+                    builder->work();
+                    return false;
+            }
+            return false;
+        }
+
+        /**
+         * @brief Runs a tile of a frame in tiled mode, the last tile of the frame gives its result
+         * 
+         * @param s the stream of the task
+         * @param t the task
+         * @param fraction where the fraction of different pixels is stored when the frame is finished
+         * @return true if the frame is finished
+         */
+        bool execute_tile(PoolStream * s, PoolTask & t, float & fraction) {
+            TiledFrame * tf = t.tiled;
+            {
+                // The other tiles of the frame wait for the check, that is cheaper than a tile
+                unique_lock<mutex> lock(tf->l);
+                if (!tf->checked) {
+                    if (rt != nullptr && rt->expired(t.arrival)) tf->dropped = true;
+                    else if (s->pyramid != nullptr) {
+                        TraceScope tr("coarse", "stage", t.frame_number);
+                        tf->decided = (s->pyramid)->decide(*(t.m), tf->fraction);
+                    }
+                    tf->checked = true;
+                }
+            }
+            if (!tf->dropped && !tf->decided) {
+                TraceScope tr("tile", "stage", t.frame_number);
+                tf->cnt += (s->tiled)->run_tile(*(t.m), t.tile, (tf->mask).get());
+            }
+            if (--(tf->left) > 0) return false;
+            delete t.m;
+            // The mask is given with the verdict only if the tiles have set it
+            if (!tf->dropped && !tf->decided) frame_mask() = move(tf->mask);
+            else (tf->mask).reset();
+            if (tf->dropped) {
+                rt->drop();
+                fraction = -1;
+            }
+            else {
+                if (rt != nullptr) rt->complete(t.arrival);
+                fraction = (tf->decided) ? tf->fraction : (float) tf->cnt / (s->tiled)->get_area();
+            }
+            {
+                AllocationScope a;
+                unique_lock<mutex> lock(this -> l);
+                free_tiled.push_back(tf);
+            }
+            return true;
+        }
+
+        /**
+         * @brief Tells if a frame has exceeded its deadline in real time mode, in that case it is dropped
+         * 
+         * @param m the frame to check
+         * @param arrival time at which the frame became available to the reader
+         * @return true if the frame has been dropped
+         */
+        bool dropped(Mat * m, TimePoint arrival) {
+            if (rt == nullptr || !rt->expired(arrival)) return false;
+            delete m;
+            rt->drop();
+            return true;
+        }
+
+        /**
+         * @brief Decides a frame on its downsampled version in pyramid mode, before the full resolution stages
+         * 
+         * @param s the stream of the frame
+         * @param m the frame, deleted if it is decided
+         * @param n the number of the frame
+         * @param arrival time at which the frame became available to the reader
+         * @param fraction where the fraction of different pixels is stored if the frame is decided
+         * @return true if the frame is decided
+         */
+        bool coarse(PoolStream * s, Mat * m, int n, TimePoint arrival, float & fraction) {
+            if (s->pyramid == nullptr) return false;
+            {
+                TraceScope tr("coarse", "stage", n);
+                if (!(s->pyramid)->decide(*m, fraction)) return false;
+            }
+            delete m;
+            if (rt != nullptr) rt->complete(arrival);
+            return true;
+        }
+
+        /**
+         * @brief Gets a stream by id
+         * 
+         * @param id the id of the stream
+         * @return the stream
+         */
+        PoolStream * get_stream(int id) {
+            unique_lock<mutex> lock(this -> l);
+            return streams.at(id);
+        }
+
+        /**
+         * @brief Tells if all the frames of the main stream have a result, when the pool is not persistent
+         * 
+         * @return true if the workers can exit
+         */
+        bool finished() {
+            return this->frame_number >= 0 && main != nullptr && main->res_number == this->frame_number;
+        }
+
+        /**
+         * @brief Tells if a local queue has tasks that another worker can steal: the worker takes its next
+         *        task as soon as it returns from the current one, so only the tasks after it are stolen
+         * 
+         * @param q the local queue
+         * @return true if a task can be stolen
+         */
+        static bool stealable(const vector<PoolTask> & q) {
+            return q.size() > 1;
+        }
+
+        /**
+         * @brief Tells if there is a task for the calling thread. It must be called with the lock of the
+         *        queues held
+         * 
+         * @return true if next_task gives a task
+         */
+        bool has_task() {
+            if (pending > local_pending) return true;
+            if (local_pending == 0) return false;
+            int w = worker_id();
+            if (w >= 0 && w < (int) local.size() && !local[w].empty()) return true;
+            for (vector<PoolTask> & other : local) {
+                if (stealable(other)) return true;
+            }
+            return false;
+        }
+
+        /**
+         * @brief Takes the next task: with stage affinity the one kept by the worker first, then from the
+         *        first stream with tasks after the one served last, and only then one kept by another worker
+         *        behind its next task. It must be called with the lock of the queues held
+         * 
+         * @param t where the task is stored
+         * @return the stream of the task, nullptr if there are no tasks
+         */
+        PoolStream * next_task(PoolTask & t) {
+            if (pending == 0) return nullptr;
+            if (local_pending > 0) {
+                int w = worker_id();
+                vector<PoolTask> * q = (w >= 0 && w < (int) local.size() && !local[w].empty()) ? &local[w] : nullptr;
+                // The worker is idle when the streams have no tasks, so it steals from a backlog
+                if (q == nullptr && pending == local_pending) {
+                    for (vector<PoolTask> & other : local) {
+                        if (stealable(other)) {
+                            q = &other;
+                            steals++;
+                            break;
+                        }
+                    }
+                }
+                if (q != nullptr) {
+                    t = q->front();
+                    q->erase(q->begin());
+                    pending--;
+                    local_pending--;
+                    return streams.at(t.stream);
+                }
+                // Only the tasks kept by the other workers are left, and they will take them
+                if (pending == local_pending) return nullptr;
+            }
+            auto it = streams.lower_bound(turn);
+            for (size_t i=0; i<=streams.size(); i++, it++) {
+                if (it == streams.end()) it = streams.begin();
+                if (!it->second->queue.empty()) break;
+            }
+            PoolStream * s = it->second;
+            t = s->queue.top();
+            s->queue.pop();
+            pending--;
+            turn = s->id + 1;
+            return s;
+        }
+
+        /**
+         * @brief Reserves the queue of a stream for the tasks allowed in it, before queueing the initial
+         *        tasks of a frame. It must be called with the lock of the queues held
+         * 
+         * @param stream the stream
+         * @param n the number of initial tasks of the frame
+         */
+        void reserve(int stream, size_t n) {
+            // Up to 10 frames of n tasks are queued with the new one, and a task for each worker going on with a frame
+            streams.at(stream)->queue.reserve(11 * n + this->nw);
+        }
+
+        /**
+         * @brief Adds a task to the queue of its stream. It must be called with the lock of the queues held
+         * 
+         * @param t the task
+         */
+        void enqueue(PoolTask & t) {
+            t.seq = next_seq++;
+            streams.at(t.stream)->queue.push(t);
+            pending++;
+            if ((long) pending > queue_high_water) queue_high_water = pending;
+            TraceRecorder::counter("queue length", pending);
+        }
 
     public:
 
         ThreadPool(Smoother * smoother, GreyscaleConverter * converter, Comparer * comparer, int nw, Mat background, 
             float threshold, float percent, bool show, bool times, bool mapping):
-            background(background), threshold(threshold), percent(percent), show(show), times(times), smoother(smoother), 
-            converter(converter), comparer(comparer), nw(nw), mapping(mapping) {
+            background(background), threshold(threshold), show(show), times(times), nw(nw), mapping(mapping) {
                 this -> stop = false;
                 this -> frame_number = -1;
-                this -> res_number = 0;
-                this -> different_frames = 0;
+                this -> main = new PoolStream(0, smoother, converter, comparer, percent);
+                this -> streams[0] = this -> main;
             }
 
+        /**
+         * @brief Creates a persistent pool without a main stream, the videos are added with open_stream
+         * 
+         * @param nw number of workers
+         * @param times flag to log the results of the frames
+         * @param mapping flag to map the workers on the cores
+         */
+        ThreadPool(int nw, bool times, bool mapping): nw(nw), times(times), mapping(mapping) {
+            this -> stop = false;
+            this -> frame_number = -1;
+            this -> persistent = true;
+        }
+
+        ~ThreadPool() {
+            for (TiledFrame * tf : free_tiled) delete tf;
+        }
+
         /**
          * @brief Insert the initial task (grayscale conversion of the frame), 
          *        in this case check the queue size before inserting
          * 
          * @param t task to insert
          */
-        void submit_initial_task(Task t) {
+        void submit_initial_task(PoolTask t) {
+            submit_initial_tasks(&t, 1);
+        }
+
+        /**
+         * @brief Insert the initial tasks of a frame together, checking the queue size as for a single
+         *        initial task: a frame split in n tasks waits until there are at most 10 frames of n tasks.
+         *        With a memory budget the frame waits instead until its bytes fit in the budget
+         * 
+         * @param ts tasks to insert, of the same frame and stream
+         * @param n number of tasks
+         */
+        void submit_initial_tasks(PoolTask * ts, size_t n) {
+            AllocationScope a;
             bool submitted = false;
+            auto start = std::chrono::high_resolution_clock::now();
+            // The reader is traced as blocked only when it waits for room
+            optional<TraceScope> tr;
+            InFlightCounter * inflight = get_stream(ts[0].stream)->inflight;
+            if (inflight != nullptr) {
+                if (!inflight->try_enter()) {
+                    tr.emplace("blocked", "reader", ts[0].frame_number);
+                    inflight->enter();
+                }
+                {
+                    unique_lock<mutex> lock(this -> l);
+                    reserve(ts[0].stream, n);
+                    for (size_t k=0; k<n; k++) enqueue(ts[k]);
+                }
+                if (n == 1) cond.notify_one();
+                else cond.notify_all();
+                submitted = true;
+            }
             while (!submitted) {
                 {
                     unique_lock<mutex> lock(this -> l);
-                    // Queues the task if there are less or equal than 10 tasks
-                    if (queue.size() <= 10) {
-                        queue.push(t);
+                    // Queues the tasks if there are less or equal than 10 frames of tasks of its stream
+                    if (streams.at(ts[0].stream)->queue.size() <= 10 * n) {
+                        reserve(ts[0].stream, n);
+                        for (size_t k=0; k<n; k++) enqueue(ts[k]);
                         submitted = true;
                     }
                 }
                 // Notifies other workers if there is a submission
-                if (!submitted) this_thread::sleep_for(std::chrono::microseconds(1000));
-                else cond.notify_one();
+                if (!submitted) {
+                    if (!tr) tr.emplace("blocked", "reader", ts[0].frame_number);
+                    this_thread::sleep_for(std::chrono::microseconds(1000));
+                }
+                else if (n == 1) cond.notify_one();
+                else cond.notify_all();
             }
+            this->stall_usec += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
         }
 
         /**
-         * @brief Insert a task in the queue and notify one worker
+         * @brief Insert a task in the queue and notify one worker. With stage affinity a task submitted by
+         *        a worker is kept by it, without waking up the others, since it takes it as soon as it
+         *        returns from the current task
          * 
          * @param t task to insert
          */
-        void submit_task(Task t) {
+        void submit_task(PoolTask t) {
+            AllocationScope a;
+            int w = worker_id();
+            if (w >= 0) {
+                t.worker = w;
+                t.core = StageMigrations::current_core();
+            }
+            bool keep = affinity && w >= 0 && w < (int) local.size();
+            bool notify = !keep;
             {
                 unique_lock<mutex> lock(this->l);
-                queue.push(t);
+                if (keep) {
+                    local[w].push_back(t);
+                    local_pending++;
+                    pending++;
+                    if ((long) pending > queue_high_water) queue_high_water = pending;
+                    TraceRecorder::counter("queue length", pending);
+                    // The kept task is left to the worker, the waiting ones are woken only for a backlog
+                    notify = waiting > 0 && stealable(local[w]);
+                }
+                else enqueue(t);
             }
-            cond.notify_one();
+            if (notify) cond.notify_one();
         } 
 
         /**
          * @brief Creates a task to convert a frame in black and white and puts it in the queue
          * 
          * @param m the frame to convert to grayscale
+         * @param arrival time at which the frame became available to the reader
+         * @param stream the video of the frame
          */
-        void submit_conversion_task(Mat * m, int n) {
-            // Creates the task
-            auto f = [this, n] (Mat * m) {
-                m = converter -> convert_to_greyscale(m);
-                submit_smoothing_task(m, n);
-                return (float)2;
-            };
-            auto fb = bind(f, m);
-            Task t;
-            t.frame_number = n;
-            t.f = fb;
-            // Inserts the task in the queue
-            submit_initial_task(t);
+        void submit_conversion_task(Mat * m, int n, TimePoint arrival = chrono::steady_clock::now(), int stream = 0) {
+            PoolTask t = make_task(POOL_CONVERSION, m, n, arrival, stream);
+            frame_submitted();
+            // Inserts the task in the queue, in real time mode the reader limits the frames in the pool
+            if (rt != nullptr) submit_task(t);
+            else submit_initial_task(t);
+            frame_entered();
+        }
+
+        /**
+         * @brief Creates a task to perform smoothing on a frame read in luma mode, that is already
+         *        in greyscale, and puts it in the queue checking its size as for the initial tasks
+         * 
+         * @param m the frame to smooth
+         * @param arrival time at which the frame became available to the reader
+         * @param stream the video of the frame
+         */
+        void submit_luma_task(Mat * m, int n, TimePoint arrival = chrono::steady_clock::now(), int stream = 0) {
+            PoolTask t = make_task(POOL_LUMA, m, n, arrival, stream);
+            frame_submitted();
+            // Inserts the task in the queue, in real time mode the reader limits the frames in the pool
+            if (rt != nullptr) submit_task(t);
+            else submit_initial_task(t);
+            frame_entered();
+        }
+
+        /**
+         * @brief Splits a frame in tiles and puts a task for each tile in the queue, each task runs the three
+         *        stages on its tile. The tiles of a frame are taken by different workers, the one that
+         *        finishes the last tile gives the result of the frame
+         * 
+         * @param m the frame, BGR or greyscale in luma mode
+         * @param arrival time at which the frame became available to the reader
+         * @param stream the video of the frame
+         */
+        void submit_tiled_task(Mat * m, int n, TimePoint arrival = chrono::steady_clock::now(), int stream = 0) {
+            int tiles = get_stream(stream)->tiled->tiles(*m);
+            // Shared by the tiles of the frame, the frame is deleted with the last tile
+            TiledFrame * tf = get_tiled_frame(tiles);
+            if (get_stream(stream)->masks) tf->mask = make_shared<MotionMask>(m->rows, m->cols);
+            // The tasks of the frames are built in the same buffer, that keeps its capacity
+            static thread_local vector<PoolTask> ts;
+            {
+                AllocationScope a;
+                ts.resize(tiles);
+            }
+            for (int k=0; k<tiles; k++) {
+                ts[k] = make_task(POOL_TILE, m, n, arrival, stream);
+                ts[k].tiled = tf;
+                ts[k].tile = k;
+            }
+            frame_submitted();
+            // In real time mode the reader limits the frames in the pool
+            if (rt != nullptr) for (PoolTask & t : ts) submit_task(t);
+            else submit_initial_tasks(ts.data(), ts.size());
+            frame_entered();
+        }
+
+        /**
+         * @brief Submits the preparation of the background to the workers, before the frames. The workers
+         *        that find no band left go on with the frames, that wait for the background in the comparison
+         * 
+         * @param builder the builder of the background
+         */
+        void submit_background(BackgroundBuilder * builder) {
+            this -> builder = builder;
+            for (int i=0; i<(this->nw); i++) {
+                // The tasks with the highest number are taken first
+                submit_task(make_task(POOL_BACKGROUND, nullptr, INT_MAX, chrono::steady_clock::now(), 0));
+            }
         }
 
         /**
          * @brief Create a task to performs smoothing on a matrix and puts it in the queue
          * 
          * @param m the matrix to smooth
+         * @param arrival time at which the frame became available to the reader
+         * @param stream the video of the frame
          */
-        void submit_smoothing_task(Mat * m, int n) {
-            // Creates the task
-            auto f = [this, n] (Mat * m) {
-                m = (this->smoother)->smoothing(m);
-                submit_result_task(m, n);
-                return (float)3;
-            };
-            auto fb = (bind(f, m));
-            Task t;
-            t.frame_number = n;
-            t.f = fb;
-            // Inserts the task in the queue
-            submit_task(t);
+        void submit_smoothing_task(Mat * m, int n, TimePoint arrival, int stream = 0) {
+            submit_task(make_task(POOL_SMOOTHING, m, n, arrival, stream));
         }
 
         /**
          * @brief Creates a task to compare a frame with background and puts it in the queue
          * 
          * @param m the frame to compare to background
+         * @param arrival time at which the frame became available to the reader
+         * @param stream the video of the frame
          */
-        void submit_result_task(Mat * m, int n) {
-            // Creates the task
-            auto f = [this, n] (Mat * m) {
-                return this->comparer->different_pixels(m);
-            };
-            auto fb = (bind(f, m));
-            Task t;
-            t.frame_number = n;
-            t.f = fb;
-            // Inserts the task in the queue
-            submit_task(t);
+        void submit_result_task(Mat * m, int n, TimePoint arrival, int stream = 0) {
+            submit_task(make_task(POOL_COMPARE, m, n, arrival, stream));
         }
 
         
@@ -184,34 +885,53 @@ class ThreadPool {
          */
         void start_pool() {
             // Body of a worker
-            auto body = [&] {
+            auto body = [&] (int id) {
+                worker_id() = id;
+                TraceRecorder::name_thread("worker");
                 float res = 0;
-                function<float()> f = []() {return -1;};
-                Task t;
+                bool done = false;
+                PoolTask t;
+                PoolStream * s;
                 // Loop until background subtraction is done for all the frames of the video
-                while (this->res_number <= this->frame_number || this->frame_number < 0) {
+                while (!finished()) {
                     {
-                        // Gets a task from the queue
+                        // Gets a task from the queues, the streams are served in turn
+                        AllocationScope a;
                         unique_lock<mutex> lock(this -> l);
-                        cond.wait(lock, [&](){return(!queue.empty() || (this->stop) || 
-                            (this->res_number == this->frame_number && this->frame_number >= 0));});
-                        if (!queue.empty()) {
-                            t = queue.top();
-                            queue.pop();
-                        }
-                        else if (this -> stop || (this->res_number == this->frame_number && this->frame_number >= 0)) {
-                            break;
-                        }
+                        waiting++;
+                        cond.wait(lock, [&](){return(has_task() || (this->stop) || finished());});
+                        waiting--;
+                        s = next_task(t);
+                        if (s != nullptr) TraceRecorder::counter("queue length", pending);
+                        else break;
                     }
+                    StageMigrations::record(t.worker, id, t.core, StageMigrations::current_core());
                     // Executes task
-                    res = t.f();
-                    if (res >= 0 && res <= 1) { // Case background subtraction, store the result
-                        if (res > this->percent) this->different_frames++;
-                        this -> res_number++;
-                        if (times) cout << "Frames with movement detected until now: " << this->different_frames << " over " << res_number << " analyzed" << endl;
+                    done = execute(s, t, res);
+                    if (done) frame_left(id, t, res);
+                    // The frame has left the pool, making room for the next one with a memory budget
+                    if (done && s->inflight != nullptr) s->inflight->leave();
+                    // The stream can be closed as soon as its last result is counted, so it is not used after
+                    if (done && res >= 0) { // Case background subtraction, store the result
+                        FirstVerdict::mark();
+                        bool motion = res > s->percent;
+                        if (motion) s->different_frames++;
+                        shared_ptr<const MotionMask> mask = move(frame_mask());
+                        if (s->on_verdict) s->on_verdict({t.frame_number, res, motion, mask});
+                        if (times) AsyncLogger::instance().log("Frames with movement detected until now: " + to_string(s->different_frames) + " over " + to_string(s->res_number + 1) + " analyzed");
+                        if (s == main && s->res_number + 1 == AllocationCounter::WARMUP_FRAMES) AllocationCounter::mark_steady();
+                        s -> res_number++;
+                    }
+                    else if (done) { // Case frame dropped in real time mode, it is counted without result
+                        s -> res_number++;
                     } // If it is the grayscale conversion or smoothing case, it is not needed to do anything here
+                    // Wakes up who waits for the results of a video in persistent mode
+                    if (persistent && done) {
+                        { unique_lock<mutex> lock(this->lresults); }
+                        results_cond.notify_all();
+                    }
                     // Break when it knows the total number of frames and they are finished
-                    if (this->res_number == this->frame_number && this->frame_number >= 0) break;
+                    if (finished()) break;
                 }
                 // Stop the pool when all the frame have been analysed
                 {
@@ -225,18 +945,272 @@ class ThreadPool {
 
             // Threads starting
             int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
+            local.resize(this->nw);
+            frame_latency.resize(this->nw);
+            // In tiled mode the states of the frames that fit in the queue (10 frames and the one being
+            // submitted) and on the workers are allocated now, more are allocated only with a larger limit
+            int tiled_frames = (main != nullptr && main->tiled != nullptr) ? 11 + this->nw : 0;
+            free_tiled.reserve(max(64, tiled_frames));
+            for (int i=0; i<tiled_frames; i++) free_tiled.push_back(new TiledFrame);
             for (int i=0; i<(this->nw); i++) {
-                (this -> tids).push_back(thread(body));
+                (this -> tids).push_back(thread(body, i));
                 if (mapping) {
                     cpu_set_t cpuset;
                     CPU_ZERO(&cpuset);
-                    CPU_SET(i%numCPU, &cpuset);
+                    CPU_SET((this->cpu_offset + i)%numCPU, &cpuset);
                     int rc = pthread_setaffinity_np((this -> tids).at(i).native_handle(), sizeof(cpu_set_t), &cpuset);
                     assert(rc == 0);
                 }
             }
         }
 
+        /**
+         * @brief Sets the real time controller, used to drop the frames that exceed their deadline
+         * 
+         * @param rt the real time controller
+         */
+        void set_realtime(RealTime * rt) {
+            this -> rt = rt;
+        }
+
+        /**
+         * @brief Sets the function called with the result of each frame of the main stream, from the worker
+         *        that computed it
+         * 
+         * @param callback the function
+         */
+        void set_callback(VerdictCallback callback) {
+            main -> on_verdict = callback;
+        }
+
+        /**
+         * @brief Gives the mask of the different pixels of each frame of a stream with its verdict, each
+         *        frame is compared in a new mask. It must be called before submitting the frames
+         * 
+         * @param stream the id of the stream, 0 for the main one
+         */
+        void set_masks(int stream = 0) {
+            get_stream(stream) -> masks = true;
+        }
+
+        /**
+         * @brief Sets the coarse detector of the video given to the constructor, the frames far from
+         *        the percentage are decided downsampled
+         * 
+         * @param pyramid the coarse detector
+         */
+        void set_pyramid(Pyramid * pyramid) {
+            main -> pyramid = pyramid;
+        }
+
+        /**
+         * @brief Sets the stages run on the tiles of the frames of the video given to the constructor, the
+         *        frames are submitted with submit_tiled_task
+         * 
+         * @param tiled the tiled stages
+         */
+        void set_tiled(TiledStages * tiled) {
+            main -> tiled = tiled;
+        }
+
+        /**
+         * @brief Sets the counter of the frames of the video given to the constructor, that limits the bytes
+         *        of the frames in the pool in place of the number of queued tasks. It is used only without
+         *        real time mode, where the controller limits the frames
+         * 
+         * @param inflight the counter with the memory budget
+         */
+        void set_inflight(InFlightCounter * inflight) {
+            main -> inflight = inflight;
+        }
+
+        /**
+         * @brief Keeps the next stage of a frame on the worker that ran the previous one, so that the frame
+         *        is still in its cache. It must be called before starting the pool
+         * 
+         */
+        void set_affinity() {
+            this -> affinity = true;
+        }
+
+        /**
+         * @brief Sets the order in which the workers take the tasks of each stream. It must be called
+         *        before submitting the tasks
+         * 
+         * @param policy the scheduling policy
+         */
+        void set_policy(SchedPolicy policy) {
+            unique_lock<mutex> lock(this -> l);
+            this -> policy = policy;
+            for (auto & s : streams) (s.second)->set_policy(policy);
+        }
+
+        /**
+         * @brief Gets the latency of the frames from their submission, or their arrival in real time mode,
+         *        to their result. It must be called when the workers have finished
+         * 
+         * @return the histogram of the latencies
+         */
+        LatencyHistogram get_frame_latency() {
+            LatencyHistogram h;
+            for (LatencyHistogram & w : frame_latency) h.merge(w);
+            return h;
+        }
+
+        /**
+         * @brief Gets the maximum number of frames submitted and without a result at the same time
+         * 
+         * @return the number of frames
+         */
+        long get_in_flight_high_water() {
+            return this->in_flight_high_water;
+        }
+
+        /**
+         * @brief Gets the number of frames dropped without a result
+         * 
+         * @return the number of frames
+         */
+        long get_frames_dropped() {
+            return this->frames_dropped;
+        }
+
+        /**
+         * @brief Gets the frames with a result per second, from the submission of the first frame to the
+         *        result of the last one, the dropped frames are not counted
+         * 
+         * @return the throughput in frames per second
+         */
+        double get_throughput() {
+            long usec = this->last_frame_usec;
+            return (usec > 0) ? 1e6 * this->frames_done / usec : 0;
+        }
+
+        /**
+         * @brief Prints the effect of the scheduling policy on the frames
+         * 
+         */
+        void print_scheduling_report() {
+            LatencyHistogram h = get_frame_latency();
+            cout << "Scheduling policy: " << policy_name(this->policy) << ", throughput: " << fixed << setprecision(1) <<
+                get_throughput() << " fps, frames dropped: " << get_frames_dropped() << ", frames in flight high water: " <<
+                get_in_flight_high_water() << endl;
+            cout << "Frame latency (msec): p50 " << h.percentile(50) / 1e6 << ", p90 " << h.percentile(90) / 1e6 <<
+                ", p99 " << h.percentile(99) / 1e6 << ", max " << h.get_max() / 1e6 << endl;
+            cout.unsetf(ios::floatfield);
+            cout << setprecision(6);
+        }
+
+        /**
+         * @brief Gets the number of tasks kept by a worker and taken by another one that was idle
+         * 
+         * @return the number of tasks
+         */
+        long get_steals() {
+            return this->steals;
+        }
+
+        /**
+         * @brief Keeps the workers alive between videos: the end of a video is waited with wait_results and
+         *        the pool is stopped with stop_pool. It must be called before starting the pool
+         * 
+         */
+        void set_persistent() {
+            this -> persistent = true;
+        }
+
+        /**
+         * @brief Replaces the stage that compares the frames with the background, used when a new video
+         *        starts in persistent mode and the pool has no tasks
+         * 
+         * @param comparer the new stage, owned by the pool
+         */
+        void set_comparer(Comparer * comparer) {
+            delete main -> comparer;
+            main -> comparer = comparer;
+        }
+
+        /**
+         * @brief Adds a video to a persistent pool, its frames are submitted with its id and share the
+         *        workers with the other streams
+         * 
+         * @param smoother smoothing stage of the video, owned by the pool
+         * @param converter greyscale conversion stage of the video, owned by the pool
+         * @param comparer background subtraction stage of the video, owned by the pool
+         * @param percent percentage of different pixels to detect movement in a frame
+         * @param callback function called with the result of each frame, nullptr if not used
+         * @return the id of the stream
+         */
+        int open_stream(Smoother * smoother, GreyscaleConverter * converter, Comparer * comparer, float percent, VerdictCallback callback) {
+            unique_lock<mutex> lock(this -> l);
+            int id = next_stream++;
+            PoolStream * s = new PoolStream(id, smoother, converter, comparer, percent, this->policy);
+            s -> on_verdict = callback;
+            streams[id] = s;
+            return id;
+        }
+
+        /**
+         * @brief Removes a stream whose results have all been waited, deleting its stages
+         * 
+         * @param stream the id of the stream
+         * @return the number of frames of the stream with movement detected
+         */
+        int close_stream(int stream) {
+            PoolStream * s;
+            {
+                unique_lock<mutex> lock(this -> l);
+                s = streams.at(stream);
+                streams.erase(stream);
+            }
+            int different_frames = s -> different_frames;
+            delete s;
+            return different_frames;
+        }
+
+        /**
+         * @brief Waits in persistent mode until the given number of frames of a stream has a result
+         * 
+         * @param n the number of frames submitted
+         * @param stream the id of the stream
+         */
+        void wait_results(int n, int stream = 0) {
+            PoolStream * s = get_stream(stream);
+            unique_lock<mutex> lock(this->lresults);
+            results_cond.wait(lock, [&]() { return s->res_number >= n; });
+        }
+
+        /**
+         * @brief Resets the counters of the results of the main stream in persistent mode, before a new
+         *        video starts
+         * 
+         */
+        void reset_results() {
+            main -> res_number = 0;
+            main -> different_frames = 0;
+        }
+
+        /**
+         * @brief Stops the workers in persistent mode, get_final_result waits for them
+         * 
+         */
+        void stop_pool() {
+            {
+                unique_lock<mutex> lock(this -> l);
+                this -> stop = true;
+            }
+            cond.notify_all();
+        }
+
+        /**
+         * @brief Sets the first core on which the workers are mapped, the cores before are left to the decoder
+         * 
+         * @param offset index of the first core for the workers
+         */
+        void set_cpu_offset(int offset) {
+            this -> cpu_offset = offset;
+        }
+
         /**
          * @brief Receives the number of frames from the reader when it has finished
          * 
@@ -247,6 +1221,25 @@ class ThreadPool {
             cond.notify_all();
         }
 
+        /**
+         * @brief Gets the maximum length reached by the queue
+         * 
+         * @return the number of tasks
+         */
+        long get_queue_high_water() {
+            unique_lock<mutex> lock(this->l);
+            return this->queue_high_water;
+        }
+
+        /**
+         * @brief Gets the time spent by the reader waiting for room in the queue
+         * 
+         * @return the time in usec
+         */
+        long get_stall_usec() {
+            return this->stall_usec;
+        }
+
         /**
          * @brief Gets the final result from outside the pool
          * 
@@ -256,11 +1249,12 @@ class ThreadPool {
             for (int i=0; i<(this->nw); i++) {
                 (this -> tids)[i].join();
             }
-            // Delete the stages of the pipe
-            delete smoother;
-            delete converter;
-            delete comparer;
-            return this->different_frames;
+            int different_frames = (main != nullptr) ? (int) main->different_frames : 0;
+            // Delete the stages of the pipe of each stream
+            for (auto & s : streams) delete s.second;
+            streams.clear();
+            main = nullptr;
+            return different_frames;
         }
 
 };
\ No newline at end of file
@@ -0,0 +1,118 @@
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+/**
+ * @brief Counts the heap allocations made inside the scopes marked with AllocationScope, that are the
+ *        scheduling code of the thread pool: the creation of the tasks, the queues and the dispatch, not
+ *        the stage kernels, that allocate the frames. The allocations are counted only in the programs
+ *        compiled with -DCOUNT_ALLOCATIONS, that replaces the global operator new, and they are split
+ *        between the first frames, when the queues grow, and the steady state after them
+ *
+ */
+class AllocationCounter {
+
+    private:
+        static atomic<long> & total() {
+            static atomic<long> n(0);
+            return n;
+        }
+
+        static atomic<long> & steady() {
+            static atomic<long> n(0);
+            return n;
+        }
+
+        static atomic<bool> & steady_state() {
+            static atomic<bool> b(false);
+            return b;
+        }
+
+    public:
+        // Frames after which the queues have reached their usual length
+        static const int WARMUP_FRAMES = 32;
+
+        /**
+         * @brief Tells if the calling thread is inside a counted scope
+         *
+         * @return reference to the flag of the thread
+         */
+        static bool & counting() {
+            static thread_local bool c = false;
+            return c;
+        }
+
+        /**
+         * @brief Counts an allocation if the calling thread is inside a counted scope
+         *
+         */
+        static void count() {
+            if (!counting()) return;
+            total()++;
+            if (steady_state()) steady()++;
+        }
+
+        /**
+         * @brief Marks the end of the warm up, the allocations after it are counted as steady state
+         *
+         */
+        static void mark_steady() {
+            steady_state() = true;
+        }
+
+        /**
+         * @brief Prints the allocations counted, only in the programs compiled with -DCOUNT_ALLOCATIONS
+         *
+         */
+        static void print_report() {
+#ifdef COUNT_ALLOCATIONS
+            cout << "Scheduler allocations: " << total() << ", after the first " << WARMUP_FRAMES << " frames: " << steady() << endl;
+#endif
+        }
+};
+
+/**
+ * @brief Marks the scheduling code whose allocations are counted, for the lifetime of the object
+ *
+ */
+class AllocationScope {
+
+    private:
+        bool previous;
+
+    public:
+        AllocationScope() {
+            this->previous = AllocationCounter::counting();
+            AllocationCounter::counting() = true;
+        }
+
+        ~AllocationScope() {
+            AllocationCounter::counting() = this->previous;
+        }
+};
+
+#ifdef COUNT_ALLOCATIONS
+// The programs are made of a single translation unit, so the replacement is defined once
+void * operator new(size_t size) {
+    AllocationCounter::count();
+    void * p = malloc((size > 0) ? size : 1);
+    if (p == nullptr) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void * p) noexcept {
+    free(p);
+}
+
+void operator delete(void * p, size_t) noexcept {
+    free(p);
+}
+#endif
+
+#endif
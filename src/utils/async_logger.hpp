@@ -0,0 +1,163 @@
+#ifndef ASYNC_LOGGER_HPP
+#define ASYNC_LOGGER_HPP
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+/**
+ * @brief Logger that moves the output off the worker threads: the messages are copied in a lock-free
+ *        bounded ring (multiple producers, one consumer) and a background thread writes them. If the
+ *        ring is full the message is dropped and counted, so logging never blocks a worker. After stop
+ *        the messages are written directly by the thread that logs them
+ *
+ */
+class AsyncLogger {
+
+    private:
+        static const int CAPACITY = 4096; // must be a power of two
+        static const int MESSAGE_SIZE = 120;
+
+        struct Slot {
+            atomic<size_t> sequence;
+            char text[MESSAGE_SIZE];
+        };
+
+        Slot slots[CAPACITY];
+        alignas(64) atomic<size_t> head; // next position to write
+        alignas(64) size_t tail = 0; // next position to read, used only by the background thread
+        atomic<long> dropped;
+        atomic<bool> running;
+        atomic<bool> started;
+        atomic<bool> stopped;
+        atomic<int> writers; // threads writing a message in the ring, stop waits for them
+        mutex lwrite; // lock of the messages written directly after stop
+        thread consumer;
+
+        AsyncLogger() {
+            for (size_t i=0; i<CAPACITY; i++) slots[i].sequence = i;
+            this->head = 0;
+            this->dropped = 0;
+            this->running = false;
+            this->started = false;
+            this->stopped = false;
+            this->writers = 0;
+        }
+
+        /**
+         * @brief Copies a message in the ring, it is truncated if longer than the slot
+         *
+         * @param message the message to write
+         */
+        void enqueue(const string & message) {
+            if (!this->started) this->start();
+            size_t pos = (this->head).load(memory_order_relaxed);
+            while (true) {
+                Slot & s = slots[pos & (CAPACITY - 1)];
+                size_t seq = s.sequence.load(memory_order_acquire);
+                if (seq == pos) {
+                    if ((this->head).compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                        strncpy(s.text, message.c_str(), MESSAGE_SIZE - 1);
+                        s.text[MESSAGE_SIZE - 1] = '\0';
+                        s.sequence.store(pos + 1, memory_order_release);
+                        return;
+                    }
+                }
+                else if (seq < pos) {
+                    // The ring is full
+                    this->dropped++;
+                    return;
+                }
+                else {
+                    pos = (this->head).load(memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * @brief Writes all the messages in the ring
+         *
+         * @return the number of messages written
+         */
+        int drain() {
+            int n = 0;
+            while (true) {
+                Slot & s = slots[this->tail & (CAPACITY - 1)];
+                if (s.sequence.load(memory_order_acquire) != this->tail + 1) break;
+                cout << s.text << '\n';
+                s.sequence.store(this->tail + CAPACITY, memory_order_release);
+                this->tail++;
+                n++;
+            }
+            if (n > 0) cout.flush();
+            return n;
+        }
+
+        /**
+         * @brief Starts the background thread the first time a message is logged
+         *
+         */
+        void start() {
+            bool expected = false;
+            if (!(this->started).compare_exchange_strong(expected, true)) return;
+            this->running = true;
+            this->consumer = thread([this] {
+                while (this->running) {
+                    if (this->drain() == 0) this_thread::sleep_for(chrono::microseconds(500));
+                }
+                this->drain();
+            });
+        }
+
+    public:
+
+        static AsyncLogger & instance() {
+            static AsyncLogger logger;
+            return logger;
+        }
+
+        ~AsyncLogger() {
+            this->stop();
+        }
+
+        /**
+         * @brief Queues a message, it is truncated if longer than the slot. After stop the message is
+         *        written directly, since nobody would drain the ring
+         *
+         * @param message the message to write
+         */
+        void log(const string & message) {
+            // The writer is registered before checking the flag, so stop either sees it or is seen by it
+            this->writers++;
+            if (!this->stopped) {
+                this->enqueue(message);
+                this->writers--;
+                return;
+            }
+            this->writers--;
+            unique_lock<mutex> lock(this->lwrite);
+            cout << message << endl;
+        }
+
+        /**
+         * @brief Writes the remaining messages and stops the background thread
+         *
+         */
+        void stop() {
+            if (this->stopped.exchange(true)) return;
+            // The messages being copied in the ring are written by the last drain
+            while (this->writers > 0) this_thread::yield();
+            if (!this->started || !this->running) return;
+            this->running = false;
+            if ((this->consumer).joinable()) (this->consumer).join();
+            if (this->dropped > 0) cout << "Log messages dropped: " << this->dropped << endl;
+        }
+};
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef BACKGROUND_BUILDER_HPP
+#define BACKGROUND_BUILDER_HPP
+
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "roi_mask.hpp"
+#include "seq_greyscale_converter.hpp"
+#include "seq_smoother.hpp"
+#include "temporal_median.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Prepares the background from the first frames in parallel, with the workers of the
+ *        implementation. The frames are split in bands of rows, that go through three phases: the
+ *        bands of every frame are converted to greyscale, then smoothed, then, with more than one frame,
+ *        the bands of the background are the per pixel median of the smoothed frames. Each phase starts
+ *        when the previous one is complete, because smoothing reads the rows of the neighbour bands.
+ *        The workers take the bands with work, and the frames that reach the comparison before the
+ *        background is ready wait with wait_ready. Greyscale conversion and smoothing of the frames do
+ *        not need the background, so they overlap with its preparation
+ *
+ */
+class BackgroundBuilder {
+
+    private:
+        static const int PHASES = 3; // greyscale, smoothing, median
+
+        vector<Mat> frames; // first frames, as read, released after greyscale conversion
+        vector<Mat> grey; // released after smoothing
+        vector<Mat> smoothed;
+        Mat background; // smoothed greyscale background, or median of the smoothed frames
+        Mat grey_background; // greyscale background before smoothing, or median of the greyscale frames
+        RoiMask * roi;
+        bool smoothed_intensity; // the threshold comes from the smoothed background, or from the greyscale one
+        int bands;
+        int band_rows;
+        GreyscaleConverterSeq converter;
+        // The frames are converted in full, the downsampled background reads the blocks around the region
+        RoiMask whole;
+        GreyscaleConverterSeq whole_converter;
+
+        // Units of work of each phase, a band of a frame, and units taken and completed
+        int units[PHASES];
+        atomic<int> next[PHASES];
+        atomic<int> done[PHASES];
+        vector<float> sums; // intensity of each band
+
+        atomic<bool> ready;
+        float avg_intensity = 0;
+        float threshold = 0;
+        mutex l;
+        condition_variable cond;
+        chrono::steady_clock::time_point start;
+        long usec = 0;
+
+        /**
+         * @brief Wakes up the workers waiting for a phase, with the lock held so that no wake up is lost
+         *
+         */
+        void notify() {
+            unique_lock<mutex> lock(this->l);
+            (this->cond).notify_all();
+        }
+
+        /**
+         * @brief Tells if a unit of work can be taken now
+         *
+         * @return true if the current phase has units not taken yet
+         */
+        bool claimable() {
+            for (int p=0; p<PHASES; p++) {
+                if (p > 0 && this->done[p - 1] < this->units[p - 1]) return false;
+                if (this->next[p] < this->units[p]) return true;
+            }
+            return false;
+        }
+
+        /**
+         * @brief Tells if all the units of work have been taken
+         *
+         * @return true if there is no more work to take
+         */
+        bool all_taken() {
+            for (int p=0; p<PHASES; p++) {
+                if (this->next[p] < this->units[p]) return false;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Computes the threshold when the last unit has been completed
+         *
+         */
+        void finish() {
+            double sum = 0;
+            for (float s : this->sums) sum += s;
+            float avg = (float) (sum / (this->roi)->get_area());
+            this->avg_intensity = round(avg * 100.0) / 100.0;
+            this->threshold = this->avg_intensity / 10;
+            this->usec = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - this->start).count();
+            this->ready = true;
+            this->notify();
+        }
+
+        /**
+         * @brief Executes a unit of work
+         *
+         * @param p the phase
+         * @param u the unit, a band of a frame for greyscale conversion and smoothing, a band of the background for the median
+         */
+        void run(int p, int u) {
+            int n = (this->smoothed).size();
+            int f = u / this->bands;
+            int b = u % this->bands;
+            int begin = b * this->band_rows;
+            int end = min((b + 1) * this->band_rows, (this->background).rows);
+            if (p == 0) (this->whole_converter).convert_rows(this->frames[f], this->grey[f], begin, end);
+            else if (p == 1) {
+                SmootherSeq s(this->grey[f], this->roi, false, false);
+                s.smoothing_rows(this->smoothed[f], begin, end);
+                if (n == 1) this->sums[b] = (this->converter).sum_intensity(this->smoothed_intensity ? this->smoothed[0] : this->grey[0], begin, end);
+            }
+            else {
+                TemporalMedian::median_rows(this->smoothed, this->background, begin, end);
+                TemporalMedian::median_rows(this->grey, this->grey_background, begin, end);
+                this->sums[b] = (this->converter).sum_intensity(this->background, begin, end);
+            }
+        }
+
+        /**
+         * @brief Processes a unit of the current phase, if there is one not taken yet
+         *
+         * @return false if there are no units to take now
+         */
+        bool help() {
+            for (int p=0; p<PHASES; p++) {
+                // A phase starts when the previous one is complete
+                if (p > 0 && this->done[p - 1] < this->units[p - 1]) return false;
+                if (this->next[p] >= this->units[p]) continue;
+                int u = (this->next[p])++;
+                if (u >= this->units[p]) continue;
+                this->run(p, u);
+                if (++(this->done[p]) == this->units[p]) {
+                    // The inputs of the phase are not needed anymore, the greyscale frames are kept for
+                    // the median of the greyscale background
+                    if (p == 0) (this->frames).clear();
+                    if ((p == 1 && this->units[2] == 0) || p == 2) (this->grey).clear();
+                    bool complete = true;
+                    for (int q=p+1; q<PHASES; q++) complete = complete && this->units[q] == 0;
+                    if (complete) this->finish();
+                    else this->notify();
+                }
+                return true;
+            }
+            return false;
+        }
+
+    public:
+
+        /**
+         * @brief Creates the builder, the work is done by the threads that call work and wait_ready
+         *
+         * @param frames the first frames, BGR or already greyscale in luma mode, the background is their median
+         * @param roi region of interest of the frames
+         * @param workers number of threads that build the background, the frames are split in more bands to balance them
+         * @param smoothed_intensity true to compute the threshold on the smoothed background, false on the greyscale
+         *        one; with more than one frame it is always computed on the median
+         */
+        BackgroundBuilder(vector<Mat> frames, RoiMask * roi, int workers, bool smoothed_intensity):
+            frames(frames), roi(roi), smoothed_intensity(smoothed_intensity), converter(roi, false, false),
+            whole(frames[0].rows, frames[0].cols), whole_converter(&(this->whole), false, false) {
+            this->start = chrono::steady_clock::now();
+            int n = frames.size();
+            int rows = frames[0].rows;
+            int cols = frames[0].cols;
+            this->bands = max(1, min(rows, 4 * workers));
+            this->band_rows = (rows + this->bands - 1) / this->bands;
+            this->bands = (rows + this->band_rows - 1) / this->band_rows;
+            this->sums.assign(this->bands, 0);
+            for (int f=0; f<n; f++) {
+                // A frame read in luma mode is already in greyscale
+                (this->grey).push_back((frames[f].channels() > 1) ? Mat(rows, cols, CV_32F) : frames[f]);
+                (this->smoothed).push_back(Mat(rows, cols, CV_32F, 0.0));
+            }
+            this->background = (n == 1) ? this->smoothed[0] : Mat(rows, cols, CV_32F, 0.0);
+            this->grey_background = (n == 1) ? this->grey[0] : Mat(rows, cols, CV_32F, 0.0);
+            this->units[0] = (frames[0].channels() > 1) ? n * this->bands : 0;
+            this->units[1] = n * this->bands;
+            this->units[2] = (n > 1) ? this->bands : 0;
+            for (int p=0; p<PHASES; p++) {
+                this->next[p] = 0;
+                this->done[p] = 0;
+            }
+            this->ready = false;
+        }
+
+        /**
+         * @brief Creates the builder of the background from the first frame
+         *
+         */
+        BackgroundBuilder(Mat frame, RoiMask * roi, int workers, bool smoothed_intensity):
+            BackgroundBuilder(vector<Mat>(1, frame), roi, workers, smoothed_intensity) {}
+
+        /**
+         * @brief Works on the background until all its units have been taken, called by each worker
+         *        when it starts
+         *
+         */
+        void work() {
+            while (true) {
+                if (this->help()) continue;
+                if (this->all_taken()) return;
+                // The units of the next phase wait for the completion of the current one
+                unique_lock<mutex> lock(this->l);
+                (this->cond).wait(lock, [&]() { return this->ready || this->claimable(); });
+            }
+        }
+
+        /**
+         * @brief Waits until the background is ready, helping to build it if there are units left
+         *
+         */
+        void wait_ready() {
+            if (this->ready) return;
+            this->work();
+            unique_lock<mutex> lock(this->l);
+            (this->cond).wait(lock, [&]() { return (bool) this->ready; });
+        }
+
+        /**
+         * @brief Tells if the background is ready
+         *
+         * @return true if the background can be used
+         */
+        bool is_ready() {
+            return this->ready;
+        }
+
+        /**
+         * @brief Gets the background, it must be ready
+         *
+         * @return the smoothed greyscale background
+         */
+        Mat get_background() {
+            return this->background;
+        }
+
+        /**
+         * @brief Gets the background before smoothing, used to derive other backgrounds that are smoothed
+         *        after a transformation, as the downsampled one. It must be ready
+         *
+         * @return the greyscale background
+         */
+        Mat get_grey_background() {
+            return this->grey_background;
+        }
+
+        /**
+         * @brief Gets the threshold to consider two pixels different, the background must be ready
+         *
+         * @return the threshold
+         */
+        float get_threshold() {
+            return this->threshold;
+        }
+
+        /**
+         * @brief Gets the average intensity of the background, it must be ready
+         *
+         * @return the average intensity
+         */
+        float get_avg_intensity() {
+            return this->avg_intensity;
+        }
+
+        /**
+         * @brief Gets the time taken to build the background, it must be ready
+         *
+         * @return the time in usec from the creation of the builder
+         */
+        long get_usec() {
+            return this->usec;
+        }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef CSV_TABLE_HPP
+#define CSV_TABLE_HPP
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+
+using namespace std;
+
+/**
+ * @brief Class that reads a CSV file with a header, such as the results files, so that the columns
+ *        can be found by name. Fields can be quoted
+ *
+ */
+class CsvTable {
+
+    private:
+        map<string, int> columns;
+        vector<vector<string>> rows;
+
+    public:
+
+        /**
+         * @brief Splits a CSV line
+         *
+         * @param line the line to split
+         * @return the fields
+         */
+        static vector<string> split(const string & line) {
+            vector<string> fields;
+            string field = "";
+            bool quoted = false;
+            for (size_t i=0; i<line.length(); i++) {
+                char c = line[i];
+                if (quoted) {
+                    if (c == '"' && i + 1 < line.length() && line[i + 1] == '"') {
+                        field += '"';
+                        i++;
+                    }
+                    else if (c == '"') quoted = false;
+                    else field += c;
+                }
+                else if (c == '"') quoted = true;
+                else if (c == ',') {
+                    fields.push_back(field);
+                    field = "";
+                }
+                else if (c != '\r') field += c;
+            }
+            fields.push_back(field);
+            return fields;
+        }
+
+        /**
+         * @brief Reads a file, the rows shorter than the header are skipped
+         *
+         * @param filename name of the file
+         */
+        CsvTable(string filename) {
+            ifstream file(filename);
+            string line;
+            if (!getline(file, line)) return;
+            vector<string> header = split(line);
+            for (size_t i=0; i<header.size(); i++) this->columns[header[i]] = i;
+            while (getline(file, line)) {
+                vector<string> f = split(line);
+                if (f.size() >= header.size()) (this->rows).push_back(f);
+            }
+        }
+
+        bool has(string column) {
+            return this->columns.find(column) != this->columns.end();
+        }
+
+        size_t size() {
+            return this->rows.size();
+        }
+
+        /**
+         * @brief Gets a field
+         *
+         * @param row index of the row
+         * @param column name of the column
+         * @return the field, empty if the column does not exist
+         */
+        string get(size_t row, string column) {
+            if (!this->has(column)) return "";
+            return this->rows[row][this->columns[column]];
+        }
+
+        double number(size_t row, string column) {
+            return atof(this->get(row, column).c_str());
+        }
+};
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef EVENT_INDEX_HPP
+#define EVENT_INDEX_HPP
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "verdict.hpp"
+#include "motion_mask.hpp"
+
+using namespace std;
+
+/**
+ * @brief Interval of frames with motion
+ *
+ */
+struct MotionEvent {
+    int start; // first frame of the event, counted from 0 in the video, background frames included
+    int end; // last frame of the event
+    int motion_frames; // frames of the event that exceed the percentage, the others are in the hysteresis or in a gap
+    float peak; // highest fraction of different pixels in the event
+    // Rectangle that holds the different pixels of the frames of the event, right < 0 if the masks are not known
+    int left = -1;
+    int top = -1;
+    int right = -1;
+    int bottom = -1;
+};
+
+/**
+ * @brief Rectangle that holds the different pixels of a frame, right < 0 if it is not known
+ *
+ */
+struct MotionRegion {
+    int left = -1;
+    int top = -1;
+    int right = -1;
+    int bottom = -1;
+};
+
+/**
+ * @brief Merges the verdicts of the frames into motion events and writes them in an index, that lets a
+ *        player or the extract tool seek directly to the events instead of decoding the whole video.
+ *        An event starts with a frame over the percentage and goes on while the frames stay over a lower
+ *        exit level, so that the noise around the percentage does not split it; events separated by less
+ *        than the minimum gap are merged.
+ *        The index is a binary file of fixed size records, little endian:
+ *        header  "MDEV" magic, uint32 version, uint32 number of events, uint32 frames, double fps
+ *        record  uint32 start frame, uint32 end frame, int64 start usec, int64 end usec, float peak, uint32 motion frames
+ *        and a JSON sidecar with the same content, named as the index with .json appended; when the verdicts
+ *        carry the masks of the frames the sidecar also gives the region of the different pixels of each event
+ *
+ */
+class EventIndex {
+
+    private:
+        static const uint32_t VERSION = 1;
+
+        vector<float> fractions; // fraction of each analyzed frame, -1 for the frames without a verdict
+        vector<MotionRegion> regions; // region of the different pixels of each analyzed frame
+        mutex l; // the verdicts can come from the threads of the pipeline, out of order
+        float percent; // level that starts an event
+        float hysteresis; // the event goes on while the frames are over percent * hysteresis
+        int min_gap; // events separated by less frames are merged
+        int offset; // frames of the video before the first analyzed one, minus one since the verdicts start from 1
+
+        /**
+         * @brief Gets the time of a frame in the video
+         *
+         * @param frame the frame, counted from 0
+         * @param fps frame rate of the video, 0 if unknown
+         * @return the time in usec, 0 if the frame rate is unknown
+         */
+        static int64_t frame_usec(int frame, double fps) {
+            return (fps > 0) ? (int64_t) (frame * 1000000.0 / fps) : 0;
+        }
+
+        /**
+         * @brief Writes a value in the binary index
+         *
+         */
+        template <typename T>
+        static void put(ofstream & out, T value) {
+            out.write((const char *) &value, sizeof(T));
+        }
+
+        /**
+         * @brief Reads a value from the binary index
+         *
+         */
+        template <typename T>
+        static T get(ifstream & in) {
+            T value{};
+            in.read((char *) &value, sizeof(T));
+            return value;
+        }
+
+        /**
+         * @brief Escapes a string to be written in the JSON sidecar
+         *
+         * @param s the string
+         * @return the string with quotes, backslashes and control characters escaped
+         */
+        static string escape(const string & s) {
+            string res;
+            for (char c : s) {
+                if (c == '"' || c == '\\') res += string("\\") + c;
+                else if ((unsigned char) c < 0x20) res += ' ';
+                else res += c;
+            }
+            return res;
+        }
+
+    public:
+
+        /**
+         * @brief Creates an empty index
+         *
+         * @param percent fraction of different pixels that starts an event, the one of the motion verdict
+         * @param hysteresis ratio of the percent under which the event ends, between 0 and 1
+         * @param min_gap minimum number of frames between two events, closer events are merged
+         * @param bgframes number of first frames taken as background, that have no verdict
+         */
+        EventIndex(float percent, float hysteresis, int min_gap, int bgframes):
+            percent(percent), hysteresis(hysteresis), min_gap(max(min_gap, 0)), offset(bgframes - 1) {}
+
+        /**
+         * @brief Records the verdict of a frame, it can be called by more threads
+         *
+         * @param v the verdict
+         */
+        void add(const Verdict & v) {
+            if (v.frame < 1) return;
+            unique_lock<mutex> lock(this->l);
+            if ((int) (this->fractions).size() < v.frame) {
+                (this->fractions).resize(v.frame, -1);
+                (this->regions).resize(v.frame);
+            }
+            this->fractions[v.frame - 1] = v.fraction;
+            if (v.mask == nullptr) return;
+            Rect r = v.mask->bounding_box();
+            if (r.width > 0) this->regions[v.frame - 1] = {r.x, r.y, r.x + r.width - 1, r.y + r.height - 1};
+        }
+
+        /**
+         * @brief Merges the verdicts recorded into events, the frames without a verdict, dropped in real time
+         *        mode, neither start nor end an event
+         *
+         * @return the events, ordered by start frame
+         */
+        vector<MotionEvent> build() {
+            unique_lock<mutex> lock(this->l);
+            vector<MotionEvent> events;
+            float exit_level = this->percent * this->hysteresis;
+            bool open = false;
+            MotionEvent e = {0, 0, 0, 0};
+            for (int i=0; i<(int) (this->fractions).size(); i++) {
+                float f = this->fractions[i];
+                if (f < 0) continue;
+                int frame = i + 1 + this->offset;
+                if (!open && f > this->percent) {
+                    // Close to the previous event, so it goes on
+                    if (!events.empty() && frame - events.back().end - 1 < this->min_gap) {
+                        e = events.back();
+                        events.pop_back();
+                    }
+                    else e = {frame, frame, 0, 0};
+                    open = true;
+                }
+                if (!open) continue;
+                if (f <= exit_level) {
+                    events.push_back(e);
+                    open = false;
+                    continue;
+                }
+                e.end = frame;
+                if (f > this->percent) e.motion_frames++;
+                e.peak = max(e.peak, f);
+                const MotionRegion & r = this->regions[i];
+                if (r.right >= 0) {
+                    bool first = e.right < 0;
+                    e.left = first ? r.left : min(e.left, r.left);
+                    e.top = first ? r.top : min(e.top, r.top);
+                    e.right = max(e.right, r.right);
+                    e.bottom = max(e.bottom, r.bottom);
+                }
+            }
+            if (open) events.push_back(e);
+            return events;
+        }
+
+        /**
+         * @brief Writes the binary index and its JSON sidecar
+         *
+         * @param path file of the binary index, the sidecar is path.json
+         * @param video name of the video, written in the sidecar
+         * @param fps frame rate of the video, used for the timestamps, 0 if unknown
+         * @param frames total frames of the video, background frames included
+         * @return the number of events, -1 if the files cannot be written
+         */
+        int write(string path, string video, double fps, int frames) {
+            vector<MotionEvent> events = this->build();
+            ofstream out(path, ios::binary | ios::trunc);
+            if (!out) return -1;
+            out.write("MDEV", 4);
+            put<uint32_t>(out, VERSION);
+            put<uint32_t>(out, events.size());
+            put<uint32_t>(out, frames);
+            put<double>(out, fps);
+            for (MotionEvent & e : events) {
+                put<uint32_t>(out, e.start);
+                put<uint32_t>(out, e.end);
+                put<int64_t>(out, frame_usec(e.start, fps));
+                put<int64_t>(out, frame_usec(e.end + 1, fps));
+                put<float>(out, e.peak);
+                put<uint32_t>(out, e.motion_frames);
+            }
+            out.close();
+            if (!out) return -1;
+
+            ofstream json(path + ".json", ios::trunc);
+            if (!json) return -1;
+            json << fixed << setprecision(6);
+            json << "{\n  \"video\": \"" << escape(video) << "\",\n  \"fps\": " << fps << ",\n  \"frames\": " << frames <<
+                ",\n  \"percent\": " << this->percent << ",\n  \"hysteresis\": " << this->hysteresis <<
+                ",\n  \"min_gap\": " << this->min_gap << ",\n  \"events\": [";
+            for (int i=0; i<(int) events.size(); i++) {
+                MotionEvent & e = events[i];
+                json << ((i > 0) ? "," : "") << "\n    {\"start_frame\": " << e.start << ", \"end_frame\": " << e.end <<
+                    ", \"start_sec\": " << frame_usec(e.start, fps) / 1e6 << ", \"end_sec\": " << frame_usec(e.end + 1, fps) / 1e6 <<
+                    ", \"peak\": " << e.peak << ", \"motion_frames\": " << e.motion_frames;
+                if (e.right >= 0) {
+                    json << ", \"region\": {\"x\": " << e.left << ", \"y\": " << e.top << ", \"width\": " << e.right - e.left + 1 <<
+                        ", \"height\": " << e.bottom - e.top + 1 << "}";
+                }
+                json << "}";
+            }
+            json << "\n  ]\n}" << endl;
+            json.close();
+            return (json) ? events.size() : -1;
+        }
+
+        /**
+         * @brief Reads a binary index
+         *
+         * @param path file of the index
+         * @param events where the events are stored
+         * @param fps where the frame rate of the video is stored
+         * @param frames where the total frames of the video are stored
+         * @return false if the file is not a valid index
+         */
+        static bool read(string path, vector<MotionEvent> & events, double & fps, int & frames) {
+            ifstream in(path, ios::binary);
+            char magic[4];
+            if (!in.read(magic, 4) || memcmp(magic, "MDEV", 4) != 0) return false;
+            if (get<uint32_t>(in) != VERSION) return false;
+            uint32_t count = get<uint32_t>(in);
+            frames = get<uint32_t>(in);
+            fps = get<double>(in);
+            events.clear();
+            for (uint32_t i=0; i<count && in; i++) {
+                MotionEvent e;
+                e.start = get<uint32_t>(in);
+                e.end = get<uint32_t>(in);
+                get<int64_t>(in);
+                get<int64_t>(in);
+                e.peak = get<float>(in);
+                e.motion_frames = get<uint32_t>(in);
+                if (in) events.push_back(e);
+            }
+            return (bool) in && events.size() == count;
+        }
+};
+
+#endif
@@ -1,41 +1,118 @@
+#ifndef FILE_WRITER_HPP
+#define FILE_WRITER_HPP
+
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <ctime>
+#include <cstring>
+#include "latency_histogram.hpp"
 
 using namespace std;
 
+// Git revision of the sources, defined by the Makefile
+#ifndef GIT_REV
+#define GIT_REV "unknown"
+#endif
+
+/**
+ * @brief Metrics of a run, written as a record of the results file
+ *
+ */
+struct RunMetrics {
+    string video;
+    string type; // seq, nt, fffarm or ffmw
+    int k = 0;
+    int nw = -1; // -1 for the sequential implementation
+    bool mapping = false;
+    int decoder_threads = 0; // 0 if the backend default is used
+    long usec = 0; // execution time
+    int different_frames = 0; // frames with movement found
+    int frames = 0; // frames analyzed
+    int rows = 0;
+    int cols = 0;
+    long reader_stall_usec = 0; // time spent by the reader waiting for room in the pipeline
+    long queue_high_water = 0; // maximum number of frames waiting in the pipeline
+    long first_verdict_usec = -1; // time from the start to the result of the first frame
+};
+
 /**
- * @brief Class used to print results on a file
- * 
+ * @brief Class used to print results on a file, as a CSV record with a header
+ *
  */
 class FileWriter {
     private:
         string filename;
 
+        /**
+         * @brief Gets the model of the host CPU
+         *
+         * @return the model name as written in /proc/cpuinfo
+         */
+        string cpu_model() {
+            ifstream cpuinfo("/proc/cpuinfo");
+            string line;
+            while (getline(cpuinfo, line)) {
+                if (line.rfind("model name", 0) == 0) {
+                    size_t colon = line.find(':');
+                    if (colon != string::npos) return line.substr(min(colon + 2, line.length()));
+                }
+            }
+            return "unknown";
+        }
+
+        /**
+         * @brief Quotes a string field if it contains commas or quotes
+         *
+         * @param s the field
+         * @return the quoted field
+         */
+        string quote(string s) {
+            if (s.find(',') == string::npos && s.find('"') == string::npos) return s;
+            string q = "\"";
+            for (char c : s) {
+                if (c == '"') q += '"';
+                q += c;
+            }
+            return q + "\"";
+        }
+
     public:
         FileWriter(string filename): filename(filename) {}
 
         /**
-         * @brief print results on a file
-         * 
-         * @param video the name of the video
-         * @param type ff, nt or seq
-         * @param k k parameter specified by the user
-         * @param nw number of workers for each stage used for data parallelism
-         * @param mapping flag that indicates if mapping is used or not
-         * @param complessive_usec execution time 
-         * @param different_frames number of frames with movement found
-         * @param np number of replication of each stage
+         * @brief print results on a file, writing the header if the file is new
+         *
+         * @param m the metrics of the run
          */
-        void print_results(string video, string type, int k, int nw, bool mapping, string complessive_usec, int different_frames) {
+        void print_results(RunMetrics & m) {
+            bool is_new = !ifstream(this->filename).good();
             ofstream file;
-            time_t now = time(0);
-            char* date = (char *) ctime(&now);
-            date[strlen(date) - 1] = '\0';
             file.open(this->filename, std::ios_base::app);
-            //file << date << " - " << video << "," << type << "," << k << "," << nw << "," << np << "," << show << "," << complessive_usec << "," << different_frames << endl;
-            file << date << " - " << video << "," << type << "," << k << "," << nw << "," << mapping << "," << complessive_usec << "," << different_frames << endl;
+            if (is_new) {
+                file << "date,video,type,k,nw,mapping,decoder_threads,usec,different_frames,frames,fps,rows,cols";
+                for (int s=0; s<STAGES; s++) {
+                    string n = StageHistograms::stage_name(s);
+                    file << "," << n << "_mean_usec," << n << "_p50_usec," << n << "_p99_usec," << n << "_p999_usec";
+                }
+                file << ",reader_stall_usec,queue_high_water,first_verdict_usec,git_rev,cpu" << endl;
+            }
+            char date[32];
+            time_t now = time(0);
+            strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+            double fps = (m.usec > 0) ? m.frames * 1000000.0 / m.usec : 0;
+            file << date << "," << quote(m.video) << "," << m.type << "," << m.k << "," << m.nw << "," <<
+                (m.mapping ? "cores" : "none") << "," << m.decoder_threads << "," << m.usec << "," <<
+                m.different_frames << "," << m.frames << "," << fps << "," << m.rows << "," << m.cols;
+            for (int s=0; s<STAGES; s++) {
+                LatencyHistogram h = StageHistograms::merged((Stage) s);
+                file << "," << h.get_mean() / 1000 << "," << h.percentile(50) / 1000.0 << "," <<
+                    h.percentile(99) / 1000.0 << "," << h.percentile(99.9) / 1000.0;
+            }
+            file << "," << m.reader_stall_usec << "," << m.queue_high_water << "," << m.first_verdict_usec << "," << GIT_REV << "," << quote(cpu_model()) << endl;
             file.close();
         }
 
-};
\ No newline at end of file
+};
+
+#endif
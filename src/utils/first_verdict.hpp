@@ -0,0 +1,60 @@
+#ifndef FIRST_VERDICT_HPP
+#define FIRST_VERDICT_HPP
+
+#include <chrono>
+#include <atomic>
+
+using namespace std;
+
+/**
+ * @brief Time to first verdict: time from the start of the program to the first frame analyzed,
+ *        that measures the cold start of a clip (opening the video, preparing the background,
+ *        starting the threads)
+ *
+ */
+class FirstVerdict {
+
+    private:
+        static chrono::steady_clock::time_point & origin() {
+            static chrono::steady_clock::time_point t = chrono::steady_clock::now();
+            return t;
+        }
+
+        static atomic<long> & usec() {
+            static atomic<long> u(-1);
+            return u;
+        }
+
+    public:
+
+        /**
+         * @brief Starts the clock, at the start of the program
+         *
+         */
+        static void start() {
+            origin() = chrono::steady_clock::now();
+            usec() = -1;
+        }
+
+        /**
+         * @brief Records the time of a verdict, only the first one is kept
+         *
+         */
+        static void mark() {
+            if (usec() >= 0) return;
+            long elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - origin()).count();
+            long expected = -1;
+            usec().compare_exchange_strong(expected, elapsed);
+        }
+
+        /**
+         * @brief Gets the time to first verdict
+         *
+         * @return the time in usec, -1 if no frame has been analyzed
+         */
+        static long get_usec() {
+            return usec();
+        }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Pool of frame buffers kept between the videos of a long running process: the reader takes the
+ *        frames from it, and the stages give back the frames they consume and take their outputs from it,
+ *        so that after the first frames a video is analyzed without allocating and faulting in the pixels
+ *        of each frame. The buffers are matched by size and type, at most capacity are kept and the ones
+ *        released first are freed first. A frame given back must not be used by anyone else
+ *
+ */
+class FramePool {
+
+    private:
+        size_t capacity;
+        deque<Mat> buffers; // free buffers, the last released at the back
+        mutex l;
+        atomic<long> allocated;
+        atomic<long> reused;
+
+    public:
+
+        /**
+         * @brief Creates the pool
+         *
+         * @param capacity number of free buffers kept, 0 to free every buffer given back
+         */
+        FramePool(size_t capacity): capacity(capacity) {
+            this->allocated = 0;
+            this->reused = 0;
+        }
+
+        /**
+         * @brief Takes a buffer, reusing a free one of the same size and type if there is one
+         *
+         * @param rows rows of the frame
+         * @param cols columns of the frame
+         * @param type type of the frame
+         * @param zero true to set the pixels to 0, as the new buffers
+         * @return the frame, owned by the caller
+         */
+        Mat * acquire(int rows, int cols, int type, bool zero = false) {
+            {
+                unique_lock<mutex> lock(this->l);
+                for (size_t i=(this->buffers).size(); i>0; i--) {
+                    Mat & b = this->buffers[i - 1];
+                    if (b.rows != rows || b.cols != cols || b.type() != type) continue;
+                    Mat * m = new Mat(b);
+                    (this->buffers).erase((this->buffers).begin() + (i - 1));
+                    lock.unlock();
+                    this->reused++;
+                    if (zero) m->setTo(Scalar(0));
+                    return m;
+                }
+            }
+            this->allocated++;
+            return (zero) ? new Mat(rows, cols, type, 0.0) : new Mat(rows, cols, type);
+        }
+
+        /**
+         * @brief Gives back a frame, that is kept for the next frames of its size
+         *
+         * @param m the frame, deleted
+         */
+        void release(Mat * m) {
+            if (this->capacity > 0 && !m->empty()) {
+                unique_lock<mutex> lock(this->l);
+                if ((this->buffers).size() >= this->capacity) (this->buffers).pop_front();
+                (this->buffers).push_back(*m);
+            }
+            delete m;
+        }
+
+        /**
+         * @brief Takes a frame from a pool, or allocates it if there is no pool
+         *
+         * @param pool the pool, nullptr if it is not used
+         * @param rows rows of the frame
+         * @param cols columns of the frame
+         * @param type type of the frame
+         * @param zero true to set the pixels to 0
+         * @return the frame, owned by the caller
+         */
+        static Mat * take(FramePool * pool, int rows, int cols, int type, bool zero = false) {
+            if (pool != nullptr) return pool->acquire(rows, cols, type, zero);
+            return (zero) ? new Mat(rows, cols, type, 0.0) : new Mat(rows, cols, type);
+        }
+
+        /**
+         * @brief Gives back a frame to a pool, or deletes it if there is no pool
+         *
+         * @param pool the pool, nullptr if it is not used
+         * @param m the frame
+         */
+        static void give_back(FramePool * pool, Mat * m) {
+            if (pool != nullptr) pool->release(m);
+            else delete m;
+        }
+
+        long get_allocated() {
+            return this->allocated;
+        }
+
+        long get_reused() {
+            return this->reused;
+        }
+
+        /**
+         * @brief Prints how many frames have been allocated and how many reused a buffer
+         *
+         */
+        void print_report() {
+            cout << "Frame buffers: " << this->allocated << " allocated, " << this->reused << " reused" << endl;
+        }
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef FRAME_QUEUE_HPP
+#define FRAME_QUEUE_HPP
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Bounded queue of the frames pushed by an application, read by the reader stage in place of a
+ *        video. The push blocks when the queue is full, so the application is slowed down to the speed
+ *        of the pipeline. It is closed at the end of a video and reopened for the next one
+ *
+ */
+class FrameQueue {
+
+    private:
+        deque<Mat> frames;
+        size_t capacity;
+        bool closed = false;
+        mutex l;
+        condition_variable not_empty;
+        condition_variable not_full;
+
+    public:
+
+        FrameQueue(size_t capacity): capacity(max(capacity, (size_t) 1)) {}
+
+        /**
+         * @brief Adds a frame, waiting if the queue is full
+         *
+         * @param frame the frame, it is not copied so it must not be modified after the push
+         * @return false if the queue is closed
+         */
+        bool push(Mat frame) {
+            unique_lock<mutex> lock(this->l);
+            (this->not_full).wait(lock, [&]() { return (this->frames).size() < this->capacity || this->closed; });
+            if (this->closed) return false;
+            (this->frames).push_back(frame);
+            (this->not_empty).notify_one();
+            return true;
+        }
+
+        /**
+         * @brief Takes the next frame, waiting if the queue is empty
+         *
+         * @param frame matrix where the frame is stored
+         * @return false if the queue is closed and there are no more frames
+         */
+        bool pop(Mat & frame) {
+            unique_lock<mutex> lock(this->l);
+            (this->not_empty).wait(lock, [&]() { return !(this->frames).empty() || this->closed; });
+            if ((this->frames).empty()) return false;
+            frame = (this->frames).front();
+            (this->frames).pop_front();
+            (this->not_full).notify_one();
+            return true;
+        }
+
+        /**
+         * @brief Marks the end of the video, the frames already in the queue are still given
+         *
+         */
+        void close() {
+            unique_lock<mutex> lock(this->l);
+            this->closed = true;
+            (this->not_empty).notify_all();
+            (this->not_full).notify_all();
+        }
+
+        /**
+         * @brief Opens the queue for a new video
+         *
+         */
+        void reopen() {
+            unique_lock<mutex> lock(this->l);
+            (this->frames).clear();
+            this->closed = false;
+        }
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef FRAME_READER_HPP
+#define FRAME_READER_HPP
+
+#include <iostream>
+#include "opencv2/opencv.hpp"
+#include "latency_histogram.hpp"
+#include "synthetic_source.hpp"
+#include "trace_recorder.hpp"
+#include "frame_queue.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Class that reads frames from a video and prepares them for the stages of the pipeline.
+ *        In luma mode the backend is asked for the raw YUV frame and only the Y plane is kept,
+ *        so the frames are already in greyscale and the colour conversion is not needed. If the name
+ *        of the video is a synthetic specification the frames are generated instead of decoded, and
+ *        an application that embeds the detector can push its own frames through a queue
+ *
+ */
+class FrameReader {
+
+    private:
+        VideoCapture cap;
+        SyntheticSource * synthetic = nullptr; // generator of the frames, nullptr if a video is read
+        FrameQueue * queue = nullptr; // frames pushed by the application, nullptr if a video is read
+        bool luma = false;
+        // Height of the frames, needed to find the Y plane of planar YUV formats
+        int height = 0;
+        // Flag to print only once that the backend does not give raw frames
+        bool warned = false;
+        // Number of frames read, used to label the reads in the trace
+        long frames_read = 0;
+
+        /**
+         * @brief Extracts the luma plane from the raw frame given by the backend
+         *
+         * @param raw the frame as given by the backend
+         * @param y matrix where the luma plane is stored
+         */
+        void extract_luma(Mat & raw, Mat & y) {
+            if (raw.channels() == 1) {
+                // Planar formats (I420, NV12) are given as a single channel matrix with the
+                // chroma planes under the luma one
+                if (this->height > 0 && raw.rows > this->height) y = raw(Rect(0, 0, raw.cols, this->height));
+                else y = raw;
+            }
+            else if (raw.channels() == 2) {
+                // Packed YUYV, the luma is the first channel
+                extractChannel(raw, y, 0);
+            }
+            else {
+                // The backend ignored the request and decoded to BGR
+                if (!this->warned) {
+                    cout << "The backend does not give raw YUV frames, converting BGR frames to greyscale" << endl;
+                    this->warned = true;
+                }
+                cvtColor(raw, y, COLOR_BGR2GRAY);
+            }
+        }
+
+    public:
+
+        FrameReader(string filename, bool luma, int decoder_threads = 0): luma(luma) {
+            if (SyntheticSource::is_spec(filename)) {
+                this->synthetic = new SyntheticSource(filename, luma);
+                return;
+            }
+            // The number of decoder threads can only be set when the video is opened
+            if (decoder_threads > 0) (this->cap).open(filename, CAP_ANY, {CAP_PROP_N_THREADS, decoder_threads});
+            else (this->cap).open(filename);
+            if (luma) {
+                // Asks the backend to not convert the frames to BGR
+                (this->cap).set(CAP_PROP_CONVERT_RGB, 0);
+                this->height = (int) (this->cap).get(CAP_PROP_FRAME_HEIGHT);
+            }
+        }
+
+        /**
+         * @brief Creates a reader of the frames pushed in a queue, 8 bit frames are converted to float
+         *        and float frames are taken as they are
+         *
+         * @param queue the queue, it is not owned by the reader
+         */
+        FrameReader(FrameQueue * queue): queue(queue) {}
+
+        ~FrameReader() {
+            delete this->synthetic;
+        }
+
+        /**
+         * @brief Reads the next frame of the video and converts it to float values in [0,1]
+         *
+         * @param frame matrix where the frame is stored, CV_32FC3 or CV_32F in luma mode
+         * @return false if the frames are finished
+         */
+        bool read(Mat & frame) {
+            auto start = std::chrono::high_resolution_clock::now();
+            TraceScope tr(READ, ++(this->frames_read));
+            if (this->synthetic != nullptr) {
+                if (!(this->synthetic)->next(frame)) return false;
+                StageHistograms::record(READ, std::chrono::high_resolution_clock::now() - start);
+                return true;
+            }
+            if (this->queue != nullptr) {
+                Mat pushed;
+                if (!(this->queue)->pop(pushed)) return false;
+                if (pushed.depth() == CV_32F) frame = pushed;
+                else pushed.convertTo(frame, CV_32F, 1.0/255.0);
+                StageHistograms::record(READ, std::chrono::high_resolution_clock::now() - start);
+                return true;
+            }
+            Mat raw;
+            this->cap >> raw;
+            if (raw.empty()) return false;
+            if (this->luma) {
+                Mat y;
+                this->extract_luma(raw, y);
+                y.convertTo(frame, CV_32F, 1.0/255.0);
+            }
+            else {
+                raw.convertTo(frame, CV_32F, 1.0/255.0);
+            }
+            StageHistograms::record(READ, std::chrono::high_resolution_clock::now() - start);
+            return true;
+        }
+
+        /**
+         * @brief Gets the frame rate of the video
+         *
+         * @return the frames per second declared by the video
+         */
+        double get_fps() {
+            if (this->queue != nullptr) return 0;
+            if (this->synthetic != nullptr) return (this->synthetic)->get_fps();
+            return (this->cap).get(CAP_PROP_FPS);
+        }
+
+        /**
+         * @brief Gets the codec of the video as a four characters code
+         *
+         * @return the codec name
+         */
+        string get_codec() {
+            if (this->synthetic != nullptr) return "synthetic";
+            if (this->queue != nullptr) return "pushed";
+            int fourcc = (int) (this->cap).get(CAP_PROP_FOURCC);
+            string codec = "";
+            for (int i=0; i<4; i++) codec += (char) ((fourcc >> (8 * i)) & 0xFF);
+            return codec;
+        }
+
+        /**
+         * @brief Tells if the frames given by the reader are already in greyscale
+         *
+         * @return true if luma mode is used
+         */
+        bool is_luma() {
+            return this->luma;
+        }
+
+        void release() {
+            if (this->synthetic != nullptr) (this->synthetic)->release();
+            (this->cap).release();
+        }
+};
+
+#endif
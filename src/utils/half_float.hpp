@@ -0,0 +1,222 @@
+#ifndef HALF_FLOAT_HPP
+#define HALF_FLOAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "roi_mask.hpp"
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Kernels of the stages on frames stored as IEEE half floats (CV_16F). The values are in [0,1]
+ *        and compared with a threshold of about 0.05, so the 11 bits of precision of a half are enough,
+ *        and the frames take half of the memory and of the bandwidth. The values are converted to float
+ *        when they are loaded and back when they are stored, with F16C 8 at a time when the compiler
+ *        targets it (-mf16c), and the arithmetic is done in float as in the FP32 kernels
+ *
+ */
+class HalfFloat {
+
+    private:
+
+        /**
+         * @brief Converts a float to a half, rounding to the nearest even, without F16C
+         *
+         * @param f the float
+         * @return the bits of the half
+         */
+        static uint16_t to_half(float f) {
+            uint32_t x;
+            memcpy(&x, &f, 4);
+            uint16_t sign = (x >> 16) & 0x8000;
+            int exp = (int) ((x >> 23) & 0xff) - 127 + 15;
+            uint32_t mant = x & 0x7fffff;
+            if (((x >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0); // inf and nan
+            if (exp >= 31) return sign | 0x7c00;
+            if (exp <= 0) {
+                // Subnormal half, the implicit bit is shifted in
+                if (exp < -10) return sign;
+                mant |= 0x800000;
+                int shift = 14 - exp;
+                uint32_t h = mant >> shift;
+                uint32_t rest = mant & ((1u << shift) - 1);
+                uint32_t half = 1u << (shift - 1);
+                if (rest > half || (rest == half && (h & 1))) h++;
+                return sign | h;
+            }
+            uint32_t h = (exp << 10) | (mant >> 13);
+            uint32_t rest = mant & 0x1fff;
+            if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+            return sign | h;
+        }
+
+        /**
+         * @brief Converts a half to a float, without F16C
+         *
+         * @param h the bits of the half
+         * @return the float
+         */
+        static float to_float(uint16_t h) {
+            uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+            int exp = (h >> 10) & 0x1f;
+            uint32_t mant = h & 0x3ff;
+            uint32_t x;
+            if (exp == 0) {
+                if (mant == 0) x = sign;
+                else {
+                    // Subnormal half, normalized in the float
+                    exp = 1;
+                    while (!(mant & 0x400)) {
+                        mant <<= 1;
+                        exp--;
+                    }
+                    mant &= 0x3ff;
+                    x = sign | ((uint32_t) (exp - 15 + 127) << 23) | (mant << 13);
+                }
+            }
+            else if (exp == 31) x = sign | 0x7f800000 | (mant << 13);
+            else x = sign | ((uint32_t) (exp - 15 + 127) << 23) | (mant << 13);
+            float f;
+            memcpy(&f, &x, 4);
+            return f;
+        }
+
+    public:
+
+        /**
+         * @brief Converts floats to halves
+         *
+         * @param src the floats
+         * @param dst where the halves are stored
+         * @param n number of values
+         */
+        static void pack(const float * src, uint16_t * dst, int n) {
+            int i = 0;
+#ifdef __F16C__
+            for (; i+8<=n; i+=8) {
+                __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+                _mm_storeu_si128((__m128i *) (dst + i), h);
+            }
+#endif
+            for (; i<n; i++) dst[i] = to_half(src[i]);
+        }
+
+        /**
+         * @brief Converts halves to floats
+         *
+         * @param src the halves
+         * @param dst where the floats are stored
+         * @param n number of values
+         */
+        static void unpack(const uint16_t * src, float * dst, int n) {
+            int i = 0;
+#ifdef __F16C__
+            for (; i+8<=n; i+=8) {
+                __m256 f = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (src + i)));
+                _mm256_storeu_ps(dst + i, f);
+            }
+#endif
+            for (; i<n; i++) dst[i] = to_float(src[i]);
+        }
+
+        /**
+         * @brief Converts a greyscale float matrix to halves, used for the background
+         *
+         * @param m the CV_32F matrix
+         * @return the CV_16F matrix
+         */
+        static Mat to_half(const Mat & m) {
+            Mat res = Mat(m.rows, m.cols, CV_16F);
+            for (int i=0; i<m.rows; i++) pack(m.ptr<float>(i), res.ptr<uint16_t>(i), m.cols);
+            return res;
+        }
+
+        /**
+         * @brief Converts a greyscale half matrix to floats, used to show it and to check the accuracy
+         *
+         * @param m the CV_16F matrix
+         * @return the CV_32F matrix
+         */
+        static Mat to_float(const Mat & m) {
+            Mat res = Mat(m.rows, m.cols, CV_32F);
+            for (int i=0; i<m.rows; i++) unpack(m.ptr<uint16_t>(i), res.ptr<float>(i), m.cols);
+            return res;
+        }
+
+        /**
+         * @brief Converts a frame in greyscale, storing it in halves
+         *
+         * @param frame the frame, CV_32FC3
+         * @param roi region of interest, the pixels of the region and their neighbours are converted
+         * @return the CV_16F greyscale frame
+         */
+        static Mat greyscale(const Mat & frame, const RoiMask & roi) {
+            Mat gr = Mat(frame.rows, frame.cols, CV_16F, 0.0);
+            int channels = frame.channels();
+            vector<float> row(frame.cols);
+            for (int i=0; i<frame.rows; i++) {
+                const float * p = frame.ptr<float>(i);
+                for (const Span & s : roi.row_halo_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        row[j] = (p[j * channels] + p[j * channels + 1] + p[j * channels + 2]) / channels;
+                    }
+                    pack(row.data() + s.begin, gr.ptr<uint16_t>(i) + s.begin, s.end - s.begin);
+                }
+            }
+            return gr;
+        }
+
+        /**
+         * @brief Performs smoothing of a half matrix with an average 3x3 kernel, as the FP32 smoothers:
+         *        the first row and column and the last two are copied, the pixels outside the region are 0.
+         *        Each row is converted to floats once and kept for the next two rows
+         *
+         * @param m the CV_16F matrix
+         * @param roi region of interest
+         * @return the smoothed CV_16F matrix
+         */
+        static Mat smoothing(const Mat & m, const RoiMask & roi) {
+            Mat res = Mat(m.rows, m.cols, CV_16F, 0.0);
+            int cols = m.cols;
+            // Floats of the rows i-1, i and i+1, and the index of the row held by each buffer
+            vector<float> rows[3] = {vector<float>(cols), vector<float>(cols), vector<float>(cols)};
+            int held[3] = {-1, -1, -1};
+            vector<float> out(cols);
+            auto row = [&](int r) -> const float * {
+                int b = r % 3;
+                if (held[b] != r) {
+                    unpack(m.ptr<uint16_t>(r), rows[b].data(), cols);
+                    held[b] = r;
+                }
+                return rows[b].data();
+            };
+            for (int i=0; i<m.rows; i++) {
+                const vector<Span> & spans = roi.row_spans(i);
+                if (spans.empty()) continue;
+                bool inner_row = i >= 1 && i + 2 < m.rows;
+                const float * up = inner_row ? row(i - 1) : nullptr;
+                const float * mid = row(i);
+                const float * down = inner_row ? row(i + 1) : nullptr;
+                for (const Span & s : spans) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        if (inner_row && j >= 1 && j + 2 < cols) {
+                            out[j] = (up[j - 1] + up[j] + up[j + 1] + mid[j - 1] + mid[j] + mid[j + 1] +
+                                down[j - 1] + down[j] + down[j + 1]) / 9;
+                        }
+                        else out[j] = mid[j];
+                    }
+                    pack(out.data() + s.begin, res.ptr<uint16_t>(i) + s.begin, s.end - s.begin);
+                }
+            }
+            return res;
+        }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef INFLIGHT_COUNTER_HPP
+#define INFLIGHT_COUNTER_HPP
+
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <condition_variable>
+#include "opencv2/opencv.hpp"
+#include "trace_recorder.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Class that counts the frames that are inside the pipeline, between the node that reads them
+ *        and the node that collects the results, and keeps the maximum reached. With a memory budget
+ *        the reader waits in enter until the bytes of the frames in flight leave room for one more, so
+ *        the memory taken by the frames does not depend on their resolution
+ *
+ */
+class InFlightCounter {
+
+    private:
+        atomic<long> n;
+        atomic<long> high;
+        long budget = 0; // bytes of the frames in flight allowed, 0 if unlimited
+        long frame_bytes = 0; // bytes taken by a frame in the pipeline
+        mutex l;
+        condition_variable room;
+
+        /**
+         * @brief Counts a frame admitted in the pipeline
+         *
+         */
+        void counted() {
+            long v = ++(this->n);
+            long h = this->high;
+            while (v > h && !(this->high).compare_exchange_weak(h, v));
+            TraceRecorder::counter("frames in flight", v);
+        }
+
+    public:
+
+        InFlightCounter() {
+            this->n = 0;
+            this->high = 0;
+        }
+
+        /**
+         * @brief Gets the bytes taken by a frame in the pipeline, the most it holds at a time, that is
+         *        during the greyscale conversion, when the frame and its greyscale copy are both alive
+         *
+         * @param frame a frame as read, BGR or greyscale in luma mode
+         * @return the number of bytes
+         */
+        static long get_frame_bytes(const Mat & frame) {
+            long pixels = (long) frame.rows * frame.cols;
+            return pixels * (long) frame.elemSize() + ((frame.channels() > 1) ? pixels * (long) sizeof(float) : 0);
+        }
+
+        /**
+         * @brief Parses a number of bytes, with an optional K, M or G suffix
+         *
+         * @param s the string
+         * @return the number of bytes, 0 if it is not valid
+         */
+        static long parse_bytes(const char * s) {
+            char * end;
+            double v = strtod(s, &end);
+            if (*end == 'K' || *end == 'k') v *= 1024;
+            else if (*end == 'M' || *end == 'm') v *= 1024 * 1024;
+            else if (*end == 'G' || *end == 'g') v *= 1024.0 * 1024 * 1024;
+            return (v > 0) ? (long) v : 0;
+        }
+
+        /**
+         * @brief Sets the memory budget of the frames in flight, when the pipeline is empty
+         *
+         * @param budget bytes of the frames in flight allowed, 0 if unlimited
+         * @param frame_bytes bytes taken by a frame in the pipeline
+         */
+        void set_budget(long budget, long frame_bytes) {
+            unique_lock<mutex> lock(this->l);
+            this->budget = max(budget, 0L);
+            this->frame_bytes = max(frame_bytes, 1L);
+        }
+
+        /**
+         * @brief Gets the number of frames the budget allows in flight, at least one
+         *
+         * @param max_frames the number of frames used without a budget
+         * @return the number of frames
+         */
+        int frames_allowed(int max_frames) {
+            unique_lock<mutex> lock(this->l);
+            if (this->budget == 0) return max_frames;
+            return (int) max(min(this->budget / this->frame_bytes, (long) max_frames), 1L);
+        }
+
+        /**
+         * @brief Counts a frame entering the pipeline, waiting for room with a budget. A frame is always
+         *        admitted in an empty pipeline, even if it exceeds the budget alone
+         *
+         */
+        void enter() {
+            if (this->budget > 0) {
+                unique_lock<mutex> lock(this->l);
+                (this->room).wait(lock, [&]() { return this->n == 0 || (this->n + 1) * this->frame_bytes <= this->budget; });
+            }
+            counted();
+        }
+
+        /**
+         * @brief Counts a frame entering the pipeline only if there is room for it without waiting
+         *
+         * @return true if the frame has been counted, false if it has to wait in enter
+         */
+        bool try_enter() {
+            if (this->budget > 0) {
+                unique_lock<mutex> lock(this->l);
+                if (this->n > 0 && (this->n + 1) * this->frame_bytes > this->budget) return false;
+            }
+            counted();
+            return true;
+        }
+
+        /**
+         * @brief Counts a frame leaving the pipeline
+         *
+         */
+        void leave() {
+            long v;
+            {
+                unique_lock<mutex> lock(this->l);
+                v = --(this->n);
+            }
+            if (this->budget > 0) (this->room).notify_one();
+            TraceRecorder::counter("frames in flight", v);
+        }
+
+        long high_water() {
+            return this->high;
+        }
+
+        /**
+         * @brief Gets the maximum bytes taken by the frames in flight
+         *
+         * @return the number of bytes, 0 if no budget has been set
+         */
+        long bytes_high_water() {
+            unique_lock<mutex> lock(this->l);
+            return (this->budget > 0) ? this->high * this->frame_bytes : 0;
+        }
+};
+
+#endif
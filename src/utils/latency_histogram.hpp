@@ -0,0 +1,231 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * @brief Histogram of latencies in nsec with logarithmic buckets: each power of two is split in 8
+ *        buckets, so the relative error of the percentiles is below 12.5%. It is not thread safe,
+ *        each thread records in its own histogram and they are merged at the end
+ *
+ */
+class LatencyHistogram {
+
+    private:
+        static const int SUB_BUCKETS = 8;
+        static const int BUCKETS = 64 * SUB_BUCKETS;
+        uint64_t counts[BUCKETS] = {0};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max_value = 0;
+
+        /**
+         * @brief Gets the bucket of a value
+         *
+         * @param v value in nsec
+         * @return index of the bucket
+         */
+        static int bucket(uint64_t v) {
+            if (v < SUB_BUCKETS) return (int) v;
+            int msb = 63 - __builtin_clzll(v);
+            int sub = (int) ((v >> (msb - 3)) & (SUB_BUCKETS - 1));
+            return (msb - 2) * SUB_BUCKETS + sub;
+        }
+
+        /**
+         * @brief Gets the value in the middle of a bucket
+         *
+         * @param b index of the bucket
+         * @return value in nsec
+         */
+        static uint64_t bucket_value(int b) {
+            if (b < SUB_BUCKETS) return b;
+            int msb = b / SUB_BUCKETS + 2;
+            int sub = b % SUB_BUCKETS;
+            uint64_t low = ((uint64_t) 1 << msb) + ((uint64_t) sub << (msb - 3));
+            // The buckets from 8 to 15 hold a single value, the wider ones are taken at their middle
+            if (msb < 4) return low;
+            return low + ((uint64_t) 1 << (msb - 4));
+        }
+
+    public:
+
+        /**
+         * @brief Records a latency
+         *
+         * @param ns latency in nsec
+         */
+        void record(uint64_t ns) {
+            this->counts[bucket(ns)]++;
+            this->count++;
+            this->sum += ns;
+            if (ns > this->max_value) this->max_value = ns;
+        }
+
+        /**
+         * @brief Adds the samples of another histogram to this one
+         *
+         * @param other the histogram to merge
+         */
+        void merge(const LatencyHistogram & other) {
+            for (int i=0; i<BUCKETS; i++) this->counts[i] += other.counts[i];
+            this->count += other.count;
+            this->sum += other.sum;
+            if (other.max_value > this->max_value) this->max_value = other.max_value;
+        }
+
+        /**
+         * @brief Gets a percentile of the recorded latencies
+         *
+         * @param p percentile in [0,100]
+         * @return the latency in nsec
+         */
+        uint64_t percentile(double p) const {
+            if (this->count == 0) return 0;
+            uint64_t rank = (uint64_t) (p / 100.0 * (this->count - 1)) + 1;
+            uint64_t seen = 0;
+            for (int i=0; i<BUCKETS; i++) {
+                seen += this->counts[i];
+                if (seen >= rank) return min(bucket_value(i), this->max_value);
+            }
+            return this->max_value;
+        }
+
+        uint64_t get_count() const {
+            return this->count;
+        }
+
+        double get_mean() const {
+            return (this->count > 0) ? (double) this->sum / this->count : 0;
+        }
+
+        uint64_t get_max() const {
+            return this->max_value;
+        }
+};
+
+/**
+ * @brief Stages whose latencies are recorded
+ *
+ */
+enum Stage { READ, GREYSCALE, SMOOTHING, COMPARE, STAGES };
+
+/**
+ * @brief Class that keeps a set of per stage histograms for each thread, without locks on the
+ *        recording path, and merges them when the results are printed
+ *
+ */
+class StageHistograms {
+
+    private:
+
+        struct ThreadSet {
+            LatencyHistogram stages[STAGES];
+        };
+
+        static mutex & lock() {
+            static mutex l;
+            return l;
+        }
+
+        // The sets are owned by the registry so that they outlive their threads
+        static vector<unique_ptr<ThreadSet>> & registry() {
+            static vector<unique_ptr<ThreadSet>> sets;
+            return sets;
+        }
+
+        /**
+         * @brief Gets the set of histograms of the calling thread, registering it the first time
+         *
+         * @return the set of the thread
+         */
+        static ThreadSet & local() {
+            thread_local ThreadSet * set = nullptr;
+            if (set == nullptr) {
+                unique_lock<mutex> l(lock());
+                registry().push_back(make_unique<ThreadSet>());
+                set = registry().back().get();
+            }
+            return *set;
+        }
+
+        static bool & enabled_flag() {
+            static bool enabled = false;
+            return enabled;
+        }
+
+    public:
+
+        static const char * stage_name(int stage) {
+            static const char * names[STAGES] = {"read", "greyscale", "smoothing", "compare"};
+            return names[stage];
+        }
+
+        /**
+         * @brief Enables the recording, it must be called before the threads start
+         *
+         */
+        static void enable() {
+            enabled_flag() = true;
+        }
+
+        static bool is_enabled() {
+            return enabled_flag();
+        }
+
+        /**
+         * @brief Records the latency of a stage in the histogram of the calling thread
+         *
+         * @param stage the stage
+         * @param d the duration of the stage
+         */
+        template <class D>
+        static void record(Stage stage, D d) {
+            if (!enabled_flag()) return;
+            long ns = chrono::duration_cast<chrono::nanoseconds>(d).count();
+            local().stages[stage].record(ns > 0 ? ns : 0);
+        }
+
+        /**
+         * @brief Merges the histograms of all the threads for a stage, it must be called when the
+         *        threads have finished
+         *
+         * @param stage the stage
+         * @return the merged histogram
+         */
+        static LatencyHistogram merged(Stage stage) {
+            unique_lock<mutex> l(lock());
+            LatencyHistogram h;
+            for (auto & set : registry()) h.merge(set->stages[stage]);
+            return h;
+        }
+
+        /**
+         * @brief Prints the percentiles of each stage in usec
+         *
+         */
+        static void print_report() {
+            if (!enabled_flag()) return;
+            cout << "Stage latencies (usec):" << endl;
+            for (int s=0; s<STAGES; s++) {
+                LatencyHistogram h = merged((Stage) s);
+                if (h.get_count() == 0) continue;
+                cout << "  " << left << setw(10) << stage_name(s) << right << fixed << setprecision(1) <<
+                    " count " << h.get_count() << ", mean " << h.get_mean() / 1000 <<
+                    ", p50 " << h.percentile(50) / 1000.0 << ", p90 " << h.percentile(90) / 1000.0 <<
+                    ", p99 " << h.percentile(99) / 1000.0 << ", p99.9 " << h.percentile(99.9) / 1000.0 <<
+                    ", max " << h.get_max() / 1000.0 << endl;
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "latency_histogram.hpp"
+
+using namespace std;
+
+/**
+ * @brief Class that samples the hardware performance counters of each thread around the stage calls:
+ *        cycles, instructions, last level cache misses and context switches. The counters of each
+ *        thread are opened as a group the first time the thread runs a stage, and the deltas are
+ *        accumulated per stage and merged at the end
+ *
+ */
+class PerfCounters {
+
+    private:
+        static const int EVENTS = 4; // cycles, instructions, LLC misses, context switches
+
+        struct StageTotals {
+            uint64_t values[EVENTS] = {0};
+            uint64_t pixels = 0;
+            uint64_t calls = 0;
+        };
+
+        struct ThreadCounters {
+            int fd[EVENTS] = {-1, -1, -1, -1};
+            bool open = false;
+            StageTotals stages[STAGES];
+        };
+
+        static mutex & lock() {
+            static mutex l;
+            return l;
+        }
+
+        static vector<unique_ptr<ThreadCounters>> & registry() {
+            static vector<unique_ptr<ThreadCounters>> threads;
+            return threads;
+        }
+
+        static bool & enabled_flag() {
+            static bool enabled = false;
+            return enabled;
+        }
+
+        /**
+         * @brief Opens a counter of the calling thread
+         *
+         * @param type type of the event
+         * @param config the event
+         * @param group file descriptor of the leader of the group, -1 for the leader
+         * @return the file descriptor of the counter, -1 if it cannot be opened
+         */
+        static int open_counter(uint32_t type, uint64_t config, int group) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = (group == -1) ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+        }
+
+        /**
+         * @brief Gets the counters of the calling thread, opening them the first time
+         *
+         * @return the counters of the thread
+         */
+        static ThreadCounters & local() {
+            thread_local ThreadCounters * counters = nullptr;
+            if (counters == nullptr) {
+                {
+                    unique_lock<mutex> l(lock());
+                    registry().push_back(make_unique<ThreadCounters>());
+                    counters = registry().back().get();
+                }
+                ThreadCounters & c = *counters;
+                c.fd[0] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+                if (c.fd[0] >= 0) {
+                    c.fd[1] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, c.fd[0]);
+                    c.fd[2] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, c.fd[0]);
+                    c.fd[3] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, c.fd[0]);
+                }
+                c.open = c.fd[0] >= 0 && c.fd[1] >= 0 && c.fd[2] >= 0 && c.fd[3] >= 0;
+                if (c.open) {
+                    ioctl(c.fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                    ioctl(c.fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+                }
+                else {
+                    unique_lock<mutex> l(lock());
+                    cout << "Cannot open the performance counters, check /proc/sys/kernel/perf_event_paranoid" << endl;
+                }
+            }
+            return *counters;
+        }
+
+    public:
+
+        /**
+         * @brief Reads the current values of the counters of the calling thread
+         *
+         * @param values array where the values are stored
+         * @return false if the counters are not available
+         */
+        static bool read(uint64_t * values) {
+            ThreadCounters & c = local();
+            if (!c.open) return false;
+            // With PERF_FORMAT_GROUP the first value is the number of events
+            uint64_t buffer[EVENTS + 1];
+            if (::read(c.fd[0], buffer, sizeof(buffer)) != (ssize_t) sizeof(buffer)) return false;
+            for (int i=0; i<EVENTS; i++) values[i] = buffer[i + 1];
+            return true;
+        }
+
+        /**
+         * @brief Adds the deltas of a stage call to the totals of the calling thread
+         *
+         * @param stage the stage
+         * @param start values read before the call
+         * @param end values read after the call
+         * @param pixels pixels processed by the call
+         */
+        static void add(Stage stage, uint64_t * start, uint64_t * end, long pixels) {
+            StageTotals & t = local().stages[stage];
+            for (int i=0; i<EVENTS; i++) t.values[i] += end[i] - start[i];
+            t.pixels += pixels;
+            t.calls++;
+        }
+
+        static void enable() {
+            enabled_flag() = true;
+        }
+
+        static bool is_enabled() {
+            return enabled_flag();
+        }
+
+        /**
+         * @brief Prints IPC, misses and cycles per pixel and context switches for each stage
+         *
+         * @param backend name of the implementation
+         */
+        static void print_report(string backend) {
+            if (!enabled_flag()) return;
+            unique_lock<mutex> l(lock());
+            cout << "Performance counters of " << backend << ":" << endl;
+            for (int s=0; s<STAGES; s++) {
+                StageTotals total;
+                for (auto & c : registry()) {
+                    if (!c->open) continue;
+                    for (int i=0; i<EVENTS; i++) total.values[i] += c->stages[s].values[i];
+                    total.pixels += c->stages[s].pixels;
+                    total.calls += c->stages[s].calls;
+                }
+                if (total.calls == 0 || total.pixels == 0) continue;
+                double ipc = (total.values[0] > 0) ? (double) total.values[1] / total.values[0] : 0;
+                cout << "  " << left << setw(10) << StageHistograms::stage_name(s) << right << fixed << setprecision(3) <<
+                    " IPC " << ipc << ", cycles/pixel " << (double) total.values[0] / total.pixels <<
+                    ", LLC misses/pixel " << setprecision(5) << (double) total.values[2] / total.pixels <<
+                    ", context switches " << total.values[3] << " in " << total.calls << " calls" << endl;
+            }
+        }
+};
+
+/**
+ * @brief Reads the counters at construction and at destruction and accumulates the deltas for a stage,
+ *        it does nothing if the counters are not enabled
+ *
+ */
+class PerfScope {
+
+    private:
+        Stage stage;
+        long pixels;
+        bool active = false;
+        uint64_t start[4];
+
+    public:
+
+        PerfScope(Stage stage, long pixels): stage(stage), pixels(pixels) {
+            if (PerfCounters::is_enabled()) this->active = PerfCounters::read(this->start);
+        }
+
+        ~PerfScope() {
+            if (!this->active) return;
+            uint64_t end[4];
+            if (PerfCounters::read(end)) PerfCounters::add(this->stage, this->start, end, this->pixels);
+        }
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef PYRAMID_HPP
+#define PYRAMID_HPP
+
+#include <iostream>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "roi_mask.hpp"
+#include "background_builder.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Coarse to fine detection: each frame is first analyzed downsampled by a factor, with the
+ *        downsampling done in the greyscale conversion, that reads every pixel once and writes only the
+ *        mean of each block. The full frame is analyzed only when the fraction of different pixels of
+ *        the downsampled one is within a margin of the percentage, so that the decisions far from it cost
+ *        factor * factor times less. Shared by the workers, that call decide on each frame
+ *
+ */
+class Pyramid {
+
+    private:
+        int factor;
+        float percent;
+        float margin; // the full frame is analyzed when the coarse fraction is within this distance of the percent
+        RoiMask coarse_roi; // region of the downsampled frames, the blocks fully inside the region of the full ones
+        int rows;
+        int cols;
+        Mat background; // downsampled background
+        float threshold = 0;
+        BackgroundBuilder * builder; // the background is taken from it at the first frame, nullptr if it is set
+        atomic<bool> ready;
+        mutex l;
+        atomic<long> coarse_frames; // frames decided on the downsampled frame
+        atomic<long> refined_frames; // frames analyzed again at full resolution
+
+        /**
+         * @brief Takes the background from the builder, at the first frame
+         *
+         */
+        void prepare() {
+            if (this->ready) return;
+            unique_lock<mutex> lock(this->l);
+            if (this->ready) return;
+            (this->builder)->wait_ready();
+            this->set_background((this->builder)->get_grey_background(), (this->builder)->get_threshold());
+        }
+
+        /**
+         * @brief Performs smoothing of a downsampled matrix, as the full resolution one
+         *
+         * @param m the matrix
+         * @return the matrix with the 3x3 average kernel applied on the region
+         */
+        Mat smoothing(const Mat & m) {
+            Mat res = Mat(this->rows, this->cols, CV_32F, 0.0);
+            for (int i=0; i<this->rows; i++) {
+                float * r = res.ptr<float>(i);
+                for (const Span & s : (this->coarse_roi).row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        // The first and last rows and columns are not smoothed
+                        if (i == 0 || j == 0 || i == this->rows - 1 || j == this->cols - 1) {
+                            r[j] = m.ptr<float>(i)[j];
+                            continue;
+                        }
+                        float sum = 0;
+                        for (int z=i-1; z<=i+1; z++) {
+                            const float * p = m.ptr<float>(z);
+                            sum += p[j - 1] + p[j] + p[j + 1];
+                        }
+                        r[j] = sum / 9;
+                    }
+                }
+            }
+            return res;
+        }
+
+    public:
+
+        /**
+         * @brief Creates the coarse detector
+         *
+         * @param roi region of interest of the full frames
+         * @param factor downsampling factor, 2 or 4
+         * @param percent fraction of different pixels that detects a movement
+         * @param margin distance from the percent within which the full frame is analyzed
+         * @param builder builder of the full background, nullptr if it is given with set_background
+         */
+        Pyramid(RoiMask * roi, int factor, float percent, float margin, BackgroundBuilder * builder):
+            factor(max(factor, 1)), percent(percent), margin(margin), coarse_roi(*roi, max(factor, 1)), builder(builder) {
+            this->rows = (this->coarse_roi).get_rows();
+            this->cols = (this->coarse_roi).get_cols();
+            this->ready = false;
+            this->coarse_frames = 0;
+            this->refined_frames = 0;
+        }
+
+        /**
+         * @brief Sets the background, downsampling the full resolution one
+         *
+         * @param grey the greyscale background at full resolution, before smoothing
+         * @param threshold threshold to consider two pixels different, the block means keep the intensity
+         */
+        void set_background(Mat grey, float threshold) {
+            // Downsampled and smoothed once, exactly as the frames, so a frame equal to it has no different pixels
+            this->background = this->smoothing(this->downsample_greyscale(grey));
+            this->threshold = threshold;
+            this->ready = true;
+        }
+
+        /**
+         * @brief Converts a frame in greyscale and downsamples it in the same pass, each pixel is the mean
+         *        of its block. Only the region and its neighbours are converted
+         *
+         * @param frame the frame, BGR or greyscale in luma mode
+         * @return the downsampled greyscale frame
+         */
+        Mat downsample_greyscale(const Mat & frame) {
+            Mat res = Mat(this->rows, this->cols, CV_32F, 0.0);
+            int channels = frame.channels();
+            int block = this->factor * channels; // values of a row of a block
+            float scale = 1.0f / (this->factor * block);
+            for (int i=0; i<this->rows; i++) {
+                float * r = res.ptr<float>(i);
+                const vector<Span> & spans = (this->coarse_roi).row_halo_spans(i);
+                for (int z=i*this->factor; z<(i+1)*this->factor; z++) {
+                    const float * p = frame.ptr<float>(z);
+                    for (const Span & s : spans) {
+                        for (int j=s.begin; j<s.end; j++) {
+                            const float * q = p + j * block;
+                            float sum = 0;
+                            for (int c=0; c<block; c++) sum += q[c];
+                            r[j] += sum;
+                        }
+                    }
+                }
+                for (const Span & s : spans) {
+                    for (int j=s.begin; j<s.end; j++) r[j] *= scale;
+                }
+            }
+            return res;
+        }
+
+        /**
+         * @brief Computes the fraction of different pixels of the downsampled frame
+         *
+         * @param frame the frame, BGR or greyscale in luma mode
+         * @return the fraction of the pixels of the downsampled region different from the background
+         */
+        float coarse_fraction(const Mat & frame) {
+            this->prepare();
+            Mat m = this->smoothing(this->downsample_greyscale(frame));
+            long cnt = 0;
+            for (int i=0; i<this->rows; i++) {
+                const float * pa = m.ptr<float>(i);
+                const float * pb = (this->background).ptr<float>(i);
+                for (const Span & s : (this->coarse_roi).row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        if (abs(pb[j] - pa[j]) > this->threshold) cnt++;
+                    }
+                }
+            }
+            return (float) cnt / (this->coarse_roi).get_area();
+        }
+
+        /**
+         * @brief Decides on the downsampled frame if it is far enough from the percentage
+         *
+         * @param frame the frame, BGR or greyscale in luma mode
+         * @param fraction where the coarse fraction is stored when the frame is decided
+         * @return true if the frame is decided, false if it has to be analyzed at full resolution
+         */
+        bool decide(const Mat & frame, float & fraction) {
+            // A region too thin to contain a whole block is always analyzed at full resolution
+            if ((this->coarse_roi).get_area() == 0) {
+                this->refined_frames++;
+                return false;
+            }
+            float f = this->coarse_fraction(frame);
+            if (abs(f - this->percent) <= this->margin) {
+                this->refined_frames++;
+                return false;
+            }
+            fraction = f;
+            this->coarse_frames++;
+            return true;
+        }
+
+        /**
+         * @brief Gets the number of frames analyzed again at full resolution
+         *
+         * @return the number of frames
+         */
+        long get_refined_frames() {
+            return this->refined_frames;
+        }
+
+        /**
+         * @brief Prints how many frames have been analyzed at full resolution
+         *
+         */
+        void print_report() {
+            long total = this->coarse_frames + this->refined_frames;
+            cout << "Pyramid " << this->factor << "x: " << this->refined_frames << " of " << total << " frames refined at full resolution";
+            if (total > 0) cout << " (" << round(10000.0 * this->refined_frames / total) / 100 << "%)";
+            cout << endl;
+        }
+};
+
+#endif
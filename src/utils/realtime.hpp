@@ -0,0 +1,155 @@
+#ifndef REALTIME_HPP
+#define REALTIME_HPP
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+typedef chrono::steady_clock::time_point TimePoint;
+
+/**
+ * @brief Class that manages the real time mode: it paces the reader to the frame rate of the source,
+ *        assigns a deadline to each frame, drops the frames that are stale or that do not fit in the
+ *        in-flight limit, and collects the end-to-end latency of the frames
+ *
+ */
+class RealTime {
+
+    private:
+        chrono::microseconds period;
+        chrono::microseconds deadline; // maximum time between the arrival and the end of a frame
+        int max_in_flight; // maximum number of frames in the pipeline before the reader drops them
+        TimePoint start;
+        long ticks = 0;
+        bool started = false;
+
+        atomic<int> in_flight;
+        atomic<long> dropped;
+        atomic<long> completed;
+
+        // End-to-end latencies in usec of the completed frames
+        mutex l;
+        vector<long> latencies;
+
+        /**
+         * @brief Gets a percentile of the latencies, they must be sorted
+         *
+         * @param p percentile in [0,100]
+         * @return the latency in usec
+         */
+        long percentile(double p) {
+            if (this->latencies.empty()) return 0;
+            size_t i = (size_t) (p / 100.0 * (this->latencies.size() - 1) + 0.5);
+            return this->latencies[min(i, this->latencies.size() - 1)];
+        }
+
+    public:
+
+        /**
+         * @brief Creates the real time controller
+         *
+         * @param fps frame rate of the source
+         * @param max_in_flight maximum number of frames in the pipeline
+         * @param deadline_ms deadline of each frame in msec, if not positive it is the time to
+         *                    read max_in_flight frames
+         */
+        RealTime(double fps, int max_in_flight, int deadline_ms): max_in_flight(max_in_flight) {
+            if (fps <= 0) fps = 25;
+            this->period = chrono::microseconds((long) (1000000.0 / fps));
+            if (deadline_ms > 0) this->deadline = chrono::microseconds((long) deadline_ms * 1000);
+            else this->deadline = this->period * max_in_flight;
+            this->in_flight = 0;
+            this->dropped = 0;
+            this->completed = 0;
+        }
+
+        /**
+         * @brief Waits until the next frame is available from the source
+         *
+         * @return the time at which the frame became available
+         */
+        TimePoint pace() {
+            if (!this->started) {
+                this->start = chrono::steady_clock::now();
+                this->started = true;
+            }
+            TimePoint arrival = this->start + this->period * this->ticks;
+            this->ticks++;
+            this_thread::sleep_until(arrival);
+            return arrival;
+        }
+
+        /**
+         * @brief Decides if a frame read by the reader can enter the pipeline. The frame is dropped if
+         *        the reader is so late that the frame is already stale or if the pipeline is full
+         *
+         * @param arrival time at which the frame became available
+         * @return true if the frame must be submitted, false if it is dropped
+         */
+        bool admit(TimePoint arrival) {
+            if (this->expired(arrival) || this->in_flight >= this->max_in_flight) {
+                this->dropped++;
+                return false;
+            }
+            this->in_flight++;
+            return true;
+        }
+
+        /**
+         * @brief Tells if a frame has exceeded its deadline
+         *
+         * @param arrival time at which the frame became available
+         * @return true if the frame is stale
+         */
+        bool expired(TimePoint arrival) {
+            return chrono::steady_clock::now() > arrival + this->deadline;
+        }
+
+        /**
+         * @brief Drops a frame already in the pipeline because it exceeded its deadline
+         *
+         */
+        void drop() {
+            this->dropped++;
+            this->in_flight--;
+        }
+
+        /**
+         * @brief Records the end-to-end latency of a frame whose result is available
+         *
+         * @param arrival time at which the frame became available
+         */
+        void complete(TimePoint arrival) {
+            long usec = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - arrival).count();
+            {
+                unique_lock<mutex> lock(this->l);
+                (this->latencies).push_back(usec);
+            }
+            this->completed++;
+            this->in_flight--;
+        }
+
+        long get_dropped() {
+            return this->dropped;
+        }
+
+        /**
+         * @brief Prints the latency percentiles and the number of dropped frames
+         *
+         */
+        void print_report() {
+            unique_lock<mutex> lock(this->l);
+            sort((this->latencies).begin(), (this->latencies).end());
+            cout << "Real time frames completed: " << this->completed << ", dropped: " << this->dropped << endl;
+            cout << "End-to-end latency p50: " << this->percentile(50) << " usec, p99: " << this->percentile(99) <<
+                " usec, p99.9: " << this->percentile(99.9) << " usec" << endl;
+        }
+};
+
+#endif
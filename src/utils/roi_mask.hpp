@@ -0,0 +1,231 @@
+#ifndef ROI_MASK_HPP
+#define ROI_MASK_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Interval [begin, end) of columns of a row that are inside the region of interest
+ *
+ */
+struct Span {
+    int begin;
+    int end;
+};
+
+/**
+ * @brief Class that represents the region of interest of the frames as lists of spans for each row.
+ *        The mask is read from a file at startup, that can be an image (pixels different from 0 are
+ *        inside the region) or a text file with a polygon for each line in the format "x,y x,y x,y ...".
+ *        Without a file the region is the whole frame
+ *
+ */
+class RoiMask {
+
+    private:
+        int rows = 0;
+        int cols = 0;
+        long area = 0;
+        // Spans of the region for each row, used by smoothing and background subtraction
+        vector<vector<Span>> spans;
+        // Spans of the region enlarged by one pixel, used by greyscale conversion because
+        // smoothing needs the neighbours of each pixel
+        vector<vector<Span>> halo_spans;
+
+        /**
+         * @brief Reads the polygons from a text file and draws them on the mask
+         *
+         * @param filename name of the file
+         * @param mask matrix on which the polygons are drawn
+         * @return false if the file cannot be read
+         */
+        bool read_polygons(string filename, Mat & mask) {
+            ifstream file(filename);
+            if (!file.is_open()) return false;
+            vector<vector<Point>> polygons;
+            string line;
+            while (getline(file, line)) {
+                if (line.empty() || line[0] == '#') continue;
+                vector<Point> polygon;
+                stringstream ss(line);
+                string vertex;
+                while (ss >> vertex) {
+                    size_t comma = vertex.find(',');
+                    if (comma == string::npos) continue;
+                    polygon.push_back(Point(atoi(vertex.substr(0, comma).c_str()), atoi(vertex.substr(comma + 1).c_str())));
+                }
+                if (polygon.size() >= 3) polygons.push_back(polygon);
+            }
+            file.close();
+            fillPoly(mask, polygons, Scalar(255));
+            return true;
+        }
+
+        /**
+         * @brief Compiles a mask in a list of spans for each row
+         *
+         * @param mask CV_8U matrix where the pixels different from 0 are inside the region
+         * @param result vector where the spans are stored
+         */
+        void compile(Mat & mask, vector<vector<Span>> & result) {
+            result.assign(this->rows, vector<Span>());
+            for (int i=0; i<this->rows; i++) {
+                unsigned char * p = mask.ptr<unsigned char>(i);
+                int j = 0;
+                while (j < this->cols) {
+                    while (j < this->cols && p[j] == 0) j++;
+                    if (j == this->cols) break;
+                    int begin = j;
+                    while (j < this->cols && p[j] != 0) j++;
+                    result[i].push_back({begin, j});
+                }
+            }
+        }
+
+        /**
+         * @brief Enlarges the region of the mask by one pixel in each direction
+         *
+         * @param mask the mask to enlarge
+         * @return the enlarged mask
+         */
+        Mat dilate_mask(Mat & mask) {
+            Mat res = Mat(this->rows, this->cols, CV_8U, 0.0);
+            for (int i=0; i<this->rows; i++) {
+                unsigned char * r = res.ptr<unsigned char>(i);
+                for (int z=max(i-1, 0); z<=min(i+1, this->rows-1); z++) {
+                    unsigned char * p = mask.ptr<unsigned char>(z);
+                    for (int j=0; j<this->cols; j++) {
+                        if (p[j] != 0 || (j > 0 && p[j-1] != 0) || (j < this->cols-1 && p[j+1] != 0)) r[j] = 255;
+                    }
+                }
+            }
+            return res;
+        }
+
+        /**
+         * @brief Compiles the spans of the region and of its enlargement and computes the area
+         *
+         * @param mask CV_8U matrix where the pixels different from 0 are inside the region
+         */
+        void init(Mat & mask) {
+            this->compile(mask, this->spans);
+            Mat halo = this->dilate_mask(mask);
+            this->compile(halo, this->halo_spans);
+            for (int i=0; i<this->rows; i++) {
+                for (Span & s : this->spans[i]) this->area += s.end - s.begin;
+            }
+        }
+
+    public:
+
+        /**
+         * @brief Creates a region that covers the whole frame
+         *
+         */
+        RoiMask(int rows, int cols): rows(rows), cols(cols) {
+            this->spans.assign(rows, vector<Span>(1, {0, cols}));
+            this->halo_spans = this->spans;
+            this->area = (long) rows * cols;
+        }
+
+        /**
+         * @brief Creates the region reading it from a file
+         *
+         * @param filename image or text file with polygons
+         */
+        RoiMask(string filename, int rows, int cols): rows(rows), cols(cols) {
+            Mat mask = Mat(rows, cols, CV_8U, 0.0);
+            string extension = filename.substr(filename.find_last_of('.') + 1);
+            if (extension == "txt") {
+                if (!this->read_polygons(filename, mask)) cout << "Cannot read the region of interest from " << filename << endl;
+            }
+            else {
+                Mat image = imread(filename, IMREAD_GRAYSCALE);
+                if (image.empty()) cout << "Cannot read the region of interest from " << filename << endl;
+                else if (image.rows != rows || image.cols != cols) resize(image, mask, Size(cols, rows));
+                else mask = image;
+            }
+            this->init(mask);
+        }
+
+        /**
+         * @brief Creates the region of a frame downsampled by a factor, a pixel is inside if all the
+         *        pixels of its block in the full frame are inside
+         *
+         * @param fine the region of the full frame
+         * @param factor the downsampling factor, the rows and columns that do not fill a block are left out
+         */
+        RoiMask(const RoiMask & fine, int factor): rows(fine.rows / factor), cols(fine.cols / factor) {
+            Mat mask = Mat(this->rows, this->cols, CV_8U, 0.0);
+            for (int i=0; i<this->rows; i++) {
+                unsigned char * p = mask.ptr<unsigned char>(i);
+                for (int j=0; j<this->cols; j++) p[j] = 255;
+                // A block is left out as soon as one of its rows does not cover it
+                for (int z=i*factor; z<(i+1)*factor; z++) {
+                    int j = 0;
+                    for (const Span & s : fine.spans[z]) {
+                        for (; j<this->cols && (j + 1) * factor <= s.end; j++) {
+                            if (j * factor < s.begin) p[j] = 0;
+                        }
+                    }
+                    for (; j<this->cols; j++) p[j] = 0;
+                }
+            }
+            this->init(mask);
+        }
+
+        /**
+         * @brief Gets the spans of a row inside the region
+         *
+         * @param i index of the row
+         * @return the spans of the row
+         */
+        const vector<Span> & row_spans(int i) const {
+            return this->spans[i];
+        }
+
+        /**
+         * @brief Gets the spans of a row inside the region enlarged by one pixel
+         *
+         * @param i index of the row
+         * @return the spans of the row
+         */
+        const vector<Span> & row_halo_spans(int i) const {
+            return this->halo_spans[i];
+        }
+
+        /**
+         * @brief Gets the number of pixels inside the region
+         *
+         * @return the area of the region
+         */
+        long get_area() const {
+            return this->area;
+        }
+
+        /**
+         * @brief Gets the number of rows of the frames
+         *
+         * @return the rows
+         */
+        int get_rows() const {
+            return this->rows;
+        }
+
+        /**
+         * @brief Gets the number of columns of the frames
+         *
+         * @return the columns
+         */
+        int get_cols() const {
+            return this->cols;
+        }
+};
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef SEQ_GREYSCALE_CONVERTER_HPP
+#define SEQ_GREYSCALE_CONVERTER_HPP
+
 #include <iostream>
 #include "opencv2/opencv.hpp"
 #include <thread>
@@ -7,6 +10,8 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include "roi_mask.hpp"
+#include "latency_histogram.hpp"
 
 using namespace std;
 using namespace cv;
@@ -20,10 +25,11 @@ class GreyscaleConverterSeq {
     private:
         bool show = false;
         bool times = false;
+        RoiMask * roi; // region of interest of the frames
 
     public:
 
-        GreyscaleConverterSeq(bool show, bool times): show(show), times(times) {}
+        GreyscaleConverterSeq(RoiMask * roi, bool show, bool times): roi(roi), show(show), times(times) {}
 
         /**
          * @brief Get the avg intensity of pixel the black and white matrix
@@ -37,15 +43,39 @@ class GreyscaleConverterSeq {
             float * p = (float *) bn.data;
             float sum = 0;
             for(int i=0; i<bn.rows; i++) {
-                for (int j=0; j<bn.cols; j++) {
-                    sum = sum + p[i * bn.cols + j];
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        sum = sum + p[i * bn.cols + j];
+                    }
                 }
             }
-            float avg = (float) sum / bn.total();
+            float avg = (float) sum / roi->get_area();
             avg = round( avg * 100.0 ) / 100.0;
             return avg;
         }
 
+        /**
+         * @brief Sums the intensity of the pixels of the region of interest in a range of rows, used
+         *        to split the average intensity among threads
+         * 
+         * @param bn the black and white matrix
+         * @param begin first row
+         * @param end row after the last one
+         * @return the sum of the intensities
+         */
+        float sum_intensity(const Mat & bn, int begin, int end) {
+            float * p = (float *) bn.data;
+            float sum = 0;
+            for(int i=begin; i<end; i++) {
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        sum = sum + p[i * bn.cols + j];
+                    }
+                }
+            }
+            return sum;
+        }
+
         
         /**
          * @brief Converts a frames in black and white
@@ -55,28 +85,42 @@ class GreyscaleConverterSeq {
         Mat convert_to_greyscale(Mat frame) {
             auto start = std::chrono::high_resolution_clock::now();
             Mat gr = Mat(frame.rows, frame.cols, CV_32F);
+            convert_rows(frame, gr, 0, frame.rows);
+            StageHistograms::record(GREYSCALE, std::chrono::high_resolution_clock::now() - start);
+            if (this->show) {
+                imshow("Frame", gr);
+                waitKey(25);
+            }
+            return gr;
+        }
+
+        /**
+         * @brief Converts a range of rows of a frame in black and white, used to split the conversion
+         *        among threads
+         * 
+         * @param frame the frame to convert
+         * @param gr the greyscale matrix, already allocated, where the rows are written
+         * @param begin first row
+         * @param end row after the last one
+         */
+        void convert_rows(const Mat & frame, Mat & gr, int begin, int end) {
             float * p = (float *) frame.data;
             float r, g, b;
             float * gp = (float *) gr.data;
             int channels = frame.channels();
-            for(int i=0; i<frame.rows; i++) {
-                for (int j=0; j<frame.cols; j++) {
-                    r = (float) p[i * frame.cols * channels + j * channels];
-                    g = (float) p[i * frame.cols * channels + j * channels + 1];
-                    b = (float) p[i * frame.cols * channels + j * channels + 2];
-                    gp[i* frame.cols + j ] = (float) (r + g + b) / channels;
+            // Only the pixels of the region of interest and their neighbours are converted
+            for(int i=begin; i<end; i++) {
+                for (const Span & s : roi->row_halo_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        r = (float) p[i * frame.cols * channels + j * channels];
+                        g = (float) p[i * frame.cols * channels + j * channels + 1];
+                        b = (float) p[i * frame.cols * channels + j * channels + 2];
+                        gp[i* frame.cols + j ] = (float) (r + g + b) / channels;
+                    }
                 }
             }
-            if (this->times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times spent to convert to greyscale: " << usec << " usec" << endl;
-            }
-            if (this->show) {
-                imshow("Frame", gr);
-                waitKey(25);
-            }
-            return gr;
         }
 
-};
\ No newline at end of file
+};
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef SEQ_SMOOTHER_HPP
+#define SEQ_SMOOTHER_HPP
+
 #include <iostream>
 #include "opencv2/opencv.hpp"
 #include <thread>
@@ -7,6 +10,8 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include "roi_mask.hpp"
+#include "latency_histogram.hpp"
 
 using namespace std;
 using namespace cv;
@@ -16,9 +21,10 @@ class SmootherSeq {
         Mat m;
         bool show = false;
         bool times = false;
+        RoiMask * roi; // region of interest of the frames
 
     public:
-        SmootherSeq(Mat m, bool show, bool times): m(m), show(show), times(times) {}
+        SmootherSeq(Mat m, RoiMask * roi, bool show, bool times): m(m), roi(roi), show(show), times(times) {}
 
         /**
          * @brief Performs smoothing of a matrix given a filter.
@@ -28,36 +34,48 @@ class SmootherSeq {
         Mat smoothing() {
             auto start = std::chrono::high_resolution_clock::now();
             Mat res = Mat(m.rows, m.cols, CV_32F, 0.0);
+            smoothing_rows(res, 0, (this->m).rows);
+            StageHistograms::record(SMOOTHING, std::chrono::high_resolution_clock::now() - start);
+            if (show) {
+                imshow("Smoothing", res);
+                waitKey(25);
+            }
+            return res;
+        }
+
+        /**
+         * @brief Performs smoothing on a range of rows, used to split the smoothing among threads
+         * 
+         * @param res the result matrix, already allocated and set to 0, where the rows are written
+         * @param begin first row
+         * @param end row after the last one
+         */
+        void smoothing_rows(Mat & res, int begin, int end) {
             float * mp = (float *) res.data;
             float * sp = (float *) (this -> m).data;
-            for(int i=0; i<(this->m).rows; i++) {
-                for (int j=0; j<(this->m).cols; j++) { 
-                    int x = j-1;
-                    int y = i-1;
-                    int width = 3;
-                    int height = 3;
-                    // Check that the bounds of the 3x3 kernel do not exceed the frame size
-                    if (x >= 0 && y >= 0 && x + width < m.cols && y + height < m.rows) {
-                        for(int z=y; z<y+height; z++) {
-                            for (int k=x; k<x+width; k++) {
-                                mp[i * res.cols + j] = mp[i * res.cols + j] + (float) (sp[z * m.cols + k] / 9);
+            // Only the pixels of the region of interest are smoothed, the others are left to 0
+            for(int i=begin; i<end; i++) {
+                for (const Span & s : roi->row_spans(i)) {
+                    for (int j=s.begin; j<s.end; j++) { 
+                        int x = j-1;
+                        int y = i-1;
+                        int width = 3;
+                        int height = 3;
+                        // Check that the bounds of the 3x3 kernel do not exceed the frame size
+                        if (x >= 0 && y >= 0 && x + width < m.cols && y + height < m.rows) {
+                            for(int z=y; z<y+height; z++) {
+                                for (int k=x; k<x+width; k++) {
+                                    mp[i * res.cols + j] = mp[i * res.cols + j] + (float) (sp[z * m.cols + k] / 9);
+                                }
                             }
                         }
-                    }
-                    else {                            
-                        mp[i * res.cols + j] = sp[i * res.cols + j];
+                        else {                            
+                            mp[i * res.cols + j] = sp[i * res.cols + j];
+                        }
                     }
                 }
             }
-            if (times) {
-                auto duration = std::chrono::high_resolution_clock::now() - start;
-                auto usec = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-                cout << "Times passed for smoothing: " << usec << " usec" << endl;
-            }
-            if (show) {
-                imshow("Smoothing", res);
-                waitKey(25);
-            }
-            return res;
         }
-};
\ No newline at end of file
+};
+
+#endif
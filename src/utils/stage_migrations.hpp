@@ -0,0 +1,89 @@
+#ifndef STAGE_MIGRATIONS_HPP
+#define STAGE_MIGRATIONS_HPP
+
+#include <iostream>
+#include <atomic>
+#include <cmath>
+#include <sched.h>
+
+using namespace std;
+
+/**
+ * @brief Counts the handoffs of a frame from a stage to the next one and how many of them run the next
+ *        stage on another worker or on another core than the previous, where the data of the frame has to
+ *        cross the caches. Without mapping a worker can also be moved by the OS, so the two can differ
+ *
+ */
+class StageMigrations {
+
+    private:
+        static atomic<long> & handoffs() {
+            static atomic<long> n(0);
+            return n;
+        }
+
+        static atomic<long> & worker_changes() {
+            static atomic<long> n(0);
+            return n;
+        }
+
+        static atomic<long> & migrations() {
+            static atomic<long> n(0);
+            return n;
+        }
+
+    public:
+
+        /**
+         * @brief Gets the core running the calling thread
+         *
+         * @return the index of the core, -1 if it is not known
+         */
+        static int current_core() {
+            return sched_getcpu();
+        }
+
+        /**
+         * @brief Records the start of a stage of a frame
+         *
+         * @param from_worker worker that ran the previous stage, -1 for the first stage, that is not counted
+         * @param to_worker worker that runs the stage
+         * @param from_core core that ran the previous stage, -1 if it is not known
+         * @param to_core core that runs the stage
+         */
+        static void record(int from_worker, int to_worker, int from_core, int to_core) {
+            if (from_worker < 0) return;
+            handoffs()++;
+            if (from_worker != to_worker) worker_changes()++;
+            if (from_core >= 0 && to_core >= 0 && from_core != to_core) migrations()++;
+        }
+
+        static long get_handoffs() {
+            return handoffs();
+        }
+
+        static long get_worker_changes() {
+            return worker_changes();
+        }
+
+        static long get_migrations() {
+            return migrations();
+        }
+
+        /**
+         * @brief Prints how many stage handoffs crossed cores
+         *
+         */
+        static void print_report() {
+            long h = handoffs();
+            long w = worker_changes();
+            long m = migrations();
+            cout << "Stage handoffs: " << h << ", on another worker: " << w;
+            if (h > 0) cout << " (" << round(10000.0 * w / h) / 100 << "%)";
+            cout << ", on another core: " << m;
+            if (h > 0) cout << " (" << round(10000.0 * m / h) / 100 << "%)";
+            cout << endl;
+        }
+};
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef SYNTHETIC_SOURCE_HPP
+#define SYNTHETIC_SOURCE_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Parameters of the synthetic video, given as a specification in place of the video file:
+ *        synthetic:WIDTHxHEIGHT,frames=N,noise=A,objects=N,size=PX,speed=PX,seed=N,fps=F,truth=FILE
+ *        where every field after the resolution is optional
+ *
+ */
+struct SyntheticParams {
+    int cols = 640;
+    int rows = 480;
+    int frames = 300;
+    float noise = 0.02; // amplitude of the uniform noise added to each pixel
+    int objects = 3; // number of moving objects
+    int size = 48; // side of the objects in pixels
+    int speed = 4; // pixels travelled by the objects at each frame
+    unsigned int seed = 1;
+    double fps = 25;
+    string truth = ""; // file where the ground truth labels are written, none if empty
+};
+
+/**
+ * @brief Ground truth of a synthetic frame
+ *
+ */
+struct MotionLabel {
+    int frame;
+    long moving_pixels; // pixels covered by the objects, that differ from the background
+    float moving_fraction; // moving pixels over the pixels of the frame
+};
+
+/**
+ * @brief Class that generates a deterministic video with moving squares over a textured background,
+ *        without I/O and decoding. Each frame is a copy of the background with the objects drawn
+ *        on it and noise taken from a table at an offset that depends on the frame, so the frames
+ *        are produced faster than any stage consumes them. The first frame, used as background by
+ *        the pipelines, never contains objects
+ *
+ */
+class SyntheticSource {
+
+    private:
+        struct Object {
+            float x0, y0; // position at frame 0
+            float vx, vy; // velocity in pixels per frame
+            int first; // first frame in which the object is visible
+            int last; // last frame in which the object is visible
+            float value; // intensity of the object
+        };
+
+        static const int NOISE_TABLE = 1 << 16;
+
+        SyntheticParams params;
+        bool luma;
+        int frame_number = 0;
+        bool released = false;
+        uint32_t state;
+        Mat background;
+        vector<float> noise;
+        vector<Object> objects;
+        vector<MotionLabel> labels;
+
+        /**
+         * @brief Gets the next value of the generator, xorshift seeded by the parameters
+         *
+         * @return a value in [0,1)
+         */
+        float random() {
+            this->state ^= this->state << 13;
+            this->state ^= this->state >> 17;
+            this->state ^= this->state << 5;
+            return (float) (this->state >> 8) / (float) (1 << 24);
+        }
+
+        /**
+         * @brief Gets the position of a coordinate that bounces between 0 and limit
+         *
+         * @param p coordinate without bounces
+         * @param limit maximum value of the coordinate
+         * @return the coordinate after the bounces
+         */
+        static int bounce(float p, int limit) {
+            if (limit <= 0) return 0;
+            int period = 2 * limit;
+            int q = ((int) p) % period;
+            if (q < 0) q += period;
+            return (q <= limit) ? q : period - q;
+        }
+
+        /**
+         * @brief Parses the specification of the synthetic video
+         *
+         * @param spec the specification
+         * @return the parameters
+         */
+        static SyntheticParams parse(string spec) {
+            SyntheticParams p;
+            stringstream fields(spec.substr(strlen("synthetic:")));
+            string field;
+            while (getline(fields, field, ',')) {
+                size_t eq = field.find('=');
+                if (eq == string::npos) {
+                    // The resolution is the only field without a name
+                    size_t x = field.find('x');
+                    if (x != string::npos) {
+                        p.cols = max(atoi(field.substr(0, x).c_str()), 3);
+                        p.rows = max(atoi(field.substr(x + 1).c_str()), 3);
+                    }
+                    continue;
+                }
+                string key = field.substr(0, eq);
+                string value = field.substr(eq + 1);
+                if (key == "frames") p.frames = max(atoi(value.c_str()), 1);
+                else if (key == "noise") p.noise = max((float) atof(value.c_str()), 0.0f);
+                else if (key == "objects") p.objects = max(atoi(value.c_str()), 0);
+                else if (key == "size") p.size = max(atoi(value.c_str()), 1);
+                else if (key == "speed") p.speed = max(atoi(value.c_str()), 0);
+                else if (key == "seed") p.seed = (unsigned int) strtoul(value.c_str(), nullptr, 10);
+                else if (key == "fps") p.fps = max(atof(value.c_str()), 1.0);
+                else if (key == "truth") p.truth = value;
+                else cout << "Unknown field of the synthetic video: " << key << endl;
+            }
+            return p;
+        }
+
+        /**
+         * @brief Creates the background, the noise table and the trajectories of the objects
+         *
+         */
+        void prepare() {
+            int rows = this->params.rows;
+            int cols = this->params.cols;
+            // Smooth gradient with a mild texture, so that smoothing and comparison see varied values
+            this->background = Mat(rows, cols, CV_32F);
+            float * bp = (float *) (this->background).data;
+            for (int i=0; i<rows; i++) {
+                for (int j=0; j<cols; j++) {
+                    float texture = ((i / 8 + j / 8) % 2 == 0) ? 0.03 : -0.03;
+                    bp[i * cols + j] = 0.3 + 0.3 * ((float) (i + j) / (rows + cols)) + texture;
+                }
+            }
+            (this->noise).resize(NOISE_TABLE);
+            for (int i=0; i<NOISE_TABLE; i++) (this->noise)[i] = (2 * this->random() - 1) * this->params.noise;
+            int size = min(this->params.size, min(rows, cols));
+            for (int o=0; o<this->params.objects; o++) {
+                Object obj;
+                obj.x0 = this->random() * (cols - size);
+                obj.y0 = this->random() * (rows - size);
+                float angle = this->random() * 2 * CV_PI;
+                obj.vx = this->params.speed * cos(angle);
+                obj.vy = this->params.speed * sin(angle);
+                // Each object is visible for a window of frames, never in the first one
+                int span = max(this->params.frames - 1, 1);
+                obj.first = 1 + (int) (this->random() * span / 2);
+                obj.last = obj.first + (int) (this->random() * span / 2) + 1;
+                // The objects are clearly brighter or darker than the background
+                obj.value = (this->random() < 0.5) ? 0.05 : 0.95;
+                (this->objects).push_back(obj);
+            }
+        }
+
+    public:
+
+        /**
+         * @brief Tells if a video name is the specification of a synthetic video
+         *
+         * @param name the name given in place of the video file
+         * @return true if the frames must be generated
+         */
+        static bool is_spec(string name) {
+            return name.rfind("synthetic:", 0) == 0;
+        }
+
+        SyntheticSource(string spec, bool luma): params(parse(spec)), luma(luma) {
+            this->state = (this->params.seed != 0) ? this->params.seed : 0x9E3779B9;
+            this->prepare();
+        }
+
+        /**
+         * @brief Generates the next frame
+         *
+         * @param frame matrix where the frame is stored, CV_32FC3 or CV_32F in luma mode, values in [0,1]
+         * @return false if the frames are finished
+         */
+        bool next(Mat & frame) {
+            if (this->frame_number >= this->params.frames) return false;
+            int rows = this->params.rows;
+            int cols = this->params.cols;
+            int t = this->frame_number;
+            Mat grey = (this->background).clone();
+            float * gp = (float *) grey.data;
+
+            // Objects, the pixels they cover are the moving pixels of the frame
+            Mat covered = Mat::zeros(rows, cols, CV_8U);
+            int size = min(this->params.size, min(rows, cols));
+            for (const Object & o : this->objects) {
+                if (t < o.first || t > o.last) continue;
+                int x = bounce(o.x0 + o.vx * t, cols - size);
+                int y = bounce(o.y0 + o.vy * t, rows - size);
+                for (int i=y; i<y+size; i++) {
+                    for (int j=x; j<x+size; j++) gp[i * cols + j] = o.value;
+                }
+                covered(Rect(x, y, size, size)).setTo(1);
+            }
+            long moving = countNonZero(covered);
+
+            // Noise from the table, starting at an offset that changes at each frame
+            if (this->params.noise > 0) {
+                long n = (long) rows * cols;
+                uint32_t offset = (uint32_t) t * 2654435761u;
+                const float * np = (this->noise).data();
+                for (long i=0; i<n; i++) {
+                    float v = gp[i] + np[(i + offset) & (NOISE_TABLE - 1)];
+                    gp[i] = min(max(v, 0.0f), 1.0f);
+                }
+            }
+
+            if (this->luma) frame = grey;
+            else {
+                Mat channels[3] = {grey, grey, grey};
+                merge(channels, 3, frame);
+            }
+            (this->labels).push_back({t, moving, (float) moving / ((long) rows * cols)});
+            this->frame_number++;
+            return true;
+        }
+
+        double get_fps() {
+            return this->params.fps;
+        }
+
+        /**
+         * @brief Gets the ground truth of the frames generated until now
+         *
+         * @return a label for each frame
+         */
+        const vector<MotionLabel> & get_labels() {
+            return this->labels;
+        }
+
+        /**
+         * @brief Prints a summary of the ground truth and writes the labels in the truth file, if given
+         *
+         */
+        void release() {
+            if (this->released) return;
+            this->released = true;
+            long with_motion = 0;
+            for (const MotionLabel & l : this->labels) if (l.moving_pixels > 0) with_motion++;
+            cout << "Synthetic video: " << (this->labels).size() << " frames generated, " << with_motion << " with moving objects" << endl;
+            if ((this->params).truth.empty()) return;
+            ofstream file;
+            file.open((this->params).truth);
+            file << "frame,moving_pixels,moving_fraction" << endl;
+            for (const MotionLabel & l : this->labels) file << l.frame << "," << l.moving_pixels << "," << l.moving_fraction << endl;
+            file.close();
+        }
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef TEMPORAL_MEDIAN_HPP
+#define TEMPORAL_MEDIAN_HPP
+
+#include <vector>
+#include <algorithm>
+#include "opencv2/opencv.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Per pixel median of a set of frames, used to build a background that ignores the objects
+ *        moving in some of them. The rows are processed in tiles of columns: the values of a tile are
+ *        copied in a small buffer, one row per frame, and for an odd number of frames up to 9 a fixed
+ *        selection network is applied on whole rows of the buffer, so that every compare and swap is a
+ *        vectorizable min/max over the tile. Other numbers of frames sort the values of each pixel
+ *
+ */
+class TemporalMedian {
+
+    private:
+        static const int TILE = 256; // columns of a tile, the buffer of 9 frames stays in L1
+
+        /**
+         * @brief Gets the selection network that moves the median of n values to position n / 2
+         *
+         * @param n number of values
+         * @param size where the number of compare and swap operations is stored
+         * @return the pairs of positions to compare and swap, nullptr if there is no network for n
+         */
+        static const int (*network(int n, int & size))[2] {
+            static const int med3[][2] = {{0, 1}, {1, 2}, {0, 1}};
+            static const int med5[][2] = {{0, 1}, {3, 4}, {0, 3}, {1, 4}, {1, 2}, {2, 3}, {1, 2}};
+            static const int med7[][2] = {{0, 5}, {0, 3}, {1, 6}, {2, 4}, {0, 1}, {3, 5}, {2, 6}, {2, 3}, {3, 6},
+                {4, 5}, {1, 4}, {1, 3}, {3, 4}};
+            static const int med9[][2] = {{1, 2}, {4, 5}, {7, 8}, {0, 1}, {3, 4}, {6, 7}, {1, 2}, {4, 5}, {7, 8},
+                {0, 3}, {5, 8}, {4, 7}, {3, 6}, {1, 4}, {2, 5}, {4, 7}, {4, 2}, {6, 4}, {4, 2}};
+            switch (n) {
+                case 3: size = 3; return med3;
+                case 5: size = 7; return med5;
+                case 7: size = 13; return med7;
+                case 9: size = 19; return med9;
+                default: size = 0; return nullptr;
+            }
+        }
+
+        /**
+         * @brief Gets the median of some values, the mean of the two central ones if they are even
+         *
+         * @param v the values, they are reordered
+         * @param n number of values
+         * @return the median
+         */
+        static float select(float * v, int n) {
+            float * mid = v + n / 2;
+            nth_element(v, mid, v + n);
+            if (n % 2 == 1) return *mid;
+            return (*max_element(v, mid) + *mid) / 2;
+        }
+
+    public:
+
+        /**
+         * @brief Computes the median of a row of the frames
+         *
+         * @param rows pointers to the same row of each frame
+         * @param n number of frames
+         * @param out row where the median is written
+         * @param cols number of columns of the row
+         */
+        static void median_row(const float * const * rows, int n, float * out, int cols) {
+            if (n == 1) {
+                copy(rows[0], rows[0] + cols, out);
+                return;
+            }
+            int size;
+            const int (*net)[2] = network(n, size);
+            vector<float> buf(n * TILE);
+            for (int c=0; c<cols; c+=TILE) {
+                int w = min(TILE, cols - c);
+                if (net != nullptr) {
+                    for (int f=0; f<n; f++) copy(rows[f] + c, rows[f] + c + w, buf.data() + f * TILE);
+                    // Each compare and swap puts the minimum in the first row and the maximum in the second
+                    for (int s=0; s<size; s++) {
+                        float * a = buf.data() + net[s][0] * TILE;
+                        float * b = buf.data() + net[s][1] * TILE;
+                        for (int j=0; j<w; j++) {
+                            float lo = min(a[j], b[j]);
+                            float hi = max(a[j], b[j]);
+                            a[j] = lo;
+                            b[j] = hi;
+                        }
+                    }
+                    copy(buf.data() + (n / 2) * TILE, buf.data() + (n / 2) * TILE + w, out + c);
+                }
+                else {
+                    for (int j=0; j<w; j++) {
+                        for (int f=0; f<n; f++) buf[f] = rows[f][c + j];
+                        out[c + j] = select(buf.data(), n);
+                    }
+                }
+            }
+        }
+
+        /**
+         * @brief Computes the median of a range of rows of the frames, used to split it among threads
+         *
+         * @param frames the frames, greyscale and of the same size
+         * @param out the median, already allocated, where the rows are written
+         * @param begin first row
+         * @param end row after the last one
+         */
+        static void median_rows(const vector<Mat> & frames, Mat & out, int begin, int end) {
+            int n = frames.size();
+            vector<const float *> rows(n);
+            for (int i=begin; i<end; i++) {
+                for (int f=0; f<n; f++) rows[f] = frames[f].ptr<float>(i);
+                median_row(rows.data(), n, out.ptr<float>(i), out.cols);
+            }
+        }
+};
+
+#endif
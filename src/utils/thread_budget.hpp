@@ -0,0 +1,112 @@
+#ifndef THREAD_BUDGET_HPP
+#define THREAD_BUDGET_HPP
+
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+using namespace std;
+
+/**
+ * @brief Class that splits a total thread budget between the decoder threads of the video backend
+ *        and the workers of the pipeline. When mapping is used the decoder gets the first cores
+ *        and the workers the following ones, so that they do not compete for the same cores
+ *
+ */
+class ThreadBudget {
+
+    private:
+        int decoder = 0; // 0 means that the backend default is used
+        int workers = 1;
+        int total = 0;
+
+    public:
+
+        /**
+         * @brief Creates the split of the threads
+         *
+         * @param total total number of threads specified with -threads, -1 if not specified
+         * @param decoder number of decoder threads specified with -decthreads, -1 if not specified
+         * @param nw number of workers specified with -nw, used if the total is not specified
+         */
+        ThreadBudget(int total, int decoder, int nw) {
+            if (total == 1) {
+                // A single thread cannot be split, it is the worker and the decoder uses the backend default
+                this->decoder = 0;
+                this->workers = 1;
+            }
+            else if (total > 1) {
+                // By default a quarter of the budget goes to the decoder
+                if (decoder <= 0) decoder = max(1, total / 4);
+                this->decoder = min(decoder, total - 1);
+                this->workers = max(1, total - this->decoder);
+            }
+            else {
+                this->decoder = max(decoder, 0);
+                this->workers = nw;
+            }
+            this->total = this->decoder + this->workers;
+        }
+
+        int get_decoder_threads() {
+            return this->decoder;
+        }
+
+        int get_workers() {
+            return this->workers;
+        }
+
+        /**
+         * @brief Gets the core on which the i-th worker has to be mapped, after the decoder cores
+         *
+         * @param i index of the worker
+         * @return the index of the core
+         */
+        int worker_cpu(int i) {
+            int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
+            return (this->decoder + i) % numCPU;
+        }
+
+        /**
+         * @brief Gets the list of cores for the FastFlow thread mapper, which assigns its entries to the
+         *        nodes in the order they are started. The nodes before the workers (the emitter that
+         *        reads the frames, then the master if any) and the ones after them (the collector)
+         *        stay on the decoder cores, so the emitter keeps the cores given by pin_reader and no
+         *        node wraps around onto the core of a worker
+         *
+         * @param before number of nodes started before the workers, the emitter included
+         * @param after number of nodes started after the workers
+         * @return a string with the cores separated by commas
+         */
+        string fastflow_mapping(int before, int after) {
+            int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
+            int decoder = max(this->decoder, 1);
+            string list = "";
+            for (int i=0; i<before + this->workers + after; i++) {
+                if (i > 0) list += ",";
+                if (i < before) list += to_string((i % decoder) % numCPU);
+                else if (i < before + this->workers) list += to_string(this->worker_cpu(i - before));
+                else list += to_string(((i - this->workers) % decoder) % numCPU);
+            }
+            return list;
+        }
+
+        /**
+         * @brief Maps the calling thread on the decoder cores. It must be called before opening the
+         *        video, because the decoder threads inherit the affinity of the thread that creates them
+         *
+         */
+        void pin_reader() {
+            if (this->decoder <= 0) return;
+            int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            for (int i=0; i<this->decoder; i++) CPU_SET(i%numCPU, &cpuset);
+            int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+            if (rc != 0) cout << "Cannot map the reader on the decoder cores" << endl;
+        }
+};
+
+#endif
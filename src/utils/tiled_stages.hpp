@@ -0,0 +1,204 @@
+#ifndef TILED_STAGES_HPP
+#define TILED_STAGES_HPP
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "roi_mask.hpp"
+#include "motion_mask.hpp"
+#include "background_builder.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Runs the three stages on a tile of a frame before moving to the next one, instead of each stage
+ *        on the whole frame. A tile is a band of full rows sized so that its frame rows, its greyscale rows
+ *        and the background rows fit in the L2 cache: at 4K a greyscale frame is 33 MB, so between the stages
+ *        of the full frame approach every pixel goes back to memory, while the greyscale rows of a tile are
+ *        smoothed and compared while they are still in cache. The greyscale rows above and below the tile are
+ *        converted again as its halo. The results are the same as the ones of the full frame stages, and the
+ *        tiles of a frame are independent, so they can be run by different threads
+ *
+ */
+class TiledStages {
+
+    private:
+        RoiMask * roi; // region of interest of the frames
+        int tile_rows; // rows of a tile, 0 to size them from the frames
+        Mat background;
+        float threshold;
+        BackgroundBuilder * builder; // the background is taken from it at the first tile, nullptr if it is given
+        atomic<bool> ready;
+        mutex l;
+
+        /**
+         * @brief Takes the background from the builder, at the first tile
+         *
+         */
+        void prepare() {
+            if (this->ready) return;
+            unique_lock<mutex> lock(this->l);
+            if (this->ready) return;
+            (this->builder)->wait_ready();
+            this->background = (this->builder)->get_background();
+            this->threshold = (this->builder)->get_threshold();
+            this->ready = true;
+        }
+
+    public:
+        // Cache taken by a tile, half of the L2 of most cores so that the tile is not evicted by the prefetches
+        static const long CACHE_BUDGET = 512 * 1024;
+
+        TiledStages(Mat background, float threshold, RoiMask * roi, int tile_rows = 0):
+            roi(roi), tile_rows(max(tile_rows, 0)), background(background), threshold(threshold), builder(nullptr) {
+            this->ready = true;
+        }
+
+        /**
+         * @brief Creates the stages of a background prepared in parallel, the tiles run before it is ready
+         *        wait for it
+         *
+         */
+        TiledStages(BackgroundBuilder * builder, RoiMask * roi, int tile_rows = 0):
+            roi(roi), tile_rows(max(tile_rows, 0)), threshold(0), builder(builder) {
+            this->ready = false;
+        }
+
+        /**
+         * @brief Computes the rows of a tile that fit in the cache budget, at least 8 so that the two halo
+         *        rows cost at most a fifth of the greyscale conversion
+         *
+         * @param cols columns of the frames
+         * @param channels channels of the frames, 1 in luma mode
+         * @return the number of rows
+         */
+        static int fit_rows(int cols, int channels) {
+            // A row of a tile reads the frame and the background and writes the greyscale row
+            long row_bytes = (long) cols * sizeof(float) * (channels + ((channels > 1) ? 2 : 1));
+            return max(8, (int) (CACHE_BUDGET / max(row_bytes, 1L)));
+        }
+
+        /**
+         * @brief Gets the rows of the tiles of a frame
+         *
+         * @param frame the frame
+         * @return the number of rows of a tile
+         */
+        int get_tile_rows(const Mat & frame) const {
+            return (this->tile_rows > 0) ? this->tile_rows : fit_rows(frame.cols, frame.channels());
+        }
+
+        /**
+         * @brief Gets the number of tiles of a frame
+         *
+         * @param frame the frame
+         * @return the number of tiles
+         */
+        int tiles(const Mat & frame) const {
+            int r = this->get_tile_rows(frame);
+            return (frame.rows + r - 1) / r;
+        }
+
+        /**
+         * @brief Converts a tile in greyscale, smooths it and compares it with the background
+         *
+         * @param frame the frame, BGR or greyscale in luma mode
+         * @param t the index of the tile
+         * @param mask where the bits of the different pixels of the tile are set, nullptr if it is not needed;
+         *        it must have the size of the frame and the rows of the tile clear
+         * @return the number of different pixels of the tile
+         */
+        long run_tile(const Mat & frame, int t, MotionMask * mask = nullptr) {
+            this->prepare();
+            int rows = frame.rows;
+            int cols = frame.cols;
+            int channels = frame.channels();
+            int r = this->get_tile_rows(frame);
+            int begin = t * r;
+            int end = min(begin + r, rows);
+            // Greyscale rows of the tile and of its halo, the buffers are kept by the thread between the tiles
+            int first = max(begin - 1, 0);
+            int last = min(end + 1, rows);
+            static thread_local vector<float> grey;
+            static thread_local vector<float> smoothed;
+            static thread_local MotionMask row_mask;
+            if (channels > 1) {
+                grey.resize((size_t) (last - first) * cols);
+                for (int z=first; z<last; z++) {
+                    const float * p = frame.ptr<float>(z);
+                    float * g = grey.data() + (size_t) (z - first) * cols;
+                    for (const Span & s : (this->roi)->row_halo_spans(z)) {
+                        for (int j=s.begin; j<s.end; j++) {
+                            g[j] = (p[j * channels] + p[j * channels + 1] + p[j * channels + 2]) / channels;
+                        }
+                    }
+                }
+            }
+            // In luma mode the frame is already in greyscale
+            auto grey_row = [&](int z) -> const float * {
+                return (channels > 1) ? grey.data() + (size_t) (z - first) * cols : frame.ptr<float>(z);
+            };
+            smoothed.resize(cols);
+            if (mask == nullptr && row_mask.get_cols() != cols) row_mask.resize(1, cols);
+
+            long cnt = 0;
+            for (int i=begin; i<end; i++) {
+                const vector<Span> & spans = (this->roi)->row_spans(i);
+                if (spans.empty()) continue;
+                // Same kernel and order of the sums of the full frame smoother, so the results are the same
+                bool inner_row = i >= 1 && i + 2 < rows;
+                const float * up = inner_row ? grey_row(i - 1) : nullptr;
+                const float * mid = grey_row(i);
+                const float * down = inner_row ? grey_row(i + 1) : nullptr;
+                for (const Span & s : spans) {
+                    for (int j=s.begin; j<s.end; j++) {
+                        if (inner_row && j >= 1 && j + 2 < cols) {
+                            smoothed[j] = up[j - 1] / 9 + up[j] / 9 + up[j + 1] / 9 + mid[j - 1] / 9 + mid[j] / 9 +
+                                mid[j + 1] / 9 + down[j - 1] / 9 + down[j] / 9 + down[j + 1] / 9;
+                        }
+                        else smoothed[j] = mid[j];
+                    }
+                }
+                const float * pb = (this->background).ptr<float>(i);
+                if (mask != nullptr) mask->compare_row(i, smoothed.data(), pb, this->threshold, spans);
+                else {
+                    row_mask.compare_row(0, smoothed.data(), pb, this->threshold, spans);
+                    cnt += row_mask.count_rows(0, 1);
+                    row_mask.clear_rows(0, 1);
+                }
+            }
+            if (mask != nullptr) cnt = mask->count_rows(begin, end);
+            return cnt;
+        }
+
+        /**
+         * @brief Runs all the tiles of a frame in the calling thread
+         *
+         * @param frame the frame, BGR or greyscale in luma mode
+         * @param mask where the mask of the different pixels is stored, nullptr if it is not needed
+         * @return the fraction of different pixels over the area of the region of interest
+         */
+        float run(const Mat & frame, MotionMask * mask = nullptr) {
+            if (mask != nullptr) {
+                if (mask->get_rows() != frame.rows || mask->get_cols() != frame.cols) mask->resize(frame.rows, frame.cols);
+                else mask->clear_rows(0, frame.rows);
+            }
+            long cnt = 0;
+            int n = this->tiles(frame);
+            for (int t=0; t<n; t++) cnt += this->run_tile(frame, t, mask);
+            return (float) cnt / (this->roi)->get_area();
+        }
+
+        /**
+         * @brief Gets the area of the region of interest, the fraction of a frame is its count over it
+         *
+         * @return the number of pixels
+         */
+        long get_area() const {
+            return (this->roi)->get_area();
+        }
+};
+
+#endif
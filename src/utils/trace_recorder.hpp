@@ -0,0 +1,201 @@
+#ifndef TRACE_RECORDER_HPP
+#define TRACE_RECORDER_HPP
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "latency_histogram.hpp"
+
+using namespace std;
+
+/**
+ * @brief Event of the timeline, the names are static strings so that recording does not allocate
+ *
+ */
+struct TraceEvent {
+    const char * name;
+    const char * category;
+    char phase; // 'X' for an interval, 'C' for a counter sample
+    int64_t ts_ns; // start of the event from the beginning of the trace
+    int64_t dur_ns; // duration of an interval
+    long arg; // frame number of an interval, value of a counter
+};
+
+/**
+ * @brief Class that records a timeline of the execution: each thread appends its events to its own
+ *        buffer, without locks, and the buffers are written at exit in the Chrome Trace Event format,
+ *        that can be opened in Perfetto or chrome://tracing
+ *
+ */
+class TraceRecorder {
+
+    private:
+        struct ThreadBuffer {
+            vector<TraceEvent> events;
+            string name = "";
+        };
+
+        static mutex & lock() {
+            static mutex l;
+            return l;
+        }
+
+        // The buffers are owned by the registry so that they outlive their threads
+        static vector<unique_ptr<ThreadBuffer>> & registry() {
+            static vector<unique_ptr<ThreadBuffer>> buffers;
+            return buffers;
+        }
+
+        static string & filename() {
+            static string f = "";
+            return f;
+        }
+
+        static chrono::steady_clock::time_point & origin() {
+            static chrono::steady_clock::time_point o = chrono::steady_clock::now();
+            return o;
+        }
+
+        /**
+         * @brief Gets the buffer of the calling thread, registering it the first time
+         *
+         * @return the buffer of the thread
+         */
+        static ThreadBuffer & local() {
+            thread_local ThreadBuffer * buffer = nullptr;
+            if (buffer == nullptr) {
+                unique_lock<mutex> l(lock());
+                registry().push_back(make_unique<ThreadBuffer>());
+                buffer = registry().back().get();
+                (buffer->events).reserve(1 << 16);
+            }
+            return *buffer;
+        }
+
+    public:
+
+        /**
+         * @brief Enables the recording, it must be called before the threads start
+         *
+         * @param file name of the JSON file written at exit
+         */
+        static void enable(string file) {
+            filename() = file;
+            origin() = chrono::steady_clock::now();
+        }
+
+        static bool is_enabled() {
+            return !filename().empty();
+        }
+
+        /**
+         * @brief Gets the time from the beginning of the trace
+         *
+         * @return the time in nsec
+         */
+        static int64_t now() {
+            return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin()).count();
+        }
+
+        /**
+         * @brief Gives a name to the calling thread in the timeline
+         *
+         * @param name the name of the thread
+         */
+        static void name_thread(string name) {
+            if (!is_enabled()) return;
+            local().name = name;
+        }
+
+        /**
+         * @brief Records an interval of the calling thread
+         *
+         * @param name name of the interval
+         * @param category category of the interval
+         * @param start start of the interval in nsec
+         * @param end end of the interval in nsec
+         * @param frame frame processed in the interval
+         */
+        static void interval(const char * name, const char * category, int64_t start, int64_t end, long frame) {
+            local().events.push_back({name, category, 'X', start, end - start, frame});
+        }
+
+        /**
+         * @brief Records a sample of a counter, such as the length of a queue
+         *
+         * @param name name of the counter
+         * @param value value of the counter
+         */
+        static void counter(const char * name, long value) {
+            if (!is_enabled()) return;
+            local().events.push_back({name, "queue", 'C', now(), 0, value});
+        }
+
+        /**
+         * @brief Writes the events of all the threads, it must be called when the threads have finished
+         *
+         */
+        static void write() {
+            if (!is_enabled()) return;
+            unique_lock<mutex> l(lock());
+            ofstream file;
+            file.open(filename());
+            file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << endl;
+            bool first = true;
+            long total = 0;
+            file << fixed << setprecision(3);
+            for (size_t tid=0; tid<registry().size(); tid++) {
+                ThreadBuffer & b = *registry()[tid];
+                if (!b.name.empty()) {
+                    file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid <<
+                        ",\"args\":{\"name\":\"" << b.name << "\"}}";
+                    first = false;
+                }
+                for (const TraceEvent & e : b.events) {
+                    file << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category <<
+                        "\",\"ph\":\"" << e.phase << "\",\"ts\":" << e.ts_ns / 1000.0 << ",\"pid\":1,\"tid\":" << tid;
+                    if (e.phase == 'X') file << ",\"dur\":" << e.dur_ns / 1000.0 << ",\"args\":{\"frame\":" << e.arg << "}}";
+                    else file << ",\"args\":{\"value\":" << e.arg << "}}";
+                    first = false;
+                    total++;
+                }
+            }
+            file << "\n]}" << endl;
+            file.close();
+            cout << "Trace with " << total << " events written in " << filename() << endl;
+        }
+};
+
+/**
+ * @brief Records the interval between its construction and its destruction, it does nothing if the
+ *        trace is not enabled
+ *
+ */
+class TraceScope {
+
+    private:
+        const char * name;
+        const char * category;
+        long frame;
+        int64_t start = -1;
+
+    public:
+
+        TraceScope(const char * name, const char * category, long frame): name(name), category(category), frame(frame) {
+            if (TraceRecorder::is_enabled()) this->start = TraceRecorder::now();
+        }
+
+        TraceScope(Stage stage, long frame): TraceScope(StageHistograms::stage_name(stage), "stage", frame) {}
+
+        ~TraceScope() {
+            if (this->start >= 0) TraceRecorder::interval(this->name, this->category, this->start, TraceRecorder::now(), this->frame);
+        }
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef VERDICT_HPP
+#define VERDICT_HPP
+
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+class MotionMask;
+
+/**
+ * @brief Result of the analysis of a frame
+ *
+ */
+struct Verdict {
+    int frame; // number of the frame in the video, the background is not numbered
+    float fraction; // fraction of the pixels of the region of interest different from the background
+    bool motion; // true if the fraction exceeds the percentage required to detect a movement
+    // Pixels different from the background when the masks are kept, nullptr otherwise and for the frames
+    // decided downsampled
+    shared_ptr<const MotionMask> mask = nullptr;
+};
+
+// Function called for each frame analyzed, possibly from the threads of the pipeline
+typedef function<void(const Verdict &)> VerdictCallback;
+
+#endif
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <cstdint>
+#include "../src/utils/latency_histogram.hpp"
+
+using namespace std;
+
+/**
+ * @brief Checks a percentile of a histogram
+ *
+ * @param h the histogram
+ * @param p the percentile
+ * @param expected the expected value
+ * @return true if the check passed
+ */
+bool check(const LatencyHistogram & h, double p, uint64_t expected) {
+    uint64_t v = h.percentile(p);
+    bool ok = v == expected;
+    cout << (ok ? "ok" : "FAIL") << ": p" << p << " is " << v << ", expected " << expected << endl;
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    // Values below 16 ns have a bucket each, so their percentiles are exact
+    LatencyHistogram small;
+    for (uint64_t v=8; v<16; v++) small.record(v);
+    ok = check(small, 0, 8) && ok;
+    ok = check(small, 50, 11) && ok;
+    ok = check(small, 100, 15) && ok;
+    for (uint64_t v=8; v<16; v++) {
+        LatencyHistogram one;
+        one.record(v);
+        ok = check(one, 50, v) && ok;
+    }
+    // Above 16 ns a value is reported at the middle of its bucket, within 12.5%
+    LatencyHistogram large;
+    large.record(16);
+    large.record(1000);
+    // 16 and 17 share a bucket
+    ok = check(large, 0, 17) && ok;
+    uint64_t v = large.percentile(100);
+    bool near = v >= 875 && v <= 1000;
+    cout << (near ? "ok" : "FAIL") << ": p100 is " << v << ", expected within 12.5% of 1000" << endl;
+    ok = near && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include "opencv2/opencv.hpp"
+#include "../src/utils/roi_mask.hpp"
+#include "../src/utils/half_float.hpp"
+#include "../src/utils/motion_mask.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Prints the result of a check
+ *
+ * @param ok the result
+ * @param what what has been checked
+ * @return the result
+ */
+bool check(bool ok, string what) {
+    cout << (ok ? "ok" : "FAIL") << ": " << what << endl;
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    // Values that are exact in half floats, so the two comparisons must give the same mask; the columns
+    // are not a multiple of 64 so that the rows end in the middle of a word
+    int rows = 50;
+    int cols = 150;
+    Mat background = Mat(rows, cols, CV_32F, 0.25);
+    Mat frame = background.clone();
+    for (int i=10; i<20; i++) {
+        for (int j=70; j<140; j++) frame.at<float>(i, j) = 0.75;
+    }
+    frame.at<float>(30, 3) = 0.5;
+    RoiMask roi(rows, cols);
+    MotionMask full;
+    MotionMask half;
+    long cnt = full.compare(frame, background, 0.1, roi);
+    long cnt_half = half.compare(HalfFloat::to_half(frame), HalfFloat::to_half(background), 0.1, roi);
+    ok = check(cnt == 10 * 70 + 1, "FP32 comparison counts " + to_string(cnt) + " pixels, expected 701") && ok;
+    ok = check(cnt_half == cnt, "half float comparison counts " + to_string(cnt_half) + " pixels") && ok;
+    bool same = true;
+    for (int i=0; i<rows; i++) {
+        for (int j=0; j<cols; j++) same = same && full.get(i, j) == half.get(i, j);
+    }
+    ok = check(same, "half float mask equal to the FP32 one") && ok;
+    Rect r = full.bounding_box();
+    ok = check(r.x == 3 && r.y == 10 && r.width == 137 && r.height == 21, "bounding box " + to_string(r.x) + "," + to_string(r.y) +
+        " " + to_string(r.width) + "x" + to_string(r.height) + ", expected 3,10 137x21") && ok;
+    full.compare(background, background, 0.1, roi);
+    ok = check(full.bounding_box().width == 0, "empty mask has an empty bounding box") && ok;
+    return ok ? 0 : 1;
+}
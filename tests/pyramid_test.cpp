@@ -0,0 +1,60 @@
+#include <iostream>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "../src/utils/pyramid.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Creates a frame of pseudo random pixels, with edges that the smoothing blurs
+ *
+ * @param rows rows of the frame
+ * @param cols columns of the frame
+ * @param channels 3 for a BGR frame, 1 for a frame read in luma mode
+ * @param seed seed of the pixels
+ * @return the frame, CV_32F in [0,1]
+ */
+Mat make_frame(int rows, int cols, int channels, unsigned seed) {
+    Mat m = Mat(rows, cols, (channels > 1) ? CV_32FC3 : CV_32F);
+    float * p = (float *) m.data;
+    unsigned x = seed;
+    for (long i=0; i<(long) rows * cols * channels; i++) {
+        x = x * 1664525 + 1013904223;
+        p[i] = (float) (x >> 8) / (1 << 24);
+    }
+    return m;
+}
+
+/**
+ * @brief Checks that a frame equal to the background has no different pixels in the coarse analysis
+ *
+ * @param channels channels of the frames
+ * @param factor downsampling factor
+ * @param bgframes frames of the background, all equal to the frame
+ * @return true if the check passed
+ */
+bool equal_frame(int channels, int factor, int bgframes) {
+    int rows = 96;
+    int cols = 128;
+    Mat frame = make_frame(rows, cols, channels, 7);
+    RoiMask roi(rows, cols);
+    BackgroundBuilder builder(vector<Mat>(bgframes, frame), &roi, 2, false);
+    builder.wait_ready();
+    Pyramid pyramid(&roi, factor, 0.1, 0.02, &builder);
+    float fraction = pyramid.coarse_fraction(frame);
+    bool ok = fraction == 0;
+    cout << (ok ? "ok" : "FAIL") << ": frame equal to the background, " << channels << " channels, factor " << factor <<
+        ", " << bgframes << " background frames, coarse fraction " << fraction << endl;
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    for (int channels : {3, 1}) {
+        for (int factor : {2, 4}) {
+            for (int bgframes : {1, 3}) ok = equal_frame(channels, factor, bgframes) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}